@@ -0,0 +1,60 @@
+/*
+ * Tiny benchmark harness for the desktop build.
+ * Each case is run in growing batches until it took long enough to be measured,
+ * results are written as CSV so they could be tracked between releases.
+*/
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+/* keep the compiler from optimizing away the benchmarked work */
+template<class T> inline void doNotOptimize(const T& value) {
+	asm volatile("" : : "r,m"(value) : "memory");
+}
+
+class Bench {
+public:
+	explicit Bench(FILE* out, uint64_t min_time_ns = 200000000ULL);
+
+	/*
+		run fn repeatedly and record one result row.
+		bytes is the amount of payload processed by a single call, 0 if not applicable.
+	*/
+	template<class F> void run(const char* suite, const char* name, uint32_t bytes, F fn) {
+		uint64_t iterations = 1;
+		uint64_t elapsed = 0;
+		for (;;) {
+			const auto start = now();
+			for (uint64_t i = 0; i < iterations; i++)
+				fn();
+			elapsed = now() - start;
+			if (elapsed >= min_time_ns)
+				break;
+			iterations *= elapsed < min_time_ns / 16 ? 8 : 2;
+		}
+		record(suite, name, bytes, iterations, elapsed);
+	}
+
+	/* a case which couldn't be run */
+	void skip(const char* suite, const char* name, const char* reason);
+
+private:
+	static uint64_t now();
+	void record(const char* suite, const char* name, uint32_t bytes, uint64_t iterations, uint64_t elapsed_ns);
+
+	FILE* out;
+	uint64_t min_time_ns;
+};
+
+/* suites */
+void bench_pdu(Bench& b);
+void bench_gsm7(Bench& b);
+void bench_parse(Bench& b);
+void bench_pool(Bench& b);
+void bench_journal(Bench& b);
+
+#endif // !BENCH_H
@@ -0,0 +1,131 @@
+/*
+ * GSM 7-bit packing/unpacking kernels of pdu.c against the septet at a time loops they replaced, on the same septets.
+ * ascii_to_gsm()/gsm_to_ascii() add the alphabet translation on top, they're measured on their own for plain ASCII
+ * (which is its own GSM code and isn't translated) and for text with a char to translate every 10 chars.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+extern "C" {
+#include "pdu.h"
+}
+
+#include "bench.h"
+
+/* the loops pdu.c used before its word kernels */
+static int loop_pack(const char* in, uint8_t len, uint8_t* out) {
+	uint8_t bytes_written = 0;
+	uint16_t bit_count = 0;
+	uint16_t bit_queue = 0;
+	while (len--) {
+		bit_queue |= (*in & 0x7F) << bit_count;
+		bit_count += 7;
+		if (bit_count >= 8) {
+			*out++ = (uint8_t)bit_queue;
+			bytes_written++;
+			bit_count -= 8;
+			bit_queue >>= 8;
+		}
+		in++;
+	}
+	if (bit_count > 0) {
+		*out++ = (uint8_t)bit_queue;
+		bytes_written++;
+	}
+
+	return bytes_written;
+}
+
+static int loop_unpack(const uint8_t* in, uint8_t in_len, uint8_t septets, char* out) {
+	uint16_t bit = 0;
+	for (uint8_t i = 0; i < septets; i++, bit += 7) {
+		const uint8_t byte = bit >> 3;
+		const uint8_t shift = bit & 7;
+		if (byte >= in_len)
+			return -1;
+
+		uint16_t v = in[byte] >> shift;
+		if (shift > 1 && byte + 1 < in_len)
+			v |= in[byte + 1] << (8 - shift);
+		*out++ = v & 0x7F;
+	}
+	*out = 0;
+
+	return septets;
+}
+
+static const uint8_t lengths[] = { 7, 70, 160 };
+
+void bench_gsm7(Bench& b) {
+	/* chars which are their own GSM code, the septets are the text itself */
+	static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789 .,!?";
+	char text[GSM_CODING_MAX_CHAR];
+	char mixed[GSM_CODING_MAX_CHAR];
+	for (int i = 0; i < GSM_CODING_MAX_CHAR; i++) {
+		text[i] = alphabet[(i * 37) % (sizeof(alphabet) - 1)];
+		mixed[i] = i % 10 == 9 ? '_' : text[i];
+	}
+
+	uint8_t packed[PDU_UD_MAX_LEN];
+	char unpacked[GSM_CODING_MAX_CHAR + 1];
+	char name[32];
+	for (auto len : lengths) {
+		/* both must agree before they're compared */
+		uint8_t expected[PDU_UD_MAX_LEN];
+		const int octets = loop_pack(text, len, expected);
+		if (pdu_pack_septets(text, len, 0, packed) != octets || memcmp(packed, expected, octets) != 0 ||
+			pdu_unpack_septets(packed, octets, 0, len, unpacked) != len || memcmp(unpacked, text, len) != 0 ||
+			ascii_to_gsm(text, len, packed) != octets || memcmp(packed, expected, octets) != 0) {
+			snprintf(name, sizeof(name), "%u", len);
+			b.skip("gsm7", name, "word kernels don't match the loops");
+			continue;
+		}
+
+		snprintf(name, sizeof(name), "pack_loop_%u", len);
+		b.run("gsm7", name, len, [&] {
+			doNotOptimize(loop_pack(text, len, packed));
+			doNotOptimize(packed);
+		});
+		snprintf(name, sizeof(name), "pack_word_%u", len);
+		b.run("gsm7", name, len, [&] {
+			doNotOptimize(pdu_pack_septets(text, len, 0, packed));
+			doNotOptimize(packed);
+		});
+
+		snprintf(name, sizeof(name), "unpack_loop_%u", len);
+		b.run("gsm7", name, len, [&] {
+			doNotOptimize(loop_unpack(expected, octets, len, unpacked));
+			doNotOptimize(unpacked);
+		});
+		snprintf(name, sizeof(name), "unpack_word_%u", len);
+		b.run("gsm7", name, len, [&] {
+			doNotOptimize(pdu_unpack_septets(expected, octets, 0, len, unpacked));
+			doNotOptimize(unpacked);
+		});
+
+		snprintf(name, sizeof(name), "ascii_to_gsm_%u", len);
+		b.run("gsm7", name, len, [&] {
+			doNotOptimize(ascii_to_gsm(text, len, packed));
+			doNotOptimize(packed);
+		});
+		snprintf(name, sizeof(name), "gsm_to_ascii_%u", len);
+		b.run("gsm7", name, len, [&] {
+			doNotOptimize(gsm_to_ascii(expected, octets, len, unpacked));
+			doNotOptimize(unpacked);
+		});
+
+		uint8_t mixed_packed[PDU_UD_MAX_LEN];
+		const int mixed_octets = ascii_to_gsm(mixed, len, mixed_packed);
+		snprintf(name, sizeof(name), "ascii_to_gsm_mixed_%u", len);
+		b.run("gsm7", name, len, [&] {
+			doNotOptimize(ascii_to_gsm(mixed, len, packed));
+			doNotOptimize(packed);
+		});
+		snprintf(name, sizeof(name), "gsm_to_ascii_mixed_%u", len);
+		b.run("gsm7", name, len, [&] {
+			doNotOptimize(gsm_to_ascii(mixed_packed, mixed_octets, len, unpacked));
+			doNotOptimize(unpacked);
+		});
+	}
+}
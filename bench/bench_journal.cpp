@@ -0,0 +1,69 @@
+/*
+ * SMSJournal overhead on the outbound queue: a batch of SMS is sent through the modem queue alone,
+ * through the journal with its group commit and through the journal committing every record.
+ * Modem answers right away, so the journal cost isn't hidden behind modem latency.
+ * The journal is written in /var/tmp, which is usually on disk unlike /tmp.
+*/
+
+#include <unistd.h>
+
+#include "MockModem.h"
+#include "SMSJournal.h"
+#include "bench.h"
+
+#define BATCH 64
+#define JOURNAL_PATH "/var/tmp/a6_bench.journal"
+
+static void script(MockModem& port) {
+	port.on("AT+CMGF", "\r\nOK\r\n");
+	port.on("AT+CSCA?", "\r\n+CSCA: \"+989350001500\",145\r\n\r\nOK\r\n");
+	port.on("AT+CMGS=", "\r\n> ");
+	port.onSubmit("\r\n+CMGS: 12\r\n\r\nOK\r\n");
+}
+
+void bench_journal(Bench& b) {
+	MockModem port;
+	script(port);
+	port.begin(115200);
+	A6lib modem(&port);
+	modem.setSMSFormat(Format_PDU);
+
+	char name[32];
+	snprintf(name, sizeof(name), "modem_queue_%d_sms", BATCH);
+	modem.setAsyncSMSQueue(true);
+	b.run("journal", name, 0, [&modem] {
+		for (uint8_t i = 0; i < BATCH; i++) {
+			if (!modem.queueSMS("989120000000", "Hello from the journal"))
+				modem.flushSMSQueue();
+		}
+		doNotOptimize(modem.flushSMSQueue());
+	});
+
+	SMSJournal journal(&modem);
+	unlink(JOURNAL_PATH);
+	if (journal.open(JOURNAL_PATH) < 0) {
+		b.skip("journal", "group_commit", "can't open " JOURNAL_PATH);
+		return;
+	}
+
+	snprintf(name, sizeof(name), "group_commit_%d_sms", BATCH);
+	b.run("journal", name, 0, [&journal] {
+		for (uint8_t i = 0; i < BATCH; i++)
+			journal.queueSMS("989120000000", "Hello from the journal");
+		doNotOptimize(journal.flush());
+	});
+
+	/* every record is on disk before the next step, as a per message fsync() would do */
+	journal.onSMSSent([](uint32_t, bool, uint8_t, void* ctx) { static_cast<SMSJournal*>(ctx)->commit(); }, &journal);
+	snprintf(name, sizeof(name), "commit_each_%d_sms", BATCH);
+	b.run("journal", name, 0, [&journal] {
+		for (uint8_t i = 0; i < BATCH; i++) {
+			journal.queueSMS("989120000000", "Hello from the journal");
+			journal.commit();
+		}
+		doNotOptimize(journal.flush());
+	});
+
+	journal.close();
+	unlink(JOURNAL_PATH);
+}
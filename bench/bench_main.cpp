@@ -0,0 +1,60 @@
+/*
+ * Benchmark runner for the desktop build.
+ * usage: program [output.csv] (default: stdout)
+*/
+
+#include "bench.h"
+
+#define STRINGIFY_(x) #x
+#define STRINGIFY(x) STRINGIFY_(x)
+#ifdef A6_VERSION
+#	define BENCH_VERSION STRINGIFY(A6_VERSION)
+#else
+#	define BENCH_VERSION "unknown"
+#endif
+
+Bench::Bench(FILE* out, uint64_t min_time_ns) : out{ out }, min_time_ns{ min_time_ns } {
+	fprintf(out, "version,suite,case,bytes,iterations,ns_per_op,ops_per_s,ns_per_byte\n");
+}
+
+uint64_t Bench::now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void Bench::record(const char* suite, const char* name, uint32_t bytes, uint64_t iterations, uint64_t elapsed_ns) {
+	const double ns_per_op = (double)elapsed_ns / iterations;
+	fprintf(out, "%s,%s,%s,%u,%llu,%.2f,%.0f,", BENCH_VERSION, suite, name, bytes, (unsigned long long)iterations, ns_per_op, 1e9 / ns_per_op);
+	if (bytes)
+		fprintf(out, "%.3f\n", ns_per_op / bytes);
+	else
+		fprintf(out, "\n");
+	fflush(out);
+}
+
+void Bench::skip(const char* suite, const char* name, const char* reason) {
+	fprintf(stderr, "skipped %s/%s: %s\n", suite, name, reason);
+}
+
+int main(int argc, char** argv) {
+	FILE* out = stdout;
+	if (argc > 1) {
+		out = fopen(argv[1], "w");
+		if (!out) {
+			perror(argv[1]);
+			return 1;
+		}
+	}
+
+	Bench b(out);
+	bench_pdu(b);
+	bench_gsm7(b);
+	bench_parse(b);
+	bench_pool(b);
+	bench_journal(b);
+
+	if (out != stdout)
+		fclose(out);
+	return 0;
+}
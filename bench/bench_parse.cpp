@@ -0,0 +1,98 @@
+/*
+ * reply field parsing (replyparser.h) against the sscanf formats it replaced.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "replyparser.h"
+
+#include "bench.h"
+
+static Span toSpan(const char* s) {
+	return Span{ s, static_cast<uint16_t>(strlen(s)) };
+}
+
+static const char csq[] = "\r\n+CSQ: 20,0\r\n\r\nOK\r\n";
+static const char creg[] = "\r\n+CREG: 1,5\r\n\r\nOK\r\n";
+static const char cclk[] = "\r\n+CCLK: \"18/01/02,10:11:12+14\"\r\n\r\nOK\r\n";
+static const char cmgr[] = "\r\n+CMGR: \"REC READ\",\"+989120000000\",\"\",\"18/01/02,10:11:12+14\"\r\nhello world\r\n\r\nOK\r\n";
+static const char clcc[] = "\r\n+CLCC: 1,0,0,0,0,\"+989120000000\",145\r\n\r\nOK\r\n";
+
+void bench_parse(Bench& b) {
+	b.run("parse", "csq_sscanf", sizeof(csq) - 1, [] {
+		int rssi = 0;
+		doNotOptimize(sscanf(csq, "%*[^+]+CSQ: %d,%*d%*s", &rssi));
+		doNotOptimize(rssi);
+	});
+	b.run("parse", "csq_fields", sizeof(csq) - 1, [] {
+		Span line, field;
+		int32_t rssi = 0;
+		doNotOptimize(findLine(toSpan(csq), "+CSQ:", &line) && splitFields(line, &field, 1) && parseInt(field, &rssi));
+		doNotOptimize(rssi);
+	});
+
+	b.run("parse", "creg_sscanf", sizeof(creg) - 1, [] {
+		int status = 0;
+		doNotOptimize(sscanf(creg, "%*[^+]+CREG: %*d,%d%*s", &status));
+		doNotOptimize(status);
+	});
+	b.run("parse", "creg_fields", sizeof(creg) - 1, [] {
+		Span line, fields[2];
+		int32_t status = 0;
+		doNotOptimize(findLine(toSpan(creg), "+CREG:", &line) && splitFields(line, fields, 2) == 2 && parseInt(fields[1], &status));
+		doNotOptimize(status);
+	});
+
+	b.run("parse", "cclk_sscanf", sizeof(cclk) - 1, [] {
+		struct tm time;
+		int tz = 0;
+		doNotOptimize(sscanf(cclk, "%*[^+]+CCLK: \"%d/%d/%d,%d:%d:%d+%d\"", &time.tm_year, &time.tm_mon, &time.tm_mday, &time.tm_hour, &time.tm_min, &time.tm_sec, &tz));
+		doNotOptimize(time);
+	});
+	b.run("parse", "cclk_fields", sizeof(cclk) - 1, [] {
+		Span line, field;
+		struct tm time;
+		int tz = 0;
+		doNotOptimize(findLine(toSpan(cclk), "+CCLK:", &line) && splitFields(line, &field, 1) && parseTime(field, &time, &tz));
+		doNotOptimize(time);
+	});
+
+	b.run("parse", "cmgr_sscanf", sizeof(cmgr) - 1, [] {
+		char phone[16], time[32], content[160];
+		doNotOptimize(sscanf(cmgr, "%*[^+]+CMGR: \"%*[^\"]\",\"+%[^\"]\",\"\",\"%[^\"]\"\r\n%[^OK]", phone, time, content));
+		doNotOptimize(content);
+	});
+	b.run("parse", "cmgr_fields", sizeof(cmgr) - 1, [] {
+		Span rest = toSpan(cmgr), line, fields[4];
+		char phone[16], time[32];
+		bool found = false;
+		while (!found && takeLine(&rest, &line))
+			found = spanStartsWith(line, "+CMGR:");
+		doNotOptimize(found && splitFields(line, fields, 4) == 4 && copyField(skipPlus(fields[1]), phone, sizeof(phone)) && copyField(fields[3], time, sizeof(time)));
+		/* the text goes up to the final OK */
+		auto end = rest.data;
+		while (takeLine(&rest, &line) && !(line.len == 2 && memcmp(line.data, "OK", 2) == 0)) {
+			if (line.len)
+				end = line.data + line.len;
+		}
+		doNotOptimize(end);
+	});
+
+	b.run("parse", "clcc_sscanf", sizeof(clcc) - 1, [] {
+		int index, direction, state, mode, multiparty, type;
+		char number[50];
+		doNotOptimize(sscanf(strstr(clcc, "+CLCC"), "+CLCC: %d,%d,%d,%d,%d,\"%[^\"]\",%d", &index, &direction, &state, &mode, &multiparty, number, &type));
+		doNotOptimize(type);
+	});
+	b.run("parse", "clcc_fields", sizeof(clcc) - 1, [] {
+		Span line, fields[7];
+		int32_t values[5], type = 0;
+		char number[50];
+		bool ok = findLine(toSpan(clcc), "+CLCC:", &line) && splitFields(line, fields, 7) == 7;
+		for (uint8_t i = 0; ok && i < 5; i++)
+			ok = parseInt(fields[i], &values[i]);
+		doNotOptimize(ok && copyField(fields[5], number, sizeof(number)) && parseInt(fields[6], &type));
+		doNotOptimize(type);
+	});
+}
@@ -0,0 +1,148 @@
+/*
+ * pdu_encode()/pdu_encodew(), UTF-8 text encoding and hex conversion throughput.
+*/
+
+#include <A6lib.h>
+
+extern "C" {
+#include "pdu.h"
+}
+
+#include "bench.h"
+
+/* A6lib::toHex() is internal */
+class HexAccess : public A6lib {
+public:
+	using A6lib::toHex;
+};
+
+/* counts and drops whatever is written to it */
+class NullPrint : public Print {
+public:
+	size_t write(uint8_t) override {
+		return ++count, 1;
+	}
+	size_t write(const uint8_t* buffer, size_t size) override {
+		doNotOptimize(buffer);
+		count += size;
+		return size;
+	}
+	using Print::write;
+
+	size_t count = 0;
+};
+
+static const struct Address {
+	const char* name;
+	const char* sca;
+	const char* phone;
+} addresses[] = {
+	{ "even_addr", "989350001500", "989120000000" },
+	{ "odd_addr", "98935000150", "98912000000" },
+};
+
+static const uint8_t lengths[] = { 1, 70, 160 };
+
+/* what callers did before the UTF-8 text format: transcode to a UCS2 buffer first */
+static uint8_t utf8ToUcs2(const char* in, uint16_t len, uint16_t* out) {
+	uint8_t n = 0;
+	for (uint16_t i = 0; i < len;) {
+		const uint8_t c = in[i];
+		if (c < 0x80) {
+			out[n++] = c;
+			i += 1;
+		} else if (c < 0xE0) {
+			out[n++] = ((c & 0x1F) << 6) | (in[i + 1] & 0x3F);
+			i += 2;
+		} else {
+			out[n++] = ((c & 0x0F) << 12) | ((in[i + 1] & 0x3F) << 6) | (in[i + 2] & 0x3F);
+			i += 3;
+		}
+	}
+
+	return n;
+}
+
+void bench_pdu(Bench& b) {
+	char text[GSM_CODING_MAX_CHAR];
+	uint16_t wtext[GSM_CODING_MAX_CHAR];
+	for (int i = 0; i < GSM_CODING_MAX_CHAR; i++) {
+		text[i] = 'a' + i % 26;
+		wtext[i] = 0x0627 + i % 26; /* arabic letters */
+	}
+
+	/* the same arabic letters in UTF-8, 2 bytes each */
+	char utf8[UCS2_CODING_MAX_CHAR * 2];
+	for (int i = 0; i < UCS2_CODING_MAX_CHAR; i++) {
+		utf8[i * 2] = 0xC0 | (wtext[i] >> 6);
+		utf8[i * 2 + 1] = 0x80 | (wtext[i] & 0x3F);
+	}
+
+	uint8_t pdu[PDU_MAX_LEN];
+	char name[64];
+	for (const auto& addr : addresses) {
+		for (auto len : lengths) {
+			snprintf(name, sizeof(name), "gsm7_%u_%s", len, addr.name);
+			b.run("pdu_encode", name, len, [&] {
+				doNotOptimize(pdu_encode(addr.sca, addr.phone, text, len, pdu, sizeof(pdu)));
+			});
+
+			snprintf(name, sizeof(name), "ucs2_%u_%s", len, addr.name);
+			if (len > UCS2_CODING_MAX_CHAR) {
+				b.skip("pdu_encodew", name, "more than a single UCS2 SMS can hold");
+				continue;
+			}
+			b.run("pdu_encodew", name, len * 2, [&] {
+				doNotOptimize(pdu_encodew(addr.sca, addr.phone, wtext, len, pdu, sizeof(pdu)));
+			});
+		}
+	}
+
+	for (auto len : lengths) {
+		if (len > UCS2_CODING_MAX_CHAR)
+			continue;
+
+		snprintf(name, sizeof(name), "buffered_%u", len);
+		b.run("pdu_encode_utf8", name, len * 2, [&] {
+			uint16_t buffer[UCS2_CODING_MAX_CHAR];
+			const pdu_text_t text = { buffer, utf8ToUcs2(utf8, len * 2, buffer), PDU_TEXT_UCS2 };
+			pdu_plan_t plan;
+			uint16_t from = 0;
+			if (pdu_plan(&text, 8, &plan) == 0)
+				doNotOptimize(pdu_encode_text_part(addresses[0].sca, addresses[0].phone, &text, &from, plan.coding, nullptr, pdu, sizeof(pdu)));
+		});
+
+		snprintf(name, sizeof(name), "stream_%u", len);
+		b.run("pdu_encode_utf8", name, len * 2, [&] {
+			const pdu_text_t text = { utf8, static_cast<uint16_t>(len * 2), PDU_TEXT_UTF8 };
+			pdu_plan_t plan;
+			uint16_t from = 0;
+			if (pdu_plan(&text, 8, &plan) == 0)
+				doNotOptimize(pdu_encode_text_part(addresses[0].sca, addresses[0].phone, &text, &from, plan.coding, nullptr, pdu, sizeof(pdu)));
+		});
+	}
+
+	/* hex conversion of the PDUs built above */
+	for (auto len : lengths) {
+		const int nbyte = pdu_encode(addresses[0].sca, addresses[0].phone, text, len, pdu, sizeof(pdu));
+		snprintf(name, sizeof(name), "gsm7_%u", len);
+		b.run("to_hex", name, nbyte, [&] {
+			String hex;
+			hex.reserve(nbyte * 2);
+			HexAccess::toHex(&hex, pdu, nbyte);
+			doNotOptimize(hex.length());
+		});
+
+		NullPrint sink;
+		snprintf(name, sizeof(name), "gsm7_%u", len);
+		b.run("to_hex_stream", name, nbyte, [&] {
+			HexAccess::toHex(&sink, pdu, nbyte);
+		});
+
+		snprintf(name, sizeof(name), "encode_to_hex_gsm7_%u", len);
+		b.run("pipeline", name, len, [&] {
+			const int n = pdu_encode(addresses[0].sca, addresses[0].phone, text, len, pdu, sizeof(pdu));
+			HexAccess::toHex(&sink, pdu, n);
+		});
+	}
+}
@@ -0,0 +1,51 @@
+/*
+ * ModemPool throughput against simulated modems: the same batch of SMS is sent by
+ * pools of 1 to 8 modems, ns_per_op should fall close to 1 / modem count.
+*/
+
+#include <ModemPool.h>
+
+#include "MockModem.h"
+#include "bench.h"
+
+#define BATCH 16
+#define PROMPT_LATENCY 5 // ms
+#define SUBMIT_LATENCY 20 // ms
+
+static void script(MockModem& port) {
+	port.on("AT+CREG?", "\r\n+CREG: 1,1\r\n\r\nOK\r\n", 1);
+	port.on("AT+CMGF", "\r\nOK\r\n", 1);
+	port.on("AT+CSCA?", "\r\n+CSCA: \"+989350001500\",145\r\n\r\nOK\r\n", 1);
+	port.on("AT+CMGS=", "\r\n> ", PROMPT_LATENCY);
+	port.onSubmit("\r\n+CMGS: 12\r\n\r\nOK\r\n", SUBMIT_LATENCY);
+}
+
+void bench_pool(Bench& b) {
+	static const uint8_t sizes[] = { 1, 2, 4, 8 };
+	for (const auto n : sizes) {
+		if (n > A6_POOL_SIZE) {
+			b.skip("pool", "flush", "A6_POOL_SIZE is too small");
+			continue;
+		}
+
+		MockModem ports[8];
+		ModemPool pool;
+		for (uint8_t i = 0; i < n; i++) {
+			script(ports[i]);
+			ports[i].begin(115200);
+			pool.addModem(&ports[i]);
+		}
+		if (pool.begin() != n) {
+			b.skip("pool", "flush", "modems are not healthy");
+			continue;
+		}
+
+		char name[32];
+		snprintf(name, sizeof(name), "flush_%d_sms_%d_modem", BATCH, n);
+		b.run("pool", name, 0, [&pool] {
+			for (uint8_t i = 0; i < BATCH; i++)
+				pool.queueSMS("989120000000", "Hello from the pool");
+			doNotOptimize(pool.flush());
+		});
+	}
+}
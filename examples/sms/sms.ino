@@ -40,8 +40,8 @@ void sms_sent_event() {
 	/* send PDU now */
 	if (!once) {
 		once = true;
-		uint16_t content[] = { 0x0048, 0x0069, 0x0021 }; // Hi!
-		modem.sendPDU(DST_NUM, content, sizeof(content) / sizeof(uint16_t));
+		const char content[] = "Hi! سلام"; // UTF-8, it's sent in UCS2 as it has non GSM chars
+		modem.sendPDU(DST_NUM, content, strlen(content));
 	}
 #endif
 }
@@ -0,0 +1,499 @@
+#include "Arduino.h"
+
+#include <time.h>
+#include <sched.h>
+
+static NativeHeapStats heap_stats;
+
+NativeHeapStats& nativeHeapStats() {
+	return heap_stats;
+}
+
+static unsigned long long now_us() {
+	static unsigned long long start = 0;
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	const unsigned long long us = ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+	if (start == 0)
+		start = us;
+
+	return us - start;
+}
+
+unsigned long millis() {
+	return now_us() / 1000;
+}
+
+unsigned long micros() {
+	return now_us();
+}
+
+void delay(unsigned long ms) {
+	struct timespec ts = { static_cast<time_t>(ms / 1000), static_cast<long>(ms % 1000) * 1000000L };
+	nanosleep(&ts, nullptr);
+}
+
+void delayMicroseconds(unsigned int us) {
+	struct timespec ts = { static_cast<time_t>(us / 1000000), static_cast<long>(us % 1000000) * 1000L };
+	nanosleep(&ts, nullptr);
+}
+
+void yield() {
+	sched_yield();
+}
+
+void pinMode(uint8_t, uint8_t) {}
+
+void digitalWrite(uint8_t, uint8_t) {}
+
+int digitalRead(uint8_t) {
+	return LOW;
+}
+
+/* String */
+String::String(const char* cstr) {
+	if (cstr)
+		concat(cstr, strlen(cstr));
+}
+
+String::String(const String& str) {
+	concat(str.c_str(), str.len);
+}
+
+String::String(String&& str) : buffer{ str.buffer }, capacity{ str.capacity }, len{ str.len } {
+	str.buffer = nullptr;
+	str.capacity = 0;
+	str.len = 0;
+}
+
+String::String(const __FlashStringHelper* str) : String(reinterpret_cast<const char*>(str)) {
+
+}
+
+String::String(char c) {
+	concat(&c, 1);
+}
+
+String::String(unsigned char value, unsigned char base) : String(static_cast<unsigned long>(value), base) {
+
+}
+
+String::String(int value, unsigned char base) : String(static_cast<long>(value), base) {
+
+}
+
+String::String(unsigned int value, unsigned char base) : String(static_cast<unsigned long>(value), base) {
+
+}
+
+String::String(long value, unsigned char base) {
+	if (value < 0 && base == 10) {
+		concat('-');
+		concat(String(static_cast<unsigned long>(-value), base));
+	} else {
+		*this = String(static_cast<unsigned long>(value), base);
+	}
+}
+
+String::String(unsigned long value, unsigned char base) {
+	char buf[8 * sizeof(long) + 1];
+	char* p = buf + sizeof(buf) - 1;
+	*p = 0;
+	if (base < 2)
+		base = 10;
+	do {
+		const unsigned long d = value % base;
+		*--p = d < 10 ? '0' + d : 'a' + d - 10;
+		value /= base;
+	} while (value);
+	concat(p, strlen(p));
+}
+
+String::String(double value, unsigned char decimals) {
+	char buf[64];
+	snprintf(buf, sizeof(buf), "%.*f", decimals, value);
+	concat(buf, strlen(buf));
+}
+
+String::~String() {
+	invalidate();
+}
+
+void String::invalidate() {
+	if (buffer) {
+		free(buffer);
+		heap_stats.frees++;
+	}
+	buffer = nullptr;
+	capacity = len = 0;
+}
+
+String& String::operator=(const String& rhs) {
+	if (this == &rhs)
+		return *this;
+
+	len = 0;
+	concat(rhs.c_str(), rhs.len);
+	return *this;
+}
+
+String& String::operator=(String&& rhs) {
+	if (this == &rhs)
+		return *this;
+
+	invalidate();
+	buffer = rhs.buffer;
+	capacity = rhs.capacity;
+	len = rhs.len;
+	rhs.buffer = nullptr;
+	rhs.capacity = rhs.len = 0;
+	return *this;
+}
+
+String& String::operator=(const char* cstr) {
+	len = 0;
+	if (cstr)
+		concat(cstr, strlen(cstr));
+	return *this;
+}
+
+unsigned char String::reserve(unsigned int size) {
+	if (buffer && capacity >= size)
+		return 1;
+
+	auto p = static_cast<char*>(realloc(buffer, size + 1));
+	if (!p)
+		return 0;
+
+	heap_stats.allocations++;
+	heap_stats.bytes += size + 1;
+	if (!buffer)
+		p[0] = 0;
+	buffer = p;
+	capacity = size;
+	return 1;
+}
+
+unsigned char String::concat(const char* cstr, unsigned int length) {
+	if (!cstr)
+		return 0;
+
+	if (!reserve(len + length))
+		return 0;
+
+	memmove(buffer + len, cstr, length);
+	len += length;
+	buffer[len] = 0;
+	return 1;
+}
+
+unsigned char String::concat(const String& str) {
+	return concat(str.c_str(), str.len);
+}
+
+unsigned char String::concat(const char* cstr) {
+	return cstr ? concat(cstr, strlen(cstr)) : 0;
+}
+
+unsigned char String::concat(const __FlashStringHelper* str) {
+	return concat(reinterpret_cast<const char*>(str));
+}
+
+unsigned char String::concat(char c) {
+	return concat(&c, 1);
+}
+
+unsigned char String::concat(unsigned char num) {
+	return concat(String(num));
+}
+
+unsigned char String::concat(int num) {
+	return concat(String(num));
+}
+
+unsigned char String::concat(unsigned int num) {
+	return concat(String(num));
+}
+
+unsigned char String::concat(long num) {
+	return concat(String(num));
+}
+
+unsigned char String::concat(unsigned long num) {
+	return concat(String(num));
+}
+
+String operator+(const String& lhs, const String& rhs) {
+	String s(lhs);
+	s.concat(rhs);
+	return s;
+}
+
+String operator+(const String& lhs, const char* rhs) {
+	String s(lhs);
+	s.concat(rhs);
+	return s;
+}
+
+String operator+(const char* lhs, const String& rhs) {
+	String s(lhs);
+	s.concat(rhs);
+	return s;
+}
+
+String operator+(const String& lhs, char rhs) {
+	String s(lhs);
+	s.concat(rhs);
+	return s;
+}
+
+int String::compareTo(const String& s) const {
+	return strcmp(c_str(), s.c_str());
+}
+
+unsigned char String::equals(const String& s) const {
+	return len == s.len && compareTo(s) == 0;
+}
+
+unsigned char String::equals(const char* cstr) const {
+	return strcmp(c_str(), cstr ? cstr : "") == 0;
+}
+
+unsigned char String::startsWith(const String& prefix) const {
+	return len >= prefix.len && strncmp(c_str(), prefix.c_str(), prefix.len) == 0;
+}
+
+unsigned char String::endsWith(const String& suffix) const {
+	return len >= suffix.len && strcmp(c_str() + len - suffix.len, suffix.c_str()) == 0;
+}
+
+char String::charAt(unsigned int index) const {
+	return index < len ? buffer[index] : 0;
+}
+
+void String::setCharAt(unsigned int index, char c) {
+	if (index < len)
+		buffer[index] = c;
+}
+
+void String::toCharArray(char* buf, unsigned int bufsize, unsigned int index) const {
+	if (!bufsize || !buf)
+		return;
+
+	if (index >= len) {
+		buf[0] = 0;
+		return;
+	}
+
+	unsigned int n = bufsize - 1;
+	if (n > len - index)
+		n = len - index;
+	memcpy(buf, buffer + index, n);
+	buf[n] = 0;
+}
+
+int String::indexOf(char ch, unsigned int fromIndex) const {
+	if (fromIndex >= len)
+		return -1;
+
+	auto p = static_cast<const char*>(memchr(buffer + fromIndex, ch, len - fromIndex));
+	return p ? p - buffer : -1;
+}
+
+int String::indexOf(const char* str, unsigned int fromIndex) const {
+	if (!str || fromIndex >= len)
+		return -1;
+
+	auto p = strstr(buffer + fromIndex, str);
+	return p ? p - buffer : -1;
+}
+
+int String::lastIndexOf(char ch) const {
+	return len ? lastIndexOf(ch, len - 1) : -1;
+}
+
+int String::lastIndexOf(char ch, unsigned int fromIndex) const {
+	if (fromIndex >= len)
+		return -1;
+
+	for (int i = fromIndex; i >= 0; i--) {
+		if (buffer[i] == ch)
+			return i;
+	}
+
+	return -1;
+}
+
+String String::substring(unsigned int beginIndex, unsigned int endIndex) const {
+	if (beginIndex > endIndex) {
+		auto tmp = endIndex;
+		endIndex = beginIndex;
+		beginIndex = tmp;
+	}
+	if (beginIndex >= len)
+		return String();
+	if (endIndex > len)
+		endIndex = len;
+
+	String out;
+	out.concat(buffer + beginIndex, endIndex - beginIndex);
+	return out;
+}
+
+void String::replace(const String& find, const String& replace) {
+	if (len == 0 || find.len == 0)
+		return;
+
+	String out;
+	const char* p = buffer;
+	const char* hit;
+	while ((hit = strstr(p, find.c_str())) != nullptr) {
+		out.concat(p, hit - p);
+		out.concat(replace);
+		p = hit + find.len;
+	}
+	out.concat(p);
+	*this = static_cast<String&&>(out);
+}
+
+void String::remove(unsigned int index) {
+	remove(index, static_cast<unsigned int>(-1));
+}
+
+void String::remove(unsigned int index, unsigned int count) {
+	if (index >= len)
+		return;
+
+	if (count > len - index)
+		count = len - index;
+	memmove(buffer + index, buffer + index + count, len - index - count);
+	len -= count;
+	buffer[len] = 0;
+}
+
+void String::toUpperCase() {
+	for (unsigned int i = 0; i < len; i++)
+		buffer[i] = toupper(static_cast<unsigned char>(buffer[i]));
+}
+
+void String::toLowerCase() {
+	for (unsigned int i = 0; i < len; i++)
+		buffer[i] = tolower(static_cast<unsigned char>(buffer[i]));
+}
+
+void String::trim() {
+	if (len == 0)
+		return;
+
+	unsigned int begin = 0;
+	while (begin < len && isspace(static_cast<unsigned char>(buffer[begin])))
+		begin++;
+	unsigned int end = len;
+	while (end > begin && isspace(static_cast<unsigned char>(buffer[end - 1])))
+		end--;
+	len = end - begin;
+	memmove(buffer, buffer + begin, len);
+	buffer[len] = 0;
+}
+
+long String::toInt() const {
+	return len ? atol(buffer) : 0;
+}
+
+/* Print */
+size_t Print::write(const uint8_t* buffer, size_t size) {
+	size_t n = 0;
+	while (size--)
+		n += write(*buffer++);
+	return n;
+}
+
+size_t Print::print(const __FlashStringHelper* str) {
+	return write(reinterpret_cast<const char*>(str));
+}
+
+size_t Print::print(const String& str) {
+	return write(str.c_str(), str.length());
+}
+
+size_t Print::print(const char* str) {
+	return write(str);
+}
+
+size_t Print::print(char c) {
+	return write(static_cast<uint8_t>(c));
+}
+
+size_t Print::print(unsigned char n, int base) {
+	return print(static_cast<unsigned long>(n), base);
+}
+
+size_t Print::print(int n, int base) {
+	return print(static_cast<long>(n), base);
+}
+
+size_t Print::print(unsigned int n, int base) {
+	return print(static_cast<unsigned long>(n), base);
+}
+
+size_t Print::print(long n, int base) {
+	char buf[24];
+	if (base == DEC)
+		snprintf(buf, sizeof(buf), "%ld", n);
+	else
+		snprintf(buf, sizeof(buf), base == HEX ? "%lX" : "%lo", static_cast<unsigned long>(n));
+	return write(buf);
+}
+
+size_t Print::print(unsigned long n, int base) {
+	char buf[24];
+	snprintf(buf, sizeof(buf), base == HEX ? "%lX" : base == OCT ? "%lo" : "%lu", n);
+	return write(buf);
+}
+
+size_t Print::print(double n, int digits) {
+	char buf[64];
+	snprintf(buf, sizeof(buf), "%.*f", digits, n);
+	return write(buf);
+}
+
+size_t Print::println() {
+	return write("\r\n");
+}
+
+/* Stream */
+int Stream::timedRead() {
+	const auto start = millis();
+	do {
+		const int c = read();
+		if (c >= 0)
+			return c;
+		yield();
+	} while (millis() - start < _timeout);
+
+	return -1;
+}
+
+size_t Stream::readBytes(char* buffer, size_t length) {
+	size_t count = 0;
+	while (count < length) {
+		const int c = timedRead();
+		if (c < 0)
+			break;
+		*buffer++ = static_cast<char>(c);
+		count++;
+	}
+
+	return count;
+}
+
+String Stream::readString() {
+	String ret;
+	int c = timedRead();
+	while (c >= 0) {
+		ret.concat(static_cast<char>(c));
+		c = timedRead();
+	}
+
+	return ret;
+}
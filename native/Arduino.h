@@ -0,0 +1,240 @@
+/*
+ * Minimal Arduino core shim for building A6lib on a desktop host.
+ * Only what A6lib and its examples use is provided.
+*/
+
+#ifndef ARDUINO_H
+#define ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <math.h>
+
+#define ARDUINO_NATIVE 1
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+class __FlashStringHelper;
+#define PROGMEM
+#define PGM_P const char*
+#define PSTR(s) (s)
+#define F(s) (reinterpret_cast<const __FlashStringHelper*>(PSTR(s)))
+#define FPSTR(p) (reinterpret_cast<const __FlashStringHelper*>(p))
+#define pgm_read_byte(addr) (*reinterpret_cast<const uint8_t*>(addr))
+#define pgm_read_word(addr) (*reinterpret_cast<const uint16_t*>(addr))
+#define pgm_read_dword(addr) (*reinterpret_cast<const uint32_t*>(addr))
+#define pgm_read_ptr(addr) (*reinterpret_cast<const void* const*>(addr))
+#define strlen_P strlen
+#define strcpy_P strcpy
+#define strncpy_P strncpy
+#define memcmp_P memcmp
+#define memcpy_P memcpy
+#define strcmp_P strcmp
+#define strncmp_P strncmp
+#define vsnprintf_P vsnprintf
+#define snprintf_P snprintf
+#define sscanf_P sscanf
+
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define LOW 0x0
+#define HIGH 0x1
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+template<class A, class B> inline A min(A a, B b) {
+	return a < b ? a : (A)b;
+}
+
+template<class A, class B> inline A max(A a, B b) {
+	return a > b ? a : (A)b;
+}
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield();
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+
+/* heap usage of String objects, so allocation behaviour could be measured */
+struct NativeHeapStats {
+	unsigned long allocations;
+	unsigned long frees;
+	unsigned long bytes;
+};
+NativeHeapStats& nativeHeapStats();
+
+class String {
+public:
+	String(const char* cstr = "");
+	String(const String& str);
+	String(String&& str);
+	String(const __FlashStringHelper* str);
+	explicit String(char c);
+	explicit String(unsigned char value, unsigned char base = 10);
+	explicit String(int value, unsigned char base = 10);
+	explicit String(unsigned int value, unsigned char base = 10);
+	explicit String(long value, unsigned char base = 10);
+	explicit String(unsigned long value, unsigned char base = 10);
+	explicit String(double value, unsigned char decimals = 2);
+	~String();
+
+	String& operator=(const String& rhs);
+	String& operator=(String&& rhs);
+	String& operator=(const char* cstr);
+
+	unsigned char reserve(unsigned int size);
+	unsigned int length() const {
+		return len;
+	}
+	const char* c_str() const {
+		return buffer ? buffer : "";
+	}
+
+	unsigned char concat(const String& str);
+	unsigned char concat(const char* cstr);
+	unsigned char concat(const __FlashStringHelper* str);
+	unsigned char concat(char c);
+	unsigned char concat(unsigned char num);
+	unsigned char concat(int num);
+	unsigned char concat(unsigned int num);
+	unsigned char concat(long num);
+	unsigned char concat(unsigned long num);
+
+	template<class T> String& operator+=(const T& rhs) {
+		concat(rhs);
+		return *this;
+	}
+
+	friend String operator+(const String& lhs, const String& rhs);
+	friend String operator+(const String& lhs, const char* rhs);
+	friend String operator+(const char* lhs, const String& rhs);
+	friend String operator+(const String& lhs, char rhs);
+
+	int compareTo(const String& s) const;
+	unsigned char equals(const String& s) const;
+	unsigned char equals(const char* cstr) const;
+	bool operator==(const String& rhs) const {
+		return equals(rhs);
+	}
+	bool operator==(const char* cstr) const {
+		return equals(cstr);
+	}
+	bool operator!=(const String& rhs) const {
+		return !equals(rhs);
+	}
+	bool operator!=(const char* cstr) const {
+		return !equals(cstr);
+	}
+	unsigned char startsWith(const String& prefix) const;
+	unsigned char endsWith(const String& suffix) const;
+
+	char charAt(unsigned int index) const;
+	void setCharAt(unsigned int index, char c);
+	char operator[](unsigned int index) const {
+		return charAt(index);
+	}
+	void toCharArray(char* buf, unsigned int bufsize, unsigned int index = 0) const;
+
+	int indexOf(char ch, unsigned int fromIndex = 0) const;
+	int indexOf(const char* str, unsigned int fromIndex = 0) const;
+	int indexOf(const String& str, unsigned int fromIndex = 0) const {
+		return indexOf(str.c_str(), fromIndex);
+	}
+	int lastIndexOf(char ch) const;
+	int lastIndexOf(char ch, unsigned int fromIndex) const;
+	String substring(unsigned int beginIndex) const {
+		return substring(beginIndex, len);
+	}
+	String substring(unsigned int beginIndex, unsigned int endIndex) const;
+
+	void replace(const String& find, const String& replace);
+	void remove(unsigned int index);
+	void remove(unsigned int index, unsigned int count);
+	void toUpperCase();
+	void toLowerCase();
+	void trim();
+	long toInt() const;
+
+protected:
+	unsigned char concat(const char* cstr, unsigned int length);
+	void invalidate();
+
+	char* buffer = nullptr;
+	unsigned int capacity = 0;
+	unsigned int len = 0;
+};
+
+class Print {
+public:
+	virtual ~Print() {}
+	virtual size_t write(uint8_t) = 0;
+	virtual size_t write(const uint8_t* buffer, size_t size);
+	virtual int availableForWrite() {
+		return 0;
+	}
+	virtual void flush() {}
+
+	size_t write(const char* str) {
+		return str ? write(reinterpret_cast<const uint8_t*>(str), strlen(str)) : 0;
+	}
+	size_t write(const char* buffer, size_t size) {
+		return write(reinterpret_cast<const uint8_t*>(buffer), size);
+	}
+
+	size_t print(const __FlashStringHelper* str);
+	size_t print(const String& str);
+	size_t print(const char* str);
+	size_t print(char c);
+	size_t print(unsigned char n, int base = DEC);
+	size_t print(int n, int base = DEC);
+	size_t print(unsigned int n, int base = DEC);
+	size_t print(long n, int base = DEC);
+	size_t print(unsigned long n, int base = DEC);
+	size_t print(double n, int digits = 2);
+
+	size_t println();
+	template<class T> size_t println(const T& arg) {
+		size_t n = print(arg);
+		return n + println();
+	}
+	template<class T> size_t println(const T& arg, int fmt) {
+		size_t n = print(arg, fmt);
+		return n + println();
+	}
+};
+
+class Stream : public Print {
+public:
+	virtual int available() = 0;
+	virtual int read() = 0;
+	virtual int peek() = 0;
+
+	void setTimeout(unsigned long timeout) {
+		_timeout = timeout;
+	}
+	unsigned long getTimeout() const {
+		return _timeout;
+	}
+
+	size_t readBytes(char* buffer, size_t length);
+	String readString();
+
+protected:
+	int timedRead();
+
+	unsigned long _timeout = 1000;
+};
+
+#endif // !ARDUINO_H
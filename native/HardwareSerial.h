@@ -0,0 +1,24 @@
+#ifndef HARDWARESERIAL_H
+#define HARDWARESERIAL_H
+
+#include "Arduino.h"
+
+/*
+ * On desktop there's no UART, so this is the base class of every serial
+ * transport (e.g MockModem) which A6lib could be constructed with.
+*/
+class HardwareSerial : public Stream {
+public:
+	virtual void begin(unsigned long baud) {
+		this->baud = baud;
+	}
+	virtual void end() {}
+	unsigned long baudRate() const {
+		return baud;
+	}
+
+protected:
+	unsigned long baud = 0;
+};
+
+#endif // !HARDWARESERIAL_H
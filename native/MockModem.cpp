@@ -0,0 +1,114 @@
+#include "MockModem.h"
+
+#include <stdlib.h>
+
+#define CTRLZ 0x1A
+
+void MockModem::on(const std::string& prefix, const std::string& reply, unsigned long latency) {
+	on(prefix, [reply](const std::string&) { return reply; }, latency);
+}
+
+void MockModem::on(const std::string& prefix, reply_fn_t reply, unsigned long latency) {
+	rules.push_back(Rule{ prefix, reply, latency });
+}
+
+void MockModem::onSubmit(const std::string& reply, unsigned long latency) {
+	onSubmit([reply](const std::string&) { return reply; }, latency);
+}
+
+void MockModem::onSubmit(reply_fn_t reply, unsigned long latency) {
+	submit_rule = Rule{ std::string(), reply, latency };
+}
+
+void MockModem::inject(const std::string& data, unsigned long latency) {
+	auto due = millis() + latency;
+	/* keep the order of replies */
+	if (!rx.empty() && rx.back().due > due)
+		due = rx.back().due;
+	rx.push_back(Chunk{ due, data });
+}
+
+int MockModem::available() {
+	const auto now = millis();
+	size_t n = 0;
+	for (const auto& c : rx) {
+		if (c.due > now)
+			break;
+		n += c.data.size();
+	}
+
+	return n - rx_pos;
+}
+
+int MockModem::peek() {
+	if (!available())
+		return -1;
+
+	return static_cast<uint8_t>(rx.front().data[rx_pos]);
+}
+
+int MockModem::read() {
+	const int c = peek();
+	if (c < 0)
+		return c;
+
+	if (++rx_pos == rx.front().data.size()) {
+		rx.pop_front();
+		rx_pos = 0;
+	}
+
+	return c;
+}
+
+size_t MockModem::write(uint8_t c) {
+	tx += static_cast<char>(c);
+	if (modem_baud && baud != modem_baud) {
+		/* modem only sees noise, which it takes as an unknown line */
+		line = "\xFF";
+		return 1;
+	}
+	if (c == '\r' || c == CTRLZ) {
+		received(line, c == CTRLZ);
+		line.clear();
+	} else if (c != '\n') {
+		line += static_cast<char>(c);
+	}
+
+	return 1;
+}
+
+void MockModem::received(const std::string& line, bool submit) {
+	if (!responsive || (line.empty() && !submit))
+		return;
+
+	commands++;
+	if (submit) {
+		if (submit_rule.reply)
+			reply(submit_rule.reply(line), submit_rule.latency);
+		return;
+	}
+
+	if (modem_baud && line.compare(0, 7, "AT+IPR=") == 0) {
+		/* OK goes out at the old rate */
+		reply("\r\nOK\r\n", 0);
+		modem_baud = strtoul(line.c_str() + 7, nullptr, 10);
+		return;
+	}
+
+	for (auto r = rules.rbegin(); r != rules.rend(); ++r) {
+		if (line.compare(0, r->prefix.size(), r->prefix) == 0) {
+			reply(r->reply(line), r->latency);
+			return;
+		}
+	}
+
+	if (error_by_default)
+		reply("\r\nERROR\r\n", 0);
+}
+
+void MockModem::reply(std::string data, unsigned long latency) {
+	/* a bit error in every reply */
+	if (max_reliable && modem_baud > max_reliable && data.size() > 2)
+		data[data.size() / 2] ^= 0x20;
+	inject(data, latency);
+}
@@ -0,0 +1,104 @@
+/*
+ * A scriptable in-memory modem stand-in for running A6lib on a desktop host.
+ * Commands written by A6lib are matched against the registered rules by prefix,
+ * the reply of the matched rule becomes readable after its latency.
+*/
+
+#ifndef MOCKMODEM_H
+#define MOCKMODEM_H
+
+#include <deque>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "HardwareSerial.h"
+
+class MockModem : public HardwareSerial {
+public:
+	typedef std::function<std::string(const std::string& line)> reply_fn_t;
+
+	/* reply to every command line starting with prefix, later rules take precedence */
+	void on(const std::string& prefix, const std::string& reply, unsigned long latency = 0);
+	void on(const std::string& prefix, reply_fn_t reply, unsigned long latency = 0);
+	/* reply to the data terminated by Ctrl-Z (SMS body) */
+	void onSubmit(const std::string& reply, unsigned long latency = 0);
+	void onSubmit(reply_fn_t reply, unsigned long latency = 0);
+	/* make unsolicited data readable after latency */
+	void inject(const std::string& data, unsigned long latency = 0);
+	/* a dead modem takes everything and never replies */
+	void setResponsive(bool responsive) {
+		this->responsive = responsive;
+	}
+	/* reply to commands without any matching rule with ERROR */
+	void setReplyErrorByDefault(bool enable) {
+		error_by_default = enable;
+	}
+	/*
+		talk at baud only (0 -> any rate): lines written at another rate are lost and AT+IPR moves modem to the new rate.
+		replies at a rate above max_reliable get corrupted (0 -> never)
+	*/
+	void setModemBaud(unsigned long baud, unsigned long max_reliable = 0) {
+		modem_baud = baud;
+		this->max_reliable = max_reliable;
+	}
+	unsigned long modemBaud() const {
+		return modem_baud;
+	}
+
+	/* everything A6lib wrote so far */
+	const std::string& sent() const {
+		return tx;
+	}
+	void clearSent() {
+		tx.clear();
+	}
+	unsigned long commandCount() const {
+		return commands;
+	}
+
+	int available() override;
+	int read() override;
+	int peek() override;
+	size_t write(uint8_t c) override;
+	using Print::write;
+	int availableForWrite() override {
+		return write_room;
+	}
+	/*
+		free space of the simulated tx buffer. 0 from the start is a port which doesn't report it (A6lib writes A6_TX_CHUNK at a time),
+		0 after some room was reported is a full buffer (A6lib writes nothing until there is room again)
+	*/
+	void setWriteRoom(int room) {
+		write_room = room;
+	}
+
+private:
+	struct Rule {
+		std::string prefix;
+		reply_fn_t reply;
+		unsigned long latency;
+	};
+	struct Chunk {
+		unsigned long due;
+		std::string data;
+	};
+
+	void received(const std::string& line, bool submit);
+	void reply(std::string data, unsigned long latency);
+
+	std::vector<Rule> rules;
+	Rule submit_rule{ std::string(), nullptr, 0 };
+	std::deque<Chunk> rx;
+	size_t rx_pos = 0;
+	std::string line;
+	std::string tx;
+	unsigned long commands = 0;
+	bool responsive = true;
+	bool error_by_default = true;
+	unsigned long modem_baud = 0;
+	unsigned long max_reliable = 0;
+	int write_room = 256;
+};
+
+#endif // !MOCKMODEM_H
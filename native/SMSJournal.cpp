@@ -0,0 +1,523 @@
+#include "SMSJournal.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <stdio.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <vector>
+
+/*
+	journal layout: a Header, then the records back to back, each one 4-byte aligned.
+	the file is grown ahead of the records by A6_JOURNAL_GROW_SIZE, the zeros after the last record end it.
+	a SMS is unfinished until its Rec_Sent or Rec_Failed record, replay queues only those again.
+*/
+#define JOURNAL_MAGIC "A6SJ"
+#define JOURNAL_VERSION 1
+
+struct Header {
+	char magic[4];
+	uint32_t version;
+	uint32_t next_job; /* so job ids aren't reused after compaction */
+	uint32_t reserved;
+};
+
+struct Record {
+	uint32_t crc; /* CRC32 of the rest of the record, payload included */
+	uint32_t job;
+	uint16_t len; /* of the payload */
+	uint8_t type;
+	uint8_t mr; /* message reference of Rec_Sent */
+};
+
+enum RecordType {
+	Rec_Queued = 1, /* payload: number and content, both NUL terminated */
+	Rec_Submitted, /* handed to A6lib's queue, AT+CMGS may not have gone out yet */
+	Rec_Sent,
+	Rec_Failed,
+};
+
+static size_t recordSize(uint16_t len) {
+	return (sizeof(Record) + len + 3) & ~static_cast<size_t>(3);
+}
+
+static uint32_t crc32(uint32_t crc, const uint8_t* data, size_t len) {
+	static uint32_t table[256];
+	if (!table[1]) {
+		for (uint32_t i = 0; i < 256; i++) {
+			uint32_t c = i;
+			for (uint8_t k = 0; k < 8; k++)
+				c = c & 1 ? 0xEDB88320UL ^ (c >> 1) : c >> 1;
+			table[i] = c;
+		}
+	}
+
+	crc = ~crc;
+	while (len--)
+		crc = table[(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+	return ~crc;
+}
+
+static uint32_t recordCrc(const uint8_t* record, uint16_t len) {
+	return crc32(0, record + sizeof(uint32_t), sizeof(Record) - sizeof(uint32_t) + len);
+}
+
+/* make a rename inside dir durable */
+static bool syncDir(const char* path) {
+	char copy[256];
+	snprintf(copy, sizeof(copy), "%s", path);
+	const int dir = ::open(dirname(copy), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (dir < 0)
+		return false;
+
+	const bool synced = fsync(dir) == 0;
+	::close(dir);
+	return synced;
+}
+
+SMSJournal::SMSJournal(A6lib* modem) : modem{ modem } {
+	modem->setAsyncSMSQueue(true);
+	modem->onQueuedSMSSent(&SMSJournal::jobDone, this);
+}
+
+SMSJournal::~SMSJournal() {
+	close();
+	modem->onQueuedSMSSent(nullptr);
+}
+
+/*!
+ * Open the journal at \a path, it's created if it doesn't exist, and switch modem to SMSFormat::Format_PDU.
+ * The SMS it has which didn't finish (including the ones which were handed to A6lib but have no result) are queued again
+ * in their original order, then the journal is rewritten with only them. The journal stays locked until SMSJournal::close().
+ * \param path the journal file, a temporary "<path>.tmp" is created next to it while it's rewritten
+ * \return the number of SMS queued again, or -1 if the journal can't be opened, it's not a SMS journal,
+ * another process has it open or modem can't switch to PDU mode
+ */
+int32_t SMSJournal::open(const char* path) {
+	close();
+	snprintf(this->path, sizeof(this->path), "%s", path);
+	if (!modem->setSMSFormat(Format_PDU)) {
+		fprintf(stderr, "%s: modem can't switch to PDU mode\n", path);
+		return -1;
+	}
+	fd = ::open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		perror(path);
+		return -1;
+	}
+	if (!lock()) {
+		close();
+		return -1;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		perror(path);
+		close();
+		return -1;
+	}
+	if (st.st_size > 0 && (!remap(st.st_size) || !replay())) {
+		close();
+		return -1;
+	}
+	if (!compact()) {
+		close();
+		return -1;
+	}
+
+	return jobs.size();
+}
+
+/*!
+ * Commit and close the journal. The SMS which didn't finish stay in it for the next SMSJournal::open().
+ */
+void SMSJournal::close() {
+	if (map) {
+		commit();
+		munmap(map, map_size);
+	}
+	if (fd >= 0)
+		::close(fd);
+	fd = -1;
+	map = nullptr;
+	map_size = tail = synced = live = 0;
+	jobs.clear();
+}
+
+/*!
+ * The main handler of the journal, it needs to be called inside main loop regularly.
+ * It calls A6lib::handle(), hands the waiting SMS to A6lib's queue and commits the records of the last A6_JOURNAL_COMMIT_MS.
+ */
+void SMSJournal::handle() {
+	modem->handle();
+	if (!map)
+		return;
+
+	dispatch();
+	if (tail != synced && millis() - dirty_since >= A6_JOURNAL_COMMIT_MS)
+		commit();
+	if (tail > A6_JOURNAL_COMPACT_SIZE && live * 2 < tail)
+		compact();
+}
+
+/*!
+ * Add an ASCII (or Latin-1) SMS to the journal, it's sent as A6lib::queueSMS() does.
+ * The SMS is on disk by the next group commit (see SMSJournal::commit()), a crash of the process doesn't lose it even before.
+ * \param number the detination phone number which should begin with international code
+ * \param content the SMS content in ASCII or Latin-1
+ * \return the job id which is passed to the callback registered with SMSJournal::onSMSSent(), or 0 if the journal isn't open,
+ * the content can't be sent or the journal can't grow
+ */
+uint32_t SMSJournal::queueSMS(const String& number, const String& content) {
+	const pdu_text_t text = { content.c_str(), static_cast<uint16_t>(content.length()), PDU_TEXT_LATIN1 };
+	pdu_plan_t plan;
+	const size_t len = number.length() + content.length() + 2;
+	if (!map || len > 0xFFFF || content.length() > 0xFFFF || pdu_plan(&text, 8, &plan) != 0)
+		return 0;
+
+	const auto offset = tail;
+	auto payload = beginRecord(len);
+	if (!payload)
+		return 0;
+	memcpy(payload, number.c_str(), number.length() + 1);
+	memcpy(payload + number.length() + 1, content.c_str(), content.length() + 1);
+
+	const auto id = next_job++;
+	if (next_job == 0)
+		next_job = 1;
+	endRecord(Rec_Queued, id, 0, len);
+	jobs.push_back(Job{ id, static_cast<uint32_t>(offset), 0 });
+	live += recordSize(len);
+
+	return id;
+}
+
+/*!
+ * Get the number of SMS in the journal which are not finished yet.
+ */
+uint32_t SMSJournal::pending() const {
+	return jobs.size();
+}
+
+/*!
+ * Block until every SMS in the journal is finished or none finished for \a timeout ms, then commit.
+ * The SMS which didn't finish stay in the journal, SMSJournal::pending() tells how many.
+ * \param timeout ms without progress before it gives up
+ * \return the number of SMS sent successfully meanwhile
+ */
+int16_t SMSJournal::flush(unsigned long timeout) {
+	const auto sent = jobs_sent;
+	auto done = jobs_done;
+	auto progress = millis();
+	while (map && !jobs.empty() && millis() - progress < timeout) {
+		yield();
+		handle();
+		if (done != jobs_done) {
+			done = jobs_done;
+			progress = millis();
+		}
+	}
+	commit();
+
+	return jobs_sent - sent;
+}
+
+/*!
+ * Write the records appended since the last commit to disk and wait for it. SMSJournal::handle() does it
+ * once the oldest of them is A6_JOURNAL_COMMIT_MS old, call it to make a SMS durable right away.
+ * \return false if the records couldn't be written
+ */
+bool SMSJournal::commit() {
+	if (!map || tail == synced)
+		return map != nullptr;
+
+	/* msync() wants a page aligned start, the page of synced may have a part of the next record */
+	const size_t page = sysconf(_SC_PAGESIZE);
+	const size_t from = synced / page * page;
+	if (msync(map + from, tail - from, MS_SYNC) != 0) {
+		perror(path);
+		return false;
+	}
+	synced = tail;
+	commit_count++;
+
+	return true;
+}
+
+/*!
+ * This function will register your callback and will call it for each SMS of the journal once it's finished,
+ * after its result is appended to the journal.
+ * The callback gets the job id, whether it was sent, the message reference of its (last) part from +CMGS and \a ctx.
+ * \param cb pointer to callback function
+ * \param ctx passed to the callback as is
+ */
+void SMSJournal::onSMSSent(journal_job_cb_t cb, void* ctx) {
+	job_cb = cb;
+	job_ctx = ctx;
+}
+
+///@cond INTERNAL
+/* take the journal for this process, fd must still be the file at path as compaction of another process may replace it */
+bool SMSJournal::lock() {
+	struct stat opened, current;
+	if (flock(fd, LOCK_EX | LOCK_NB) != 0 || fstat(fd, &opened) != 0 || stat(path, &current) != 0 ||
+		opened.st_ino != current.st_ino || opened.st_dev != current.st_dev) {
+		fprintf(stderr, "%s: journal is in use by another process\n", path);
+		return false;
+	}
+
+	return true;
+}
+
+bool SMSJournal::remap(size_t size) {
+	if (map)
+		munmap(map, map_size);
+	map_size = 0;
+	auto mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (mapped == MAP_FAILED) {
+		perror(path);
+		map = nullptr;
+		return false;
+	}
+	map = static_cast<uint8_t*>(mapped);
+	map_size = size;
+
+	return true;
+}
+
+/* room for len bytes after tail, the file grows by whole A6_JOURNAL_GROW_SIZE so growing is rare */
+bool SMSJournal::reserve(size_t len) {
+	if (tail + len <= map_size)
+		return true;
+
+	const size_t size = (tail + len + A6_JOURNAL_GROW_SIZE - 1) / A6_JOURNAL_GROW_SIZE * A6_JOURNAL_GROW_SIZE;
+	if (ftruncate(fd, size) != 0) {
+		perror(path);
+		return false;
+	}
+
+	return remap(size);
+}
+
+/* the payload of a new record at tail, it's written by endRecord() */
+uint8_t* SMSJournal::beginRecord(uint16_t len) {
+	if (!reserve(recordSize(len)))
+		return nullptr;
+
+	return map + tail + sizeof(Record);
+}
+
+void SMSJournal::endRecord(uint8_t type, uint32_t job, uint8_t mr, uint16_t len) {
+	const Record record = { 0, job, len, type, mr };
+	memcpy(map + tail, &record, sizeof(record));
+	const auto crc = recordCrc(map + tail, len);
+	memcpy(map + tail, &crc, sizeof(crc));
+
+	if (tail == synced)
+		dirty_since = millis();
+	tail += recordSize(len);
+}
+
+/* a record without payload */
+bool SMSJournal::append(uint8_t type, uint32_t job, uint8_t mr) {
+	if (!beginRecord(0))
+		return false;
+
+	endRecord(type, job, mr, 0);
+	return true;
+}
+
+/* rebuild the unfinished jobs from the mapped journal, it stops at the first record which is torn or not written */
+bool SMSJournal::replay() {
+	Header header;
+	if (map_size < sizeof(header) || memcmp(map, JOURNAL_MAGIC, sizeof(header.magic)) != 0) {
+		fprintf(stderr, "%s: not a SMS journal\n", path);
+		return false;
+	}
+	memcpy(&header, map, sizeof(header));
+	if (header.version != JOURNAL_VERSION) {
+		fprintf(stderr, "%s: unsupported journal version %u\n", path, header.version);
+		return false;
+	}
+	next_job = header.next_job ? header.next_job : 1;
+
+	size_t pos = sizeof(header);
+	while (pos + sizeof(Record) <= map_size) {
+		Record record;
+		memcpy(&record, map + pos, sizeof(record));
+		if (record.type < Rec_Queued || record.type > Rec_Failed || pos + sizeof(Record) + record.len > map_size ||
+			recordCrc(map + pos, record.len) != record.crc)
+			break;
+
+		const auto payload = reinterpret_cast<const char*>(map + pos + sizeof(Record));
+		if (record.type == Rec_Queued) {
+			/* both strings must be there, a record which passed its CRC is never short though */
+			if (record.len < 2 || payload[record.len - 1] || !memchr(payload, 0, record.len - 1))
+				break;
+			jobs.push_back(Job{ record.job, static_cast<uint32_t>(pos), 0 });
+			live += recordSize(record.len);
+		} else if (record.type == Rec_Sent || record.type == Rec_Failed) {
+			for (auto job = jobs.begin(); job != jobs.end(); ++job) {
+				if (job->id != record.job)
+					continue;
+
+				Record queued;
+				memcpy(&queued, map + job->offset, sizeof(queued));
+				live -= recordSize(queued.len);
+				jobs.erase(job);
+				break;
+			}
+		}
+		/* Rec_Submitted needs nothing: modem lost its queue, those SMS are sent again (maybe twice) */
+
+		if (record.job >= next_job)
+			next_job = record.job + 1 ? record.job + 1 : 1;
+		pos += recordSize(record.len);
+	}
+	tail = synced = pos;
+
+	return true;
+}
+
+/*
+	rewrite the journal with only the unfinished jobs: they're appended to "<path>.tmp" which replaces
+	the journal once it's on disk. the old journal is kept on any failure.
+*/
+bool SMSJournal::compact() {
+	char tmp[sizeof(path) + 4];
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	const int out = ::open(tmp, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (out < 0) {
+		perror(tmp);
+		return false;
+	}
+
+	const auto old_fd = fd;
+	const auto old_map = map;
+	const auto old_size = map_size;
+	const auto old_tail = tail;
+	const auto old_synced = synced;
+	fd = out;
+	map = nullptr;
+	map_size = tail = synced = 0;
+
+	std::vector<uint32_t> offsets;
+	offsets.reserve(jobs.size());
+	bool success = reserve(sizeof(Header) + live);
+	if (success) {
+		Header header = {};
+		memcpy(header.magic, JOURNAL_MAGIC, sizeof(header.magic));
+		header.version = JOURNAL_VERSION;
+		header.next_job = next_job;
+		memcpy(map, &header, sizeof(header));
+		tail = sizeof(header);
+
+		/* jobs keep their place in the queue, the ones with modem keep their Rec_Submitted too */
+		for (const auto& job : jobs) {
+			Record queued;
+			memcpy(&queued, old_map + job.offset, sizeof(queued));
+			const auto size = recordSize(queued.len);
+			if (!reserve(size)) {
+				success = false;
+				break;
+			}
+			memcpy(map + tail, old_map + job.offset, size);
+			offsets.push_back(tail);
+			tail += size;
+			if (job.modem_job && !append(Rec_Submitted, job.id)) {
+				success = false;
+				break;
+			}
+		}
+	}
+	/* the new journal is locked before it takes the place of the old one */
+	success = success && msync(map, tail, MS_SYNC) == 0 && flock(out, LOCK_EX | LOCK_NB) == 0 && rename(tmp, path) == 0;
+	if (!success) {
+		perror(tmp);
+		if (map)
+			munmap(map, map_size);
+		::close(out);
+		unlink(tmp);
+		fd = old_fd;
+		map = old_map;
+		map_size = old_size;
+		tail = old_tail;
+		synced = old_synced;
+		return false;
+	}
+
+	syncDir(path);
+	if (old_map)
+		munmap(old_map, old_size);
+	if (old_fd >= 0)
+		::close(old_fd);
+	for (size_t i = 0; i < jobs.size(); i++)
+		jobs[i].offset = offsets[i];
+	synced = tail;
+	live = tail - sizeof(Header);
+	commit_count++;
+
+	return true;
+}
+
+/* hand the waiting SMS to A6lib while its queue has room, oldest first */
+void SMSJournal::dispatch() {
+	for (size_t i = 0; i < jobs.size(); i++) {
+		auto& job = jobs[i];
+		if (job.modem_job)
+			continue;
+		if (modem->queuedSMS() >= A6_SMS_QUEUE_SIZE)
+			return;
+
+		const auto number = reinterpret_cast<const char*>(map + job.offset + sizeof(Record));
+		const auto content = number + strlen(number) + 1;
+		job.modem_job = modem->queueSMS(number, content);
+		if (!job.modem_job) {
+			/* modem had room, so it refused the SMS itself */
+			const auto id = job.id;
+			Record queued;
+			memcpy(&queued, map + job.offset, sizeof(queued));
+			live -= recordSize(queued.len);
+			jobs.erase(jobs.begin() + i--);
+			append(Rec_Failed, id);
+			jobs_done++;
+			if (job_cb)
+				job_cb(id, false, 0, job_ctx);
+			continue;
+		}
+		if (append(Rec_Submitted, job.id))
+			live += recordSize(0);
+	}
+}
+
+/* modem finished a SMS, its result goes to the journal before it's reported */
+void SMSJournal::finishJob(uint16_t modem_job, bool sent, uint8_t mr) {
+	for (auto job = jobs.begin(); job != jobs.end(); ++job) {
+		if (job->modem_job != modem_job)
+			continue;
+
+		const auto id = job->id;
+		Record queued;
+		memcpy(&queued, map + job->offset, sizeof(queued));
+		live -= recordSize(queued.len) + recordSize(0);
+		jobs.erase(job);
+		append(sent ? Rec_Sent : Rec_Failed, id, mr);
+		if (sent)
+			jobs_sent++;
+		jobs_done++;
+		if (job_cb)
+			job_cb(id, sent, mr, job_ctx);
+		return;
+	}
+}
+
+void SMSJournal::jobDone(uint16_t modem_job, bool sent, uint8_t mr, void* ctx) {
+	auto journal = static_cast<SMSJournal*>(ctx);
+	if (journal->map)
+		journal->finishJob(modem_job, sent, mr);
+}
+///@endcond
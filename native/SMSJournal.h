@@ -0,0 +1,111 @@
+/*
+ * Crash-safe outbound SMS queue for Linux gateways. Every SMS is recorded in an append-only journal file
+ * before it's handed to A6lib's outbound queue, so are that hand-over and its result with the +CMGS message reference.
+ * After a restart, SMSJournal::open() replays the journal and sends again every SMS which has no result, whether or not
+ * modem got its AT+CMGS before the restart: a SMS may be sent twice but it's never lost (at-least-once).
+ *
+ * The journal is memory-mapped: an append is a copy into the mapping, it costs no syscall and survives a crash
+ * of the process right away. Appends reach the disk by group commit, a single msync() covers all the records of
+ * the last A6_JOURNAL_COMMIT_MS, so a power loss may lose that window and the results in it. Each record carries
+ * a CRC32 and replay stops at the first torn one. The journal is locked while it's open, a second process can't open it.
+ *
+ * Modem sends in the background in SMSFormat::Format_PDU, SMSJournal::open() switches it so modem must be started:
+ *
+ *   SMSJournal outbox(&modem);
+ *   outbox.open("/var/lib/a6/outbox.journal"); // replayed SMS are queued again
+ *   outbox.queueSMS("989120000000", "Hello");
+ *   for (;;)
+ *       outbox.handle();
+*/
+
+#ifndef SMSJOURNAL_H
+#define SMSJOURNAL_H
+
+#include <deque>
+#include <stddef.h>
+
+#include <A6lib.h>
+
+/* ms appended records may wait for the group commit */
+#ifndef A6_JOURNAL_COMMIT_MS
+#	define A6_JOURNAL_COMMIT_MS 20
+#endif
+/* bytes the journal file grows by when the mapping is full, a multiple of the page size */
+#ifndef A6_JOURNAL_GROW_SIZE
+#	define A6_JOURNAL_GROW_SIZE 65536
+#endif
+/* ms SMSJournal::flush() waits without any SMS finishing before it gives up, the SMS stay in the journal */
+#ifndef A6_JOURNAL_FLUSH_TIMEOUT
+#	define A6_JOURNAL_FLUSH_TIMEOUT 30000
+#endif
+/* journal size above which it's rewritten with only the unfinished SMS (once they take less than half of it) */
+#ifndef A6_JOURNAL_COMPACT_SIZE
+#	define A6_JOURNAL_COMPACT_SIZE (1024UL * 1024UL)
+#endif
+
+typedef void(*journal_job_cb_t)(uint32_t job, bool sent, uint8_t mr, void* ctx);
+
+class SMSJournal {
+public:
+	explicit SMSJournal(A6lib* modem);
+	~SMSJournal();
+
+	int32_t open(const char* path);
+	void close();
+	bool isOpen() const {
+		return map != nullptr;
+	}
+
+	void handle();
+	uint32_t queueSMS(const String& number, const String& content);
+	uint32_t pending() const;
+	int16_t flush(unsigned long timeout = A6_JOURNAL_FLUSH_TIMEOUT);
+	bool commit();
+	void onSMSSent(journal_job_cb_t cb, void* ctx = nullptr);
+
+	/* bytes of the journal in use and the number of msync() so far, e.g to watch the group commit */
+	size_t size() const {
+		return tail;
+	}
+	uint32_t commits() const {
+		return commit_count;
+	}
+
+private:
+	struct Job {
+		uint32_t id;
+		uint32_t offset; /* its enqueue record */
+		uint16_t modem_job; /* the job id in A6lib's queue, 0 -> not handed to it yet */
+	};
+	std::deque<Job> jobs;
+
+	bool lock();
+	bool remap(size_t size);
+	bool reserve(size_t len);
+	uint8_t* beginRecord(uint16_t len);
+	void endRecord(uint8_t type, uint32_t job, uint8_t mr, uint16_t len);
+	bool append(uint8_t type, uint32_t job, uint8_t mr = 0);
+	bool replay();
+	bool compact();
+	void dispatch();
+	void finishJob(uint16_t modem_job, bool sent, uint8_t mr);
+	static void jobDone(uint16_t modem_job, bool sent, uint8_t mr, void* ctx);
+
+	A6lib* modem;
+	char path[256] = {};
+	int fd = -1;
+	uint8_t* map = nullptr;
+	size_t map_size = 0;
+	size_t tail = 0; /* where the next record goes */
+	size_t synced = 0; /* everything before it is on disk */
+	size_t live = 0; /* bytes of the records compaction would keep */
+	unsigned long dirty_since = 0; /* when the oldest record after synced was appended */
+	uint32_t next_job = 1;
+	uint32_t commit_count = 0;
+	uint16_t jobs_sent = 0;
+	uint16_t jobs_done = 0; /* sent or failed, it tells flush() modem makes progress */
+	journal_job_cb_t job_cb = nullptr;
+	void* job_ctx = nullptr;
+};
+
+#endif // !SMSJOURNAL_H
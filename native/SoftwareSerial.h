@@ -0,0 +1,30 @@
+#ifndef SOFTWARESERIAL_H
+#define SOFTWARESERIAL_H
+
+#include "Arduino.h"
+
+/* a SoftwareSerial without pins, it never receives anything */
+class SoftwareSerial : public Stream {
+public:
+	SoftwareSerial(uint8_t rx_pin, uint8_t tx_pin) {
+		(void)rx_pin;
+		(void)tx_pin;
+	}
+	void begin(unsigned long) {}
+
+	int available() override {
+		return 0;
+	}
+	int read() override {
+		return -1;
+	}
+	int peek() override {
+		return -1;
+	}
+	size_t write(uint8_t) override {
+		return 1;
+	}
+	using Print::write;
+};
+
+#endif // !SOFTWARESERIAL_H
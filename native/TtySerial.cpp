@@ -0,0 +1,146 @@
+#include "TtySerial.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+
+#define TTY_TX_QUEUE 4096 // usual size of the kernel output queue of a tty
+
+static const struct {
+	unsigned long baud;
+	speed_t speed;
+} speeds[] = {
+	{ 1200, B1200 }, { 2400, B2400 }, { 4800, B4800 }, { 9600, B9600 },
+	{ 19200, B19200 }, { 38400, B38400 }, { 57600, B57600 }, { 115200, B115200 },
+	{ 230400, B230400 }, { 460800, B460800 }, { 921600, B921600 },
+};
+
+TtySerial::TtySerial(const char* path) {
+	snprintf(this->path, sizeof(this->path), "%s", path);
+}
+
+TtySerial::~TtySerial() {
+	end();
+}
+
+void TtySerial::begin(unsigned long baud) {
+	speed_t speed = 0;
+	for (const auto& s : speeds) {
+		if (s.baud == baud)
+			speed = s.speed;
+	}
+	if (!speed) {
+		fprintf(stderr, "%s: unsupported baud rate %lu\n", path, baud);
+		end();
+		return;
+	}
+
+	/* already open -> only the speed changes, e.g when A6lib switches baud rate */
+	if (tty < 0) {
+		tty = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+		if (tty < 0) {
+			perror(path);
+			return;
+		}
+	}
+
+	struct termios tio;
+	if (tcgetattr(tty, &tio) != 0) {
+		perror(path);
+		end();
+		return;
+	}
+	cfmakeraw(&tio);
+	tio.c_cflag |= CLOCAL | CREAD;
+	tio.c_cflag &= ~(CSTOPB | CRTSCTS);
+	if (rtscts)
+		tio.c_cflag |= CRTSCTS;
+	tio.c_cc[VMIN] = 0;
+	tio.c_cc[VTIME] = 0;
+	cfsetispeed(&tio, speed);
+	cfsetospeed(&tio, speed);
+	if (tcsetattr(tty, TCSANOW, &tio) != 0) {
+		perror(path);
+		end();
+		return;
+	}
+
+	this->baud = baud;
+}
+
+void TtySerial::end() {
+	if (tty >= 0)
+		close(tty);
+	tty = -1;
+	rx_pos = rx_len = 0;
+}
+
+/* read whatever the tty has, without blocking */
+bool TtySerial::fill() {
+	if (rx_pos < rx_len)
+		return true;
+	if (tty < 0)
+		return false;
+
+	ssize_t n;
+	do {
+		n = ::read(tty, rx, sizeof(rx));
+	} while (n < 0 && errno == EINTR);
+	rx_pos = 0;
+	rx_len = n > 0 ? n : 0;
+
+	return rx_len != 0;
+}
+
+int TtySerial::available() {
+	return fill() ? rx_len - rx_pos : 0;
+}
+
+int TtySerial::read() {
+	return fill() ? rx[rx_pos++] : -1;
+}
+
+int TtySerial::peek() {
+	return fill() ? rx[rx_pos] : -1;
+}
+
+size_t TtySerial::write(uint8_t c) {
+	return write(&c, 1);
+}
+
+size_t TtySerial::write(const uint8_t* buffer, size_t size) {
+	size_t written = 0;
+	while (tty >= 0 && written < size) {
+		const auto n = ::write(tty, buffer + written, size - written);
+		if (n > 0) {
+			written += n;
+		} else if (n < 0 && errno == EINTR) {
+			continue;
+		} else if (n < 0 && errno == EAGAIN) {
+			/* output queue is full, wait for the line to drain it */
+			struct pollfd p = { tty, POLLOUT, 0 };
+			if (poll(&p, 1, TTY_WRITE_TIMEOUT) <= 0)
+				break;
+		} else {
+			break;
+		}
+	}
+
+	return written;
+}
+
+int TtySerial::availableForWrite() {
+	int queued = 0;
+	if (tty < 0 || ioctl(tty, TIOCOUTQ, &queued) != 0)
+		return 0;
+
+	return queued < TTY_TX_QUEUE ? TTY_TX_QUEUE - queued : 0;
+}
+
+void TtySerial::flush() {
+	if (tty >= 0)
+		tcdrain(tty);
+}
@@ -0,0 +1,73 @@
+/*
+ * Serial transport over a POSIX tty (e.g /dev/ttyUSB0) for running A6lib on Linux gateways.
+ * The tty is opened non-blocking in raw 8N1 mode, reads never block and writes only wait
+ * while the kernel output queue is full.
+ *
+ * Its fd could be watched by the host event loop, so A6lib::handle() runs only when modem sent something:
+ *
+ *   TtySerial port("/dev/ttyUSB0");
+ *   A6lib modem(&port);
+ *   port.begin(115200);
+ *   epoll_ctl(ep, EPOLL_CTL_ADD, port.fd(), &ev); // ev.events = EPOLLIN
+ *   for (;;) {
+ *       // commands in progress time out too, so don't sleep forever while modem is busy
+ *       epoll_wait(ep, events, n, modem.isBusy() ? 10 : -1);
+ *       modem.handle();
+ *   }
+*/
+
+#ifndef TTYSERIAL_H
+#define TTYSERIAL_H
+
+#include "HardwareSerial.h"
+
+/* bytes read from the tty at once */
+#ifndef TTY_RX_CHUNK
+#	define TTY_RX_CHUNK 256
+#endif
+/* ms a write waits for room in the kernel output queue before giving up */
+#ifndef TTY_WRITE_TIMEOUT
+#	define TTY_WRITE_TIMEOUT 1000
+#endif
+
+class TtySerial : public HardwareSerial {
+public:
+	explicit TtySerial(const char* path);
+	~TtySerial();
+
+	/* open the tty if needed and set its speed, isOpen() tells if it worked */
+	void begin(unsigned long baud) override;
+	void end() override;
+	bool isOpen() const {
+		return tty >= 0;
+	}
+	/* let the tty handle RTS/CTS (modem is set to it by A6lib::setFlowControl()), it takes effect on the next begin() */
+	void setHardwareFlowControl(bool enable) {
+		rtscts = enable;
+	}
+	/* the tty fd to wait on for EPOLLIN/POLLIN, -1 if it's not open */
+	int fd() const {
+		return tty;
+	}
+
+	int available() override;
+	int read() override;
+	int peek() override;
+	size_t write(uint8_t c) override;
+	size_t write(const uint8_t* buffer, size_t size) override;
+	using Print::write;
+	int availableForWrite() override;
+	void flush() override;
+
+private:
+	bool fill();
+
+	char path[64];
+	int tty = -1;
+	bool rtscts = false;
+	uint8_t rx[TTY_RX_CHUNK];
+	uint16_t rx_pos = 0;
+	uint16_t rx_len = 0;
+};
+
+#endif // !TTYSERIAL_H
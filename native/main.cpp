@@ -0,0 +1,135 @@
+/*
+ * Desktop runner: drives A6lib against MockModem and reports the latency
+ * and String heap allocations of the public APIs.
+ * With "pty", MockModem is served on the master side of a pseudo-terminal by a child process
+ * and A6lib talks to it through TtySerial on the slave side, like it does with a real modem.
+ * usage: program [modem latency in ms] [iterations] [pty]
+*/
+
+/* "pio test -e native" builds native/ along with the tests in test/, which bring their own main() */
+#ifndef UNIT_TEST
+
+#include <A6lib.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "MockModem.h"
+#include "TtySerial.h"
+
+static MockModem modem_port;
+static A6lib* modem;
+
+static void script(unsigned long latency) {
+	modem_port.on("AT+CSQ", "\r\n+CSQ: 20,0\r\n\r\nOK\r\n", latency);
+	modem_port.on("AT+CREG?", "\r\n+CREG: 1,1\r\n\r\nOK\r\n", latency);
+	modem_port.on("AT+CPAS", "\r\n+CPAS: 0\r\n\r\nOK\r\n", latency);
+	modem_port.on("AT+CSCA?", "\r\n+CSCA: \"+989350001500\",145\r\n\r\nOK\r\n", latency);
+	modem_port.on("AT+GSN", "\r\n867567030000000\r\n\r\nOK\r\n", latency);
+	modem_port.on("AT+GMR", "\r\nRevision:1418B05SIM800L24\r\n\r\nOK\r\n", latency);
+	modem_port.on("AT+CCLK?", "\r\n+CCLK: \"18/01/02,10:11:12+14\"\r\n\r\nOK\r\n", latency);
+	modem_port.on("AT+CMGF", "\r\nOK\r\n", latency);
+	modem_port.on("AT+CMGR=", "\r\n+CMGR: \"REC READ\",\"+989120000000\",\"\",\"18/01/02,10:11:12+14\"\r\nHello from the desktop\r\n\r\nOK\r\n", latency);
+	modem_port.on("AT+CMGS=", "\r\n> ", latency);
+	modem_port.onSubmit("\r\n+CMGS: 12\r\n\r\nOK\r\n", latency);
+}
+
+template<class F> static void probe(const char* name, unsigned iterations, F call) {
+	const auto heap = nativeHeapStats();
+	const auto start = micros();
+	for (unsigned i = 0; i < iterations; i++)
+		call();
+	const auto elapsed = micros() - start;
+	const auto allocs = nativeHeapStats().allocations - heap.allocations;
+
+	printf("%-18s %10.1f us/call %8.1f allocs/call\n", name, (double)elapsed / iterations, (double)allocs / iterations);
+}
+
+/* serve MockModem on the master side of a new PTY from a child process, slave gets the path of the other side */
+static pid_t servePty(char* slave, size_t size) {
+	const int master = posix_openpt(O_RDWR | O_NOCTTY);
+	if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0 || !ptsname(master)) {
+		perror("pty");
+		return -1;
+	}
+	snprintf(slave, size, "%s", ptsname(master));
+
+	const pid_t pid = fork();
+	if (pid != 0) {
+		close(master);
+		return pid;
+	}
+
+	struct pollfd p = { master, POLLIN, 0 };
+	for (;;) {
+		if (poll(&p, 1, 1) > 0) {
+			uint8_t buff[256];
+			const auto n = read(master, buff, sizeof(buff));
+			if (n > 0)
+				modem_port.write(buff, n);
+			else if (n < 0 && errno == EIO)
+				usleep(1000); // slave side isn't open yet
+		}
+		uint8_t buff[256];
+		size_t n = 0;
+		while (n < sizeof(buff) && modem_port.available())
+			buff[n++] = modem_port.read();
+		if (n && write(master, buff, n) < 0)
+			_exit(1);
+	}
+}
+
+int main(int argc, char** argv) {
+	const unsigned long latency = argc > 1 ? strtoul(argv[1], nullptr, 10) : 1;
+	const unsigned iterations = argc > 2 ? strtoul(argv[2], nullptr, 10) : 50;
+	const bool pty = argc > 3 && strcmp(argv[3], "pty") == 0;
+
+	script(latency);
+	modem_port.begin(115200);
+
+	HardwareSerial* port = &modem_port;
+	pid_t server = 0;
+	char slave[64];
+	if (pty) {
+		server = servePty(slave, sizeof(slave));
+		if (server < 0)
+			return 1;
+		auto tty = new TtySerial(slave);
+		tty->begin(115200);
+		if (!tty->isOpen())
+			return 1;
+		port = tty;
+	}
+	modem = new A6lib(port);
+	printf("modem latency: %lums, iterations: %u, transport: %s\n", latency, iterations, pty ? slave : "MockModem");
+
+	probe("getRSSI", iterations, [] { modem->getRSSI(); });
+	probe("getRegisterStatus", iterations, [] { modem->getRegisterStatus(); });
+	probe("getDeviceStatus", iterations, [] { modem->getDeviceStatus(); });
+	probe("getSMSSca", iterations, [] { modem->getSMSSca(); });
+	probe("getIMEI", iterations, [] { modem->getIMEI(); });
+	probe("getFirmWareVer", iterations, [] { modem->getFirmWareVer(); });
+	probe("getRealTimeClock", iterations, [] { modem->getRealTimeClock(); });
+	probe("readSMS", iterations, [] { modem->readSMS(1); });
+	probe("sendPDU", iterations, [] { modem->sendPDU("989120000000", "Hello from the desktop"); });
+
+#ifdef A6_PERF_COUNTERS
+	CommandStats stats[A6_CMD_CLASSES];
+	const auto n = modem->getCommandStats(stats, A6_CMD_CLASSES);
+	printf("\n%-8s %6s %6s %6s %6s %8s %8s %6s %6s %6s %6s %6s\n", "class", "count", "ok", "retry", "tmout", "tx", "rx", "min", "avg", "max", "p95", "prompt");
+	for (uint8_t i = 0; i < n; i++) {
+		const auto& st = stats[i];
+		printf("%-8s %6u %6u %6u %6u %8lu %8lu %6u %6u %6u %6u %6u\n", st.prefix, st.count, st.success, st.retries, st.timeouts,
+			(unsigned long)st.tx_bytes, (unsigned long)st.rx_bytes, st.min_latency, st.avg_latency, st.max_latency, st.p95_latency, st.avg_prompt_latency);
+	}
+#endif
+
+	if (server > 0)
+		kill(server, SIGTERM);
+	return 0;
+}
+
+#endif // !UNIT_TEST
@@ -5,6 +5,7 @@ extern "C" {
 }
 
 #include "A6lib.h"
+#include "replyparser.h"
 
 ///@cond INTERNAL
 #ifdef ARDUINO_ARCH_ESP8266
@@ -16,10 +17,20 @@ extern "C" {
 #endif
 
 #define Literal(arg) String(F(arg))
+/* a flash string copied on the stack, for the APIs which only read RAM (e.g strftime) */
+#define StackLiteral(name, arg) char name[sizeof(arg)]; strcpy_P(name, PSTR(arg))
 #define countof(a) (sizeof(a) / sizeof(a[0]))
 #define A6_CMD_TIMEOUT 2000
 #define A6_CMD_MAX_RETRY 2
+#define A6_BAUD_PROBE_TIMEOUT 300 // ms, modem answers AT within a few ms at the right rate
 #define DEFAULT_STREAM_TIMEOUT 200 // ms
+#define NO_CMD_CLASS 0xFF
+#define MIN_LATENCY_SAMPLES 4 // before adaptive timeout is used for a class
+#ifdef A6_PERF_COUNTERS
+#	define PERF(stmt) stmt
+#else
+#	define PERF(stmt)
+#endif
 
 #define PLACE_HOLDER "XX"
 #define RES_OK "OK"
@@ -46,15 +57,140 @@ extern "C" {
 #define CUSD_CMD "+CUSD"
 #define CSPN_CMD "+CSPN"
 #define CPAS_CMD "+CPAS"
+#define CPIN_CMD "+CPIN"
 #define CNUM_CMD "+CNUM"
 #define CME_CMD "+CME"
+#define CMS_CMD "+CMS"
 #define CADC_CMD "+CADC"
 #define NOTIF_CMTI "+CMTI"
 #define NOTIF_CIEV "+CIEV"
+#define NOTIF_RING "RING"
+#define NOTIF_CLIP "+CLIP"
+#define NOTIF_CDS "+CDS"
+#define NOTIF_CMT "+CMT"
 #define UCS2 "UCS2"
 #define CR "\r"
 #define LF "\n"
 #define CTRLZ char(0x1A)
+#define SMS_TIME_FORMAT "%Y/%m/%d,%H:%M:%S"
+
+/* the AT commands A6lib issues, indexes of at_commands */
+enum ATCommandId {
+	AT_RST,
+	AT_CPIN,
+	AT_CNUM,
+	AT_CPAS,
+	AT_GMR,
+	AT_CSQ,
+	AT_CCLK,
+	AT_GSN,
+	AT_CSCA,
+	AT_CREG,
+	AT_CSPN,
+	AT_CADC,
+	AT_DIAL,
+	AT_REDIAL,
+	AT_ANSWER,
+	AT_HANGUP,
+	AT_CLCC,
+	AT_CLVL,
+	AT_SNFS,
+	AT_CUSD,
+	AT_CPMS,
+	AT_CMGL_INDEXES,
+	AT_CMGL_LIST,
+	AT_CMGS_TEXT,
+	AT_CMGS_PDU,
+	AT_CMGR,
+	AT_CMGD,
+	AT_CMGD_ALL,
+	AT_CSCS,
+	AT_CMGF,
+	AT_CMGF_RESTORE,
+	AT_CNMI,
+	AT_IPR,
+	AT_PROBE,
+	AT_IFC,
+	AT_Count
+};
+
+struct ATCommand {
+	char format[24]; /* the command, a printf format if it takes arguments */
+	const char* resp1;
+	const char* resp2;
+	uint16_t timeout;
+	uint8_t max_retry;
+};
+
+/* kept in flash, they're formatted on the stack right into a command slot (see A6lib::prepareAT()) */
+static const ATCommand at_commands[] PROGMEM = {
+	/* AT_RST */ { AT_PREFIX RST_CMD, PLACE_HOLDER, PLACE_HOLDER, 0, 0 },
+	/* AT_CPIN */ { AT_PREFIX CPIN_CMD "?", CPIN_CMD, RES_OK, A6_CMD_TIMEOUT, A6_CMD_MAX_RETRY },
+	/* AT_CNUM */ { AT_PREFIX CNUM_CMD, CNUM_CMD, RES_OK, A6_CMD_TIMEOUT, A6_CMD_MAX_RETRY },
+	/* AT_CPAS */ { AT_PREFIX CPAS_CMD, CPAS_CMD, RES_OK, A6_CMD_TIMEOUT, A6_CMD_MAX_RETRY },
+	/* AT_GMR */ { AT_PREFIX GMR_CMD, RES_OK, RES_ERR, A6_CMD_TIMEOUT, A6_CMD_MAX_RETRY },
+	/* AT_CSQ */ { AT_PREFIX CSQ_CMD, CSQ_CMD, RES_OK, A6_CMD_TIMEOUT, A6_CMD_MAX_RETRY },
+	/* AT_CCLK */ { AT_PREFIX CCLK_CMD "?", CCLK_CMD, RES_OK, A6_CMD_TIMEOUT, A6_CMD_MAX_RETRY },
+	/* AT_GSN */ { AT_PREFIX GSN_CMD, RES_OK, RES_ERR, A6_CMD_TIMEOUT, A6_CMD_MAX_RETRY },
+	/* AT_CSCA */ { AT_PREFIX CSCA_CMD "?", CSCA_CMD, RES_OK, A6_CMD_TIMEOUT, A6_CMD_MAX_RETRY },
+	/* AT_CREG */ { AT_PREFIX CREG_CMD "?", CREG_CMD, RES_OK, A6_CMD_TIMEOUT, A6_CMD_MAX_RETRY },
+	/* AT_CSPN */ { AT_PREFIX CSPN_CMD "?", CSPN_CMD, RES_OK, A6_CMD_TIMEOUT, A6_CMD_MAX_RETRY },
+	/* AT_CADC */ { AT_PREFIX CADC_CMD "?", CADC_CMD, RES_OK, A6_CMD_TIMEOUT, A6_CMD_MAX_RETRY },
+	/* AT_DIAL */ { "ATD%s;", RES_OK, "yy", A6_CMD_TIMEOUT, 2 },
+	/* AT_REDIAL */ { "AT+DLST", RES_OK, "CONNECT", A6_CMD_TIMEOUT, 2 },
+	/* AT_ANSWER */ { "ATA", RES_OK, "yy", A6_CMD_TIMEOUT, 2 },
+	/* AT_HANGUP */ { "ATH", RES_OK, "yy", A6_CMD_TIMEOUT, 2 },
+	/* AT_CLCC */ { "AT+CLCC", RES_OK, "+CLCC", A6_CMD_TIMEOUT, 2 },
+	/* AT_CLVL */ { "AT+CLVL=%d", RES_OK, "yy", A6_CMD_TIMEOUT, 2 },
+	/* AT_SNFS */ { "AT+SNFS=%d", RES_OK, "yy", A6_CMD_TIMEOUT, 2 },
+	/* AT_CUSD */ { AT_PREFIX CUSD_CMD "=1,\"%s\",15", CUSD_CMD, RES_ERR, A6_CMD_TIMEOUT * 3 / 2, A6_CMD_MAX_RETRY },
+#ifdef A6_T
+	/* AT_CPMS */ { AT_PREFIX CPMS_CMD "=%s,%s,%s", CPMS_CMD, RES_OK, A6_CMD_TIMEOUT, A6_CMD_MAX_RETRY },
+#else
+	/* AT_CPMS */ { AT_PREFIX CPMS_CMD "=\"%s\",\"%s\",\"%s\"", CPMS_CMD, RES_OK, A6_CMD_TIMEOUT, A6_CMD_MAX_RETRY },
+#endif
+	/* AT_CMGL_INDEXES */ { AT_PREFIX CMGL_CMD "=%s", CMGL_CMD, RES_OK, A6_CMD_TIMEOUT * 5 / 2, A6_CMD_MAX_RETRY },
+	/* AT_CMGL_LIST */ { AT_PREFIX CMGL_CMD "=%s", RES_OK, RES_ERR, A6_CMD_TIMEOUT * 5 / 2, 1 }, /* no retry, the SMS listed so far are already passed on */
+	/* AT_CMGS_TEXT */ { AT_PREFIX CMGS_CMD "=\"%s\"", CMGS_CMD, RES_ERR, A6_CMD_TIMEOUT * 3, A6_CMD_MAX_RETRY },
+	/* AT_CMGS_PDU */ { AT_PREFIX CMGS_CMD "=%u", CMGS_CMD, RES_ERR, A6_CMD_TIMEOUT * 3, A6_CMD_MAX_RETRY },
+	/* AT_CMGR */ { AT_PREFIX CMGR_CMD "=%u", CMGR_CMD, RES_OK, A6_CMD_TIMEOUT, A6_CMD_MAX_RETRY },
+	/* AT_CMGD */ { AT_PREFIX CMGD_CMD "=%u", RES_OK, RES_ERR, A6_CMD_TIMEOUT, A6_CMD_MAX_RETRY },
+	/* AT_CMGD_ALL */ { AT_PREFIX CMGD_CMD "=1,4", RES_OK, RES_ERR, A6_CMD_TIMEOUT, A6_CMD_MAX_RETRY },
+	/* AT_CSCS */ { AT_PREFIX CSCS_CMD "=\"%s\"", RES_OK, RES_ERR, A6_CMD_TIMEOUT, A6_CMD_MAX_RETRY },
+	/* AT_CMGF */ { AT_PREFIX CMGF_CMD "=%u", RES_OK, RES_ERR, A6_CMD_TIMEOUT, A6_CMD_MAX_RETRY },
+	/* AT_CMGF_RESTORE */ { AT_PREFIX CMGF_CMD "=1", RES_OK, RES_ERR, A6_CMD_TIMEOUT * 5 / 2, A6_CMD_MAX_RETRY * 2 },
+#ifdef A6_T
+	/* AT_CNMI */ { AT_PREFIX CNMI_CMD "=0,1,0,0,0", RES_OK, PLACE_HOLDER, A6_CMD_TIMEOUT, A6_CMD_MAX_RETRY },
+#else
+	/* AT_CNMI */ { AT_PREFIX CNMI_CMD "=1,1,0,0,0", RES_OK, RES_ERR, A6_CMD_TIMEOUT, A6_CMD_MAX_RETRY },
+#endif
+	/* AT_IPR */ { AT_PREFIX IPR_CMD "=%lu", RES_OK, IPR_CMD, A6_CMD_TIMEOUT, A6_CMD_MAX_RETRY },
+	/* AT_PROBE */ { AT_PREFIX, RES_OK, RES_ERR, A6_BAUD_PROBE_TIMEOUT, 2 }, /* ERROR -> modem took line noise before it, but talks at this rate */
+	/* AT_IFC */ { AT_PREFIX "+IFC=%u,%u", RES_OK, RES_ERR, A6_CMD_TIMEOUT, A6_CMD_MAX_RETRY },
+};
+static_assert(countof(at_commands) == AT_Count, "at_commands doesn't match ATCommandId");
+
+/* names of SMSRecordType, CharSet and SMSStorageArea values as modem takes them */
+static const char record_names[][11] PROGMEM = { "ALL", "REC UNREAD", "REC READ", "STO UNSENT", "STO SENT" };
+static const char charset_names[][8] PROGMEM = { "GSM", "UCS2", "HEX", "PCCP936" };
+static const char storage_names[][5] PROGMEM = { "", "ME", "SM", "MT", "SM_P", "ME_P" };
+
+/* standard rates in the order they're probed, modems usually ship at 115200 or 9600 (or autobauding) */
+static const uint32_t baud_rates[] PROGMEM = { 115200, 9600, 57600, 38400, 19200, 230400, 460800, 4800, 2400, 1200 };
+/* commands whose replies never change, so they tell whether a rate carries bytes intact */
+static const uint8_t link_commands[] = { AT_GSN, AT_GMR };
+
+/* the lowest standard rate above baud, 0 if there's none up to max_baud */
+static unsigned long nextBaudRate(unsigned long baud, unsigned long max_baud) {
+	unsigned long next = 0;
+	for (uint8_t i = 0; i < countof(baud_rates); i++) {
+		const unsigned long rate = pgm_read_dword(&baud_rates[i]);
+		if (rate > baud && rate <= max_baud && (!next || rate < next))
+			next = rate;
+	}
+
+	return next;
+}
 ///@endcond
 
 /*!
@@ -72,6 +208,14 @@ extern "C" {
  *  -# SMS sent
  *  -# SMS recevied
  *  -# Storage area is full
+ *  -# SMS routed directly to A6lib (+CMT) and SMS status reports (+CDS)
+ *  -# Incoming call (RING) and its caller id (+CLIP)
+ *  -# Network registration changes (+CREG) and USSD replies (+CUSD)
+ *
+ * Every handler can be registered with a context pointer which is passed back to it, and other notifications can be caught via A6lib::onURC().
+ *
+ * All the blocking APIs sit on top of a small command engine, which can also be used directly: submit a command with A6lib::submitCommand(),
+ * keep calling A6lib::handle() from your main loop and check the result with A6lib::commandState(), so your code keeps running while modem is replying.
  *
  * \note A note about A6lib::addHandler(): When you have some important tasks in your code for example reading keypad etc, you can add a main function for running those tasks and pass it to 
  * A6lib::addHandler(), when you pass a valid function, lib will call it whenever it's in waiting state (waiting for modem to reply at some time) and thus it'll prevent locking in that precious time.
@@ -85,6 +229,8 @@ extern "C" {
   */
 A6lib::A6lib(HardwareSerial* port) : stream{ port } {
 	setStreamTimeOut(DEFAULT_STREAM_TIMEOUT);
+	setAdaptiveTimeout(false);
+	indexLinePrefixes();
 	ports.state = PortState::Using_HardWareSerial;
 	ports.hport = port;
 }
@@ -95,6 +241,8 @@ A6lib::A6lib(HardwareSerial* port) : stream{ port } {
  */
 A6lib::A6lib(SoftwareSerial* port) : stream{ port } {
 	setStreamTimeOut(DEFAULT_STREAM_TIMEOUT);
+	setAdaptiveTimeout(false);
+	indexLinePrefixes();
 	ports.state = PortState::Using_SoftWareSerial;
 	ports.sport = port;
 }
@@ -109,6 +257,8 @@ A6lib::A6lib(uint8_t rx_pin, uint8_t tx_pin) {
 	ports.sport = new SoftwareSerial(rx_pin, tx_pin);
 	stream = ports.sport;
 	setStreamTimeOut(DEFAULT_STREAM_TIMEOUT);
+	setAdaptiveTimeout(false);
+	indexLinePrefixes();
 }
 
 /*!
@@ -128,24 +278,28 @@ void A6lib::setDebugStream(Stream* stream) {
 	dbg_stream->flush();
 }
 #endif
-void A6lib::dbg(const char* format, ...) const {
+void A6lib::dbg(PGM_P format, ...) const {
 #ifdef DEBUG
 	if (!dbg_stream)
 		return;
 
+	char fmt[96];
+	strncpy_P(fmt, format, sizeof(fmt) - 1);
+	fmt[sizeof(fmt) - 1] = 0;
 	char buff[128];
 	va_list args;
 	va_start(args, format);
-	vsnprintf(buff, sizeof(buff), format, args);
+	vsnprintf(buff, sizeof(buff), fmt, args);
 	va_end(args);
-	dbg_stream->print(Literal("\n[A6lib] "));
+	dbg_stream->print(F("\n[A6lib] "));
 	dbg_stream->print(buff);
 #endif
 }
 
 void A6lib::setStreamTimeOut(uint16_t t) {
+	quiet_time = t;
 	if (stream) {
-		dbg(Literal("set stream timeout to %d").c_str(), t);
+		dbg(PSTR("set stream timeout to %d"), t);
 		stream->setTimeout(t);
 	}
 }
@@ -157,11 +311,12 @@ void A6lib::setStreamTimeOut(uint16_t t) {
  * \return true on success
  */
 bool A6lib::start(uint8_t max_retry) {
+	invalidateFacts();
 	bool success = false;
 	while (!success && max_retry--) {
 		success = begin();
 		delay(500);
-		dbg(Literal("initializing modem...").c_str());
+		dbg(PSTR("initializing modem..."));
 	}
 
 	return success;
@@ -170,31 +325,34 @@ bool A6lib::start(uint8_t max_retry) {
 /*!
 * This method will wait for modem to trigger the registration indication which is the result of correct netowrk registration.
 * you must call this usually before A6lib::start().
-* \param baud the desired baud rate to start with
+* \param baud the desired baud rate to start with, 0 to let A6lib::autoBaud() pick the fastest reliable one
 * \param time_out the maximum amount of time A6lib object wait for network registration indication.
 * \return true on success
 */
 bool A6lib::waitForNetwork(unsigned long baud, uint16_t time_out) {
 	stream->flush();
-	if (!setBaudRate(baud))
+	if (baud ? !setBaudRate(baud) : !autoBaud())
 		return false;
 
-	dbg(Literal("waiting for modem to register on GSM network...").c_str());
+	dbg(PSTR("waiting for modem to register on GSM network..."));
 	auto start = millis();
 	bool success = false;
 	do {
 		yield();
-		stream->println(ATE_CMD);
+		stream->print(F(ATE_CMD CR LF));
 #ifdef SIM800_T
 		if (getDeviceStatus() == DeviceStatus::Status_Ready) {
 			success = true;
-			dbg(Literal("modem got ready after %lums").c_str(), millis() - start);
+			dbg(PSTR("modem got ready after %lums"), millis() - start);
 			break;
 		}
 #elif defined(A6_T)
-		auto data = streamData();
-		if (data.indexOf(Literal("+CREG: 1").c_str()) != -1) {
-			dbg(Literal("modem got ready after %lums").c_str(), millis() - start);
+		fillRx();
+		StackLiteral(creg, CREG_CMD ": 1");
+		const auto registered = rx.indexOf(creg) != -1;
+		clearRx();
+		if (registered) {
+			dbg(PSTR("modem got ready after %lums"), millis() - start);
 			success = true;
 			break;
 		}
@@ -203,68 +361,414 @@ bool A6lib::waitForNetwork(unsigned long baud, uint16_t time_out) {
 
 	if (!success)
 		if (getDeviceStatus() != DeviceStatus::Status_Ready && !isRegsitered())
-			dbg(Literal("modem failed to register on network after %lums").c_str(), millis() - start);
+			dbg(PSTR("modem failed to register on network after %lums"), millis() - start);
 
 	return success;
 }
 
+/*!
+ * Find the baud rate modem talks at and step it up to the fastest one which carries replies intact.
+ * The standard rates are probed with AT until modem answers, then it's moved (AT+IPR) one standard rate up at a time
+ * as long as its IMEI and revision replies come back A6_BAUD_CHECKS times exactly as they did at the rate it was found at.
+ * Modem is moved back to the last good rate once a rate fails the check.
+ * \param max_baud the highest rate to try
+ * \return the rate modem is left at (also kept for A6lib::getBaudRate()), 0 if it doesn't answer at any rate
+ */
+unsigned long A6lib::autoBaud(unsigned long max_baud) {
+	auto baud = detectBaudRate();
+	if (!baud)
+		return 0;
+
+	String reference;
+	if (!linkReference(&reference)) {
+		dbg(PSTR("no reference reply at %lu"), baud);
+		return baud;
+	}
+
+	ATCall call;
+	for (auto next = nextBaudRate(baud, max_baud); next; next = nextBaudRate(next, max_baud)) {
+		/* modem answers at the old rate, then switches */
+		if (!prepareAT(&call, AT_IPR, next) || !cmd(call)) {
+			dbg(PSTR("modem refused %lu"), next);
+			continue;
+		}
+		openPort(next);
+		/* the line end of AT+IPR could reach modem as noise at the new rate, the probe flushes it */
+		if (probeModem() && checkLink(reference)) {
+			baud = next;
+			continue;
+		}
+
+		dbg(PSTR("%lu isn't reliable, back to %lu"), next, baud);
+		if (prepareAT(&call, AT_IPR, baud)) {
+			/* its reply is likely broken at this rate */
+			call.timeout = A6_BAUD_PROBE_TIMEOUT;
+			call.max_retry = 1;
+			cmd(call);
+		}
+		openPort(baud);
+		break;
+	}
+
+	/* lock modem at the rate (no autobauding), it's also a check that it still answers there */
+	if (!prepareAT(&call, AT_IPR, baud) || !cmd(call))
+		baud = detectBaudRate();
+
+	dbg(PSTR("baud rate: %lu"), baud);
+	return baud_rate = baud;
+}
+
+/*!
+ * Use hardware (RTS/CTS) flow control, modem is set to it via AT+IFC.
+ * Where the serial port doesn't handle it, give the pins wired to modem: an SMS payload is written only while modem holds
+ * \a cts_pin low, and \a rts_pin is held high while the receive buffer is nearly full.
+ * \param enable false to turn it off
+ * \param cts_pin input pin wired to CTS of modem, -1 if the port handles it
+ * \param rts_pin output pin wired to RTS of modem, -1 if the port handles it
+ * \return true if modem took it
+ */
+bool A6lib::setFlowControl(bool enable, int8_t cts_pin, int8_t rts_pin) {
+	ATCall call;
+	if (!prepareAT(&call, AT_IFC, enable ? 2 : 0, enable ? 2 : 0) || !cmd(call))
+		return false;
+
+	this->cts_pin = enable ? cts_pin : -1;
+	this->rts_pin = enable ? rts_pin : -1;
+	if (this->cts_pin >= 0)
+		pinMode(this->cts_pin, INPUT);
+	if (this->rts_pin >= 0) {
+		pinMode(this->rts_pin, OUTPUT);
+		digitalWrite(this->rts_pin, LOW);
+	}
+
+	return true;
+}
+
 /*!
  * the main handler of A6lib object.
  * this function needs to be called inside main loop regularly, for callbacks to work correctly.
+ * It also advances the command engine one step, so commands submitted via A6lib::submitCommand() make progress here.
  */
 void A6lib::handle() {
-	/* there are some notifications, mixed with last modem reply */
-	if (lastInterestedReply.length() != 0) {
-		parseForNotifications(&lastInterestedReply);
-		lastInterestedReply.remove(0);
+	if (!isWaiting) {
+		if (activeCommand()) {
+			runEngine();
+		} else if (fillRx()) {
+			/* nobody waits for these lines, just pick the notifications */
+			Span line;
+			while (nextLine(&line)) {}
+			consumeLines();
+			/* a line longer than rx, nobody waits for it */
+			if (rx.isFull())
+				spillRx(nullptr);
+		}
+#if A6_ASYNC_SMS
+		pumpSMSQueue();
+#endif
 	}
 
-	if (!isWaiting && stream->available()) {
-		auto reply = stream->readString();
-		parseForNotifications(&reply);
+	/* there are some notifications, mixed with last modem reply.
+	 * they're parsed in place from the front: parsing may issue new commands, which could queue more notifications
+	 * after them (those wait for the next call) or call A6lib::handle() again (it leaves them to this call) */
+	if (urc_len != 0 && !urc_dispatching) {
+		urc_dispatching = true;
+		for (uint16_t left = urc_len; left != 0;) {
+			char* line = urc_pending;
+			auto eol = static_cast<char*>(memchr(line, '\n', urc_len));
+			const uint16_t taken = eol - line + 1;
+			*eol = 0;
+			Span body = { eol, 0 };
+			if (auto sep = static_cast<char*>(memchr(line, '\r', eol - line))) {
+				*sep = 0;
+				body = Span{ sep + 1, static_cast<uint16_t>(eol - sep - 1) };
+				eol = sep;
+			}
+			parseForNotifications(Span{ line, static_cast<uint16_t>(eol - line) }, body);
+			urc_len -= taken;
+			urc_last = urc_last > taken ? urc_last - taken : 0;
+			memmove(urc_pending, urc_pending + taken, urc_len);
+			left -= taken;
+		}
+		urc_dispatching = false;
 	}
 }
 ///@cond INTERNAL
-void A6lib::parseForNotifications(String* data) {
-	if (!data)
-		return;
+static Span toSpan(const String& s) {
+	return Span{ s.c_str(), static_cast<uint16_t>(s.length()) };
+}
+
+/* the SMS content of a String, a char per byte */
+static pdu_text_t textOf(const String& s) {
+	return pdu_text_t{ s.c_str(), static_cast<uint16_t>(s.length()), PDU_TEXT_LATIN1 };
+}
+
+/* split the fields of the reply line beginning with prefix, e.g "+CSQ:" */
+static uint8_t replyFields(const String& reply, const char* prefix, Span* fields, uint8_t max) {
+	Span line;
+	if (!findLine(toSpan(reply), prefix, &line))
+		return 0;
+
+	return splitFields(line, fields, max);
+}
+
+/* the message reference from +CMGS reply, false if the SMS isn't accepted */
+static bool parseMessageRef(const String& reply, uint8_t* mr) {
+	Span field;
+	Span line;
+	if (!findLine(toSpan(reply), CMGS_CMD ":", &line))
+		return false;
+
+	if (mr && splitFields(line, &field, 1))
+		parseInt(field, mr);
+
+	return true;
+}
+
+/* notifications are parsed from a writable copy, so a field could be NUL terminated in place once all fields are split */
+static const char* fieldString(const Span& field) {
+	const_cast<char*>(field.data)[field.len] = 0;
+	return field.data;
+}
+
+enum LineType {
+	Line_None, /* no complete line yet */
+	Line_Empty,
+	Line_Intermediate, /* part of a command reply */
+	Line_Final, /* final result code of a command */
+	Line_Notification, /* unsolicited result code */
+};
+
+enum LineBody {
+	Body_None,
+	Body_Always, /* next line is the body, whatever it looks like */
+	Body_PDU, /* the same, only in PDU format */
+};
+
+#define NO_URC_HOOK 0xFF
+#define LINE_PREFIX(prefix, type, body, urc) { prefix, sizeof(prefix) - 1, type, body, urc }
+
+static const struct LinePrefix {
+	const char* prefix;
+	uint8_t len;
+	uint8_t type;
+	uint8_t body;
+	uint8_t urc; /* the built-in parser of a notification, A6lib::URCKind */
+} line_prefixes[] = {
+	LINE_PREFIX(RES_OK, Line_Final, Body_None, 0),
+	LINE_PREFIX(RES_ERR, Line_Final, Body_None, 0),
+	LINE_PREFIX(CME_CMD " " RES_ERR, Line_Final, Body_None, 0),
+	LINE_PREFIX(CMS_CMD " " RES_ERR, Line_Final, Body_None, 0),
+	LINE_PREFIX("NO CARRIER", Line_Final, Body_None, 0),
+	LINE_PREFIX("NO DIALTONE", Line_Final, Body_None, 0),
+	LINE_PREFIX("NO ANSWER", Line_Final, Body_None, 0),
+	LINE_PREFIX("BUSY", Line_Final, Body_None, 0),
+	LINE_PREFIX(CMGR_CMD, Line_Intermediate, Body_Always, 0),
+	LINE_PREFIX(CMGL_CMD, Line_Intermediate, Body_Always, 0),
+	LINE_PREFIX(NOTIF_CMTI, Line_Notification, Body_None, 1),
+	LINE_PREFIX(CMGS_CMD, Line_Notification, Body_None, 2), /* it's also the reply of AT+CMGS, which we report as SMS sent */
+	LINE_PREFIX(NOTIF_CIEV, Line_Notification, Body_None, 3),
+	LINE_PREFIX(NOTIF_RING, Line_Notification, Body_None, 4),
+	LINE_PREFIX(NOTIF_CLIP, Line_Notification, Body_None, 5),
+	LINE_PREFIX(CREG_CMD, Line_Notification, Body_None, 6), /* also the reply of AT+CREG?, told apart by its fields */
+	LINE_PREFIX(CUSD_CMD, Line_Notification, Body_None, 7),
+	LINE_PREFIX(NOTIF_CDS, Line_Notification, Body_PDU, 8),
+	LINE_PREFIX(NOTIF_CMT, Line_Notification, Body_Always, 9),
+};
+
+static_assert((A6_LINE_INDEX_SIZE & (A6_LINE_INDEX_SIZE - 1)) == 0, "A6_LINE_INDEX_SIZE must be a power of two");
+static_assert(countof(line_prefixes) + A6_URC_HOOKS < A6_LINE_INDEX_SIZE, "A6_LINE_INDEX_SIZE is too small");
+static_assert(A6_URC_HOOKS < 0x7F, "A6_URC_HOOKS is too big");
+
+/* length of the line prefix, it's the whole line or everything before ':' */
+static uint16_t linePrefixLength(const Span& line) {
+	auto colon = static_cast<const char*>(memchr(line.data, ':', line.len));
+	return colon ? colon - line.data : line.len;
+}
+
+static uint8_t linePrefixHash(const char* prefix, uint16_t len) {
+	uint16_t h = 5381;
+	for (uint16_t i = 0; i < len; i++)
+		h = (h << 5) + h + prefix[i];
+
+	return (h ^ (h >> 8)) & (A6_LINE_INDEX_SIZE - 1);
+}
+
+void A6lib::setURCHandler(URCKind kind, void(*fn)(), void* ctx) {
+	urc_handlers[kind].fn = fn;
+	urc_handlers[kind].ctx = fn ? ctx : nullptr;
+}
+
+void A6lib::indexLinePrefixes() {
+	memset(line_index, 0, sizeof(line_index));
+	for (uint8_t i = 0; i < countof(line_prefixes); i++)
+		indexLinePrefix(line_prefixes[i].prefix, line_prefixes[i].len, i + 1);
+	for (uint8_t i = 0; i < urc_hooks_len; i++)
+		indexLinePrefix(urc_hooks[i].prefix, strlen(urc_hooks[i].prefix), 0x80 | i);
+}
+
+/* put a prefix in the index, it takes over the slot of the same prefix if there's one */
+bool A6lib::indexLinePrefix(const char* prefix, uint8_t len, uint8_t value) {
+	uint8_t slot = linePrefixHash(prefix, len);
+	for (uint8_t n = 0; n < A6_LINE_INDEX_SIZE; n++, slot = (slot + 1) & (A6_LINE_INDEX_SIZE - 1)) {
+		const auto v = line_index[slot];
+		const bool same = v && ((v & 0x80) ? strlen(urc_hooks[v & 0x7F].prefix) == len && memcmp(urc_hooks[v & 0x7F].prefix, prefix, len) == 0 :
+			line_prefixes[v - 1].len == len && memcmp(line_prefixes[v - 1].prefix, prefix, len) == 0);
+		if (!v || same) {
+			line_index[slot] = value;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/* classify a line by its prefix, the hash index makes it a single probe most of the time */
+A6lib::LineClass A6lib::classifyLine(const Span& line) const {
+	const uint16_t len = linePrefixLength(line);
+	uint8_t slot = linePrefixHash(line.data, len);
+	for (uint8_t n = 0; n < A6_LINE_INDEX_SIZE; n++, slot = (slot + 1) & (A6_LINE_INDEX_SIZE - 1)) {
+		const auto v = line_index[slot];
+		if (!v)
+			break;
+		if (v & 0x80) {
+			const auto& hook = urc_hooks[v & 0x7F];
+			if (strlen(hook.prefix) == len && memcmp(hook.prefix, line.data, len) == 0)
+				return LineClass{ Line_Notification, static_cast<uint8_t>(hook.has_body ? Body_Always : Body_None), URC_None, static_cast<uint8_t>(v & 0x7F) };
+		} else {
+			const auto& p = line_prefixes[v - 1];
+			if (p.len == len && memcmp(p.prefix, line.data, len) == 0)
+				return LineClass{ p.type, p.body, p.urc, NO_URC_HOOK };
+		}
+	}
+
+	return LineClass{ Line_Intermediate, Body_None, URC_None, NO_URC_HOOK };
+}
 
-	if (!hasNotifications(*data))
+void A6lib::parseForNotifications(const Span& line, const Span& body) {
+	dbg(PSTR("notification: %s"), line.data);
+	const auto cls = classifyLine(line);
+	if (cls.hook != NO_URC_HOOK) {
+		const auto& hook = urc_hooks[cls.hook];
+		if (hook.cb)
+			hook.cb(hook.ctx, line, body);
 		return;
-	
-	auto cmtiStart = data->indexOf(NOTIF_CMTI ":");
-	auto cmgsStart = data->indexOf(CMGS_CMD ":");
-	auto smsFull = data->indexOf(NOTIF_CIEV ":");
-	dbg("new SMS indication!");
-#ifdef DEBUG
-	if (dbg_stream)
-		dbg_stream->print(*data);
-#endif
-	if (cmtiStart != -1) {
-		dbg(Literal("incoming SMS:").c_str());
-		if (sms_rx_cb) {
-			SMSInfo info;
-			int indx = 0;
-			const auto ok = sscanf(data->c_str(), Literal("%*[^+]+CMTI: \"%*[^\"]\",%d%*s").c_str(), &indx);
-			if (ok > 0) {
-				info = readSMS(indx);
+	}
+
+	const auto& h = urc_handlers[cls.urc];
+	Span fields[7];
+	const auto n = splitFields(line, fields, countof(fields));
+	switch (cls.urc) {
+	case URC_CMTI:
+		dbg(PSTR("incoming SMS:"));
+		if ((sms_rx_cb || h.fn) && n > 1) {
+			const uint8_t indx = spanToInt(fields[1]);
+			const auto info = readSMS(indx);
+			if (sms_rx_cb)
 				sms_rx_cb(indx, info);
-			}
+			if (h.fn)
+				reinterpret_cast<sms_index_cb_t>(h.fn)(h.ctx, indx, info);
 		}
-	} else if (cmgsStart != -1) {
-		dbg(Literal("SMS sent.").c_str());
+		break;
+	case URC_CMGS:
+		dbg(PSTR("SMS sent."));
 		if (sms_tx_cb)
 			sms_tx_cb();
-	} else if (smsFull != -1 && data->indexOf("SMSFULL") != -1) {
-		dbg(Literal("modem prefered storage is full!").c_str());
+		if (h.fn)
+			reinterpret_cast<ctx_cb_t>(h.fn)(h.ctx);
+		break;
+	case URC_CIEV:
+		if (spanIndexOf(line, "SMSFULL") == -1)
+			break;
+		dbg(PSTR("modem prefered storage is full!"));
 		if (sms_full_cb)
 			sms_full_cb();
+		if (h.fn)
+			reinterpret_cast<ctx_cb_t>(h.fn)(h.ctx);
+		break;
+	case URC_RING:
+		if (h.fn)
+			reinterpret_cast<ctx_cb_t>(h.fn)(h.ctx);
+		break;
+	case URC_CLIP:
+		/* "<number>",<type>,... the reply of AT+CLIP? has no quoted number */
+		if (h.fn && n > 1 && isQuoted(line, fields[0]))
+			reinterpret_cast<clip_cb_t>(h.fn)(h.ctx, fieldString(fields[0]), spanToInt(fields[1]));
+		break;
+	case URC_CREG:
+		/* <stat>[,"<lac>","<ci>"], while the reply of AT+CREG? is <n>,<stat>[,"<lac>","<ci>"] */
+		if (h.fn && n > 0 && (n == 1 || isQuoted(line, fields[1])))
+			reinterpret_cast<creg_cb_t>(h.fn)(h.ctx, static_cast<RegisterStatus>(spanToInt(fields[0])));
+		break;
+	case URC_CUSD:
+		/* <m>[,"<str>",<dcs>] */
+		if (h.fn && n > 0)
+			reinterpret_cast<ussd_cb_t>(h.fn)(h.ctx, spanToInt(fields[0]), n > 1 ? fieldString(fields[1]) : "");
+		break;
+	case URC_CDS:
+		if (!h.fn)
+			break;
+		if (body.len) {
+			/* PDU mode: <length> followed by the SMS-STATUS-REPORT pdu */
+			uint8_t pdu[PDU_MAX_LEN];
+			pdu_status_report_t report;
+			const auto pdu_len = fromHex(body.data, body.len, pdu, sizeof(pdu));
+			if (pdu_len > 0 && pdu_decode_status_report(pdu, pdu_len, &report) == 0)
+				reinterpret_cast<status_report_cb_t>(h.fn)(h.ctx, report.mr, report.st, report.ra);
+		} else if (n == 7) {
+			/* text mode: <fo>,<mr>,"<ra>",<tora>,"<scts>","<dt>",<st> */
+			const auto number = fieldString(fields[2]);
+			reinterpret_cast<status_report_cb_t>(h.fn)(h.ctx, spanToInt(fields[1]), spanToInt(fields[6]), number[0] == '+' ? number + 1 : number);
+		}
+		break;
+	case URC_CMT:
+		if (!h.fn)
+			break;
+		dbg(PSTR("incoming SMS:"));
+		if (sms_format == Format_PDU) {
+			/* [<alpha>],<length> followed by the SMS-DELIVER pdu */
+			SMSInfo info;
+			if (decodeSMS(body, &info))
+				reinterpret_cast<sms_cb_t>(h.fn)(h.ctx, info);
+		} else if (n > 2) {
+			/* "<oa>",[<alpha>],"<scts>" followed by the text */
+			SMSInfo info;
+			const auto number = fieldString(fields[0]);
+			info.number = String(number[0] == '+' ? number + 1 : number);
+			info.dateTime = toTime(fieldString(fields[2]), PSTR(SMS_TIME_FORMAT));
+			info.message = String(body.data);
+			reinterpret_cast<sms_cb_t>(h.fn)(h.ctx, info);
+		}
+		break;
+	}
+}
+
+/* keep the notification line, it'll be parsed on next A6lib::handle() call */
+bool A6lib::queueNotification(const Span& line) {
+	if (urc_len + line.len + 1 > A6_URC_BUFFER_SIZE) {
+		dbg(PSTR("notification dropped, no room!"));
+		return false;
 	}
 
+	urc_last = urc_len;
+	memcpy(urc_pending + urc_len, line.data, line.len);
+	urc_len += line.len;
+	urc_pending[urc_len++] = '\n';
+
+	return true;
 }
 
-bool A6lib::hasNotifications(const String& arg) {
-	return arg.indexOf(NOTIF_CMTI ":") != -1 || arg.indexOf(CMGS_CMD ":") != -1 || arg.indexOf(NOTIF_CIEV ":") != -1;
+/* keep the body line of the last queued notification after a '\r', the notification is dropped if there's no room */
+void A6lib::queueNotificationBody(const Span& line) {
+	if (urc_len + line.len + 1 > A6_URC_BUFFER_SIZE) {
+		dbg(PSTR("notification dropped, no room!"));
+		urc_len = urc_last;
+		return;
+	}
+
+	urc_pending[urc_len - 1] = '\r';
+	memcpy(urc_pending + urc_len, line.data, line.len);
+	urc_len += line.len;
+	urc_pending[urc_len++] = '\n';
 }
 ///@endcond
 #ifdef A6_T
@@ -274,7 +778,7 @@ bool A6lib::hasNotifications(const String& arg) {
  * \param pin the pin number which is connected to modem PWR pin(or PWR_KEY pin).
  */
 void A6lib::powerUp(int pin) {
-	dbg(Literal("powering up the modem...").c_str());
+	dbg(PSTR("powering up the modem..."));
 	powerOn(pin);
 	delay(2000);
 	powerOff(pin);
@@ -287,7 +791,8 @@ void A6lib::powerUp(int pin) {
  * You may also need to reinitilize module with A6lib::start().
  */
 void A6lib::softReset() {
-	cmd(AT_PREFIX RST_CMD, PLACE_HOLDER, PLACE_HOLDER, 0, 0);
+	invalidateFacts();
+	at(AT_RST);
 }
 #endif
 /*!
@@ -298,6 +803,7 @@ void A6lib::softReset() {
 * \param pin the pin number which is connected to modem reset(RST) pin.
 */
 void A6lib::hardReset(uint8_t pin) {
+	invalidateFacts();
 	powerOff(pin);
 	delay(120);
 	powerOn(pin);
@@ -310,31 +816,107 @@ void A6lib::hardReset(uint8_t pin) {
 bool A6lib::isSIMInserted() {
 	String reply;
 	
-	return cmd(AT_PREFIX "+CPIN?", Literal("+CPIN").c_str(), RES_OK, A6_CMD_TIMEOUT, A6_CMD_MAX_RETRY, &reply);
+	return at(AT_CPIN, &reply);
 }
 
 String A6lib::getSIMNumber() {
+	String value;
+	if (lookupFact(Fact_SIMNumber, &value))
+		return value;
+
 	String reply;
-	if (cmd(AT_PREFIX CNUM_CMD, CNUM_CMD, RES_OK, A6_CMD_TIMEOUT, A6_CMD_MAX_RETRY, &reply)) {
+	if (at(AT_CNUM, &reply)) {
 		char buff[32];
-		const auto ok = sscanf(reply.c_str(), Literal("%*[^+]+CNUM: \"\",\"+%[^\"]\",%*d%*s").c_str(), buff);
-		if (ok > 0)
-			return String(buff);
+		Span fields[2];
+		if (replyFields(reply, CNUM_CMD ":", fields, 2) == 2 && copyField(skipPlus(fields[1]), buff, sizeof(buff)) && buff[0])
+			return storeFact(Fact_SIMNumber, buff);
 	}
 
 	return String();
 }
 
+/*!
+ * Set how long a modem fact is kept once read, the getter of a fact returns the kept value without asking modem until it expires.
+ * All facts are kept forever by default and are forgotten by A6lib::start(), A6lib::hardReset(), A6lib::softReset() and A6lib::invalidateFacts().
+ * \param fact one of the ::ModemFact value
+ * \param ttl time to live in ms, FACT_TTL_FOREVER to never expire or 0 to always ask modem
+ */
+void A6lib::setFactTTL(ModemFact fact, unsigned long ttl) {
+#if A6_FACT_CACHE
+	if (fact >= Fact_Count)
+		return;
+
+	facts[fact].ttl = ttl;
+	facts[fact].valid = false;
+#endif
+}
+
+/*!
+ * Forget all the kept modem facts, next getter calls will ask modem again.
+ */
+void A6lib::invalidateFacts() {
+#if A6_FACT_CACHE
+	for (auto& f : facts)
+		f.valid = false;
+#endif
+}
+
+/*!
+ * Forget a kept modem fact, next call to its getter will ask modem again.
+ * \param fact one of the ::ModemFact value
+ */
+void A6lib::invalidateFact(ModemFact fact) {
+#if A6_FACT_CACHE
+	if (fact < Fact_Count)
+		facts[fact].valid = false;
+#endif
+}
+
+///@cond INTERNAL
+#if A6_FACT_CACHE
+bool A6lib::lookupFact(ModemFact fact, String* value) const {
+	const auto& f = facts[fact];
+	if (!f.valid || (f.ttl != FACT_TTL_FOREVER && millis() - f.stamp >= f.ttl))
+		return false;
+
+	*value = f.value;
+	return true;
+}
+
+String A6lib::storeFact(ModemFact fact, const char* value) {
+	auto& f = facts[fact];
+	const auto len = strlen(value);
+	/* longer values are just not kept */
+	if (f.ttl && len <= A6_FACT_MAX_LEN) {
+		memcpy(f.value, value, len + 1);
+		f.stamp = millis();
+		f.valid = true;
+	}
+
+	return String(value);
+}
+#else
+/* nothing is kept, every getter asks modem */
+bool A6lib::lookupFact(ModemFact, String*) const {
+	return false;
+}
+
+String A6lib::storeFact(ModemFact, const char* value) {
+	return String(value);
+}
+#endif
+///@endcond
+
 /*!
 * get the current modem working status.
 * \return on of the ::DeviceStatus value.
 */
 DeviceStatus A6lib::getDeviceStatus() {
 	String reply;
-	if (cmd(AT_PREFIX CPAS_CMD, CPAS_CMD, RES_OK, A6_CMD_TIMEOUT, A6_CMD_MAX_RETRY, &reply)) {
-		int status = DeviceStatus::Status_Unknown;
-		const auto ok = sscanf(reply.c_str(), Literal("%*[^+]+CPAS: %d%*s").c_str(), &status);
-		if (ok > 0)
+	if (at(AT_CPAS, &reply)) {
+		Span field;
+		int32_t status;
+		if (replyFields(reply, CPAS_CMD ":", &field, 1) && parseInt(field, &status))
 			return static_cast<DeviceStatus>(status);
 	}
 
@@ -346,13 +928,21 @@ DeviceStatus A6lib::getDeviceStatus() {
 * \return If success a String contain firmware version, and if fail an empty string.
 */
 String A6lib::getFirmWareVer() {
+	String value;
+	if (lookupFact(Fact_FirmWare, &value))
+		return value;
+
 	String reply;
-	if (cmd(AT_PREFIX GMR_CMD, RES_OK, RES_ERR, A6_CMD_TIMEOUT, A6_CMD_MAX_RETRY, &reply)) {
-		reply.replace(Literal("Revision:"), "");
+	if (at(AT_GMR, &reply)) {
+		/* skip the "Revision:" label, if any */
+		Span line;
 		char buff[32];
-		const auto ok = sscanf(reply.c_str(), Literal("%s[^\r]%[^s]").c_str(), buff);
-		if (ok > 0)
-			return String(buff);
+		if (firstLine(toSpan(reply), &line)) {
+			if (line.len >= 9 && strncmp_P(line.data, PSTR("Revision:"), 9) == 0)
+				line = spanTrim(Span{ line.data + 9, static_cast<uint16_t>(line.len - 9) });
+			if (line.len && copyField(line, buff, sizeof(buff)))
+				return storeFact(Fact_FirmWare, buff);
+		}
 	}
 
 	return String();
@@ -365,7 +955,7 @@ String A6lib::getFirmWareVer() {
 int A6lib::getRSSI() {
 	String reply;
 	int rssi = 0;
-	if (cmd(AT_PREFIX CSQ_CMD, CSQ_CMD, RES_OK, A6_CMD_TIMEOUT, A6_CMD_MAX_RETRY, &reply)) {
+	if (at(AT_CSQ, &reply)) {
 		/*
 			return value:
 			0 -> -113 dBm or less
@@ -374,8 +964,8 @@ int A6lib::getRSSI() {
 			31 -> -51 dBm or greater
 			99 -> Uknown
 		*/
-		const auto ok = sscanf(reply.c_str(), Literal("%*[^+]+CSQ: %d,%*d%*s").c_str(), &rssi);
-		if (ok > 0) {
+		Span field;
+		if (replyFields(reply, CSQ_CMD ":", &field, 1) && parseInt(field, &rssi)) {
 			/* convert to RSSI */
 			rssi -= 2;
 			rssi *= 2;
@@ -415,14 +1005,11 @@ uint8_t A6lib::getSignalQuality() {
 */
 time_t A6lib::getRealTimeClock() {
 	String reply;
-	if (cmd(AT_PREFIX CCLK_CMD "?", CCLK_CMD, RES_OK, A6_CMD_TIMEOUT, A6_CMD_MAX_RETRY, &reply)) {
+	if (at(AT_CCLK, &reply)) {
 		struct tm time;
-		time.tm_isdst = -1;
 		int tz = 0;
-		const auto ok = sscanf(reply.c_str(), Literal("%*[^+]+CCLK: \"%d/%d/%d,%d:%d:%d+%d\"").c_str(), &time.tm_year, &time.tm_mon, &time.tm_mday, &time.tm_hour, &time.tm_min, &time.tm_sec, &tz);
-		if (ok > 0) {
-			time.tm_year += 2000 - 1900;
-			time.tm_mon -= 1;
+		Span field;
+		if (replyFields(reply, CCLK_CMD ":", &field, 1) && parseTime(field, &time, &tz)) {
 			auto epoch = mktime(&time) + (tz * 15 * 60);
 			return epoch;
 		}
@@ -441,10 +1028,12 @@ String A6lib::getRealTimeClockString(const String& format) {
 		return String();
 
 	char buff[32];
-	if (format.length() > 0)
+	if (format.length() > 0) {
 		strftime(buff, sizeof(buff), format.c_str(), localtime(&cclk));
-	else
-		strftime(buff, sizeof(buff), Literal("%Y.%m.%d,%H:%M:%S").c_str(), localtime(&cclk));
+	} else {
+		StackLiteral(fmt, "%Y.%m.%d,%H:%M:%S");
+		strftime(buff, sizeof(buff), fmt, localtime(&cclk));
+	}
 
 	return String(buff);
 }
@@ -454,12 +1043,16 @@ String A6lib::getRealTimeClockString(const String& format) {
 * \return if success a string contain IMEI number, if fail an empty string.
 */
 String A6lib::getIMEI() {
+	String value;
+	if (lookupFact(Fact_IMEI, &value))
+		return value;
+
 	String reply;
-	if (cmd(AT_PREFIX GSN_CMD, RES_OK, RES_ERR, A6_CMD_TIMEOUT, A6_CMD_MAX_RETRY, &reply)) {
+	if (at(AT_GSN, &reply)) {
+		Span line;
 		char buff[32];
-		const auto ok = sscanf(reply.c_str(), Literal("%s[\r]%*s").c_str(), buff);
-		if (ok > 0)
-			return String(buff);
+		if (firstLine(toSpan(reply), &line) && copyField(line, buff, sizeof(buff)))
+			return storeFact(Fact_IMEI, buff);
 	}
 
 	return String();
@@ -470,12 +1063,16 @@ String A6lib::getIMEI() {
  * \return if success a string contain SCA, if fail an empty string
  */
 String A6lib::getSMSSca() {
+	String value;
+	if (lookupFact(Fact_SCA, &value))
+		return value;
+
 	String reply;
-	if (cmd(AT_PREFIX CSCA_CMD "?", CSCA_CMD, RES_OK, A6_CMD_TIMEOUT, A6_CMD_MAX_RETRY, &reply)) {
+	if (at(AT_CSCA, &reply)) {
 		char buff[32];
-		const auto ok = sscanf(reply.c_str(), Literal("%*[^+]+CSCA: \"+%[^\"]\",%*d%*s").c_str(), buff);
-		if (ok > 0)
-			return String(buff);
+		Span field;
+		if (replyFields(reply, CSCA_CMD ":", &field, 1) && copyField(skipPlus(field), buff, sizeof(buff)) && buff[0])
+			return storeFact(Fact_SCA, buff);
 	}
 	
 	return String();
@@ -487,28 +1084,45 @@ String A6lib::getSMSSca() {
 */
 RegisterStatus A6lib::getRegisterStatus() {
 	String reply;
-	if (cmd(AT_PREFIX CREG_CMD "?", CREG_CMD, RES_OK, A6_CMD_TIMEOUT, A6_CMD_MAX_RETRY, &reply)) {
-		int status = static_cast<int>(RegisterStatus::Unknown);
-		const auto ok = sscanf(reply.c_str(), Literal("%*[^+]+CREG: %*d,%d%*s").c_str(), &status);
-		if (ok > 0)
+	if (at(AT_CREG, &reply)) {
+		Span fields[2];
+		int32_t status;
+		if (replyFields(reply, CREG_CMD ":", fields, 2) == 2 && parseInt(fields[1], &status))
 			return static_cast<RegisterStatus>(status);
 	}
 
 	return RegisterStatus::Unknown;
 }
 
+/*!
+* Submit AT+CREG? to the command engine without waiting for it, e.g to check modem registration from a loop.
+* \param response receives the reply once the command is finished, its +CREG line has the status
+* \return the command handle, or INVALID_CMD_HANDLE if the engine is full
+*/
+cmd_handle_t A6lib::submitRegisterStatus(String* response) {
+	ATCall call;
+	if (!prepareAT(&call, AT_CREG))
+		return INVALID_CMD_HANDLE;
+
+	return submitCommand(call.command, call.resp1, call.resp2, call.timeout, call.max_retry, response);
+}
+
 /*!
 * Get the Network operator name. note that the name is read from SIM card.
 * \return if success a String contain the operator name, else an empty String
 */
 #ifdef SIM800_T
 String A6lib::getOperatorName() {
+	String value;
+	if (lookupFact(Fact_Operator, &value))
+		return value;
+
 	String reply;
-	if (cmd(AT_PREFIX CSPN_CMD "?", CSPN_CMD, RES_OK, A6_CMD_TIMEOUT, A6_CMD_MAX_RETRY, &reply)) {
+	if (at(AT_CSPN, &reply)) {
 		char buff[32];
-		const auto ok = sscanf(reply.c_str(), Literal("%*[^+]+CSPN: \"%[^\"]\",%*d%*s").c_str(), buff);
-		if (ok > 0)
-			return String(buff);
+		Span field;
+		if (replyFields(reply, CSPN_CMD ":", &field, 1) && copyField(field, buff, sizeof(buff)) && buff[0])
+			return storeFact(Fact_Operator, buff);
 	}
 
 	return String();
@@ -520,11 +1134,10 @@ String A6lib::getOperatorName() {
 */
 int A6lib::getADCValue() {
 	String reply;
-	if (cmd(AT_PREFIX CADC_CMD "?", CADC_CMD, RES_OK, A6_CMD_TIMEOUT, A6_CMD_MAX_RETRY, &reply)) {
-		int status = -1;
-		int adc = -1;
-		const auto ok = sscanf(reply.c_str(), Literal("%*[^+]+CADC: %d,%d%*s").c_str(), &status, &adc);
-		if (ok > 0 && status)
+	if (at(AT_CADC, &reply)) {
+		Span fields[2];
+		int32_t status, adc;
+		if (replyFields(reply, CADC_CMD ":", fields, 2) == 2 && parseInt(fields[0], &status) && status && parseInt(fields[1], &adc))
 			return adc;
 		else
 			return -1;
@@ -592,58 +1205,279 @@ String A6lib::sendCommand(const String& command, uint16_t reply_timeout) {
 	return reply;
 }
 
+/*!
+ * Submit a command to the command engine without waiting for its reply.
+ * Commands are sent to the modem in the order they're submitted, each A6lib::handle() call advances the one in progress by a single step.
+ * \param command the valid command to be sent with AT prefix(up to A6_CMD_MAX_LEN chars), an empty string only waits for the reply
+ * \param resp1 the first expected reply, it must stay valid until the command is finished(e.g a string literal)
+ * \param resp2 the second expected reply, it must stay valid until the command is finished(e.g a string literal)
+ * \param timeout the amount of time(as ms) we wait for reply on each try
+ * \param max_retry the number of times the command is sent before giving up
+ * \param response if not null, it will contain the modem reply on success. it must stay valid until the command is finished
+ * \return a handle to query the command with, or INVALID_CMD_HANDLE if the engine is full or the command is too long
+ */
+cmd_handle_t A6lib::submitCommand(const char* command, const char* resp1, const char* resp2, uint16_t timeout, uint8_t max_retry, String* response) {
+	if (!command || !resp1 || !resp2 || strlen(command) > A6_CMD_MAX_LEN)
+		return INVALID_CMD_HANDLE;
+
+	/* prefer free slots, then the oldest finished one */
+	Command* slot = nullptr;
+	for (auto& c : commands) {
+		if (c.state == Cmd_Invalid) {
+			slot = &c;
+			break;
+		}
+		if ((c.state == Cmd_Success || c.state == Cmd_Failed) && (!slot || (int16_t)(c.id - slot->id) < 0))
+			slot = &c;
+	}
+	if (!slot)
+		return INVALID_CMD_HANDLE;
+
+	if (next_cmd_id == INVALID_CMD_HANDLE)
+		next_cmd_id++;
+	slot->id = next_cmd_id++;
+	slot->state = Cmd_Queued;
+	strcpy(slot->command, command);
+	slot->resp1 = resp1;
+	slot->resp2 = resp2;
+	slot->timeout = timeout;
+	slot->attempts = max_retry ? max_retry : 1;
+	slot->started = 0;
+	slot->response = response;
+	slot->sink = nullptr;
+	slot->sink_ctx = nullptr;
+	slot->cls = commandClass(command, resp1);
+	slot->retried = false;
+	slot->payload = nullptr;
+	slot->payload_len = 0;
+	slot->payload_hex = false;
+	slot->prompted = false;
+	slot->payload_pos = 0;
+	slot->payload_sent = false;
+
+	return slot->id;
+}
+
+/*!
+ * Get the state of a command submitted via A6lib::submitCommand().
+ * The result of a finished command stays available until its slot is needed by a new command.
+ * \param handle the command handle
+ * \return on of the ::CommandState value
+ */
+CommandState A6lib::commandState(cmd_handle_t handle) const {
+	for (const auto& c : commands) {
+		if (c.state != Cmd_Invalid && c.id == handle)
+			return c.state;
+	}
+
+	return Cmd_Invalid;
+}
+
+/*!
+ * Let A6lib pick the reply timeout of each command from the latency it learned for the command class (e.g "+CSQ"),
+ * instead of the fixed worst case timeout. It's the smoothed latency plus four times its mean deviation (like TCP retransmission timeout),
+ * clamped to [\a min_timeout, \a max_timeout]. A class uses its fixed timeout until a few replies are measured, and its timeout doubles on each miss.
+ * \param enable true to use the adaptive timeouts, latencies are learned anyway
+ * \param min_timeout the lower bound in ms
+ * \param max_timeout the upper bound in ms
+ */
+void A6lib::setAdaptiveTimeout(bool enable, uint16_t min_timeout, uint16_t max_timeout) {
+	adaptive_timeout = enable;
+	this->min_timeout = min_timeout;
+	this->max_timeout = maximum(min_timeout, max_timeout);
+}
+
+/*!
+ * Get the reply latencies learned for command classes.
+ * \param buff input buffer to store the timings
+ * \param len size of buff
+ * \return number of timings stored in \a buff
+ */
+uint8_t A6lib::getCommandTimings(CommandTiming* buff, uint8_t len) const {
+	if (buff == nullptr)
+		return 0;
+
+	uint8_t n = 0;
+	for (const auto& cls : classes) {
+		if (n == len)
+			break;
+		if (!cls.prefix[0])
+			continue;
+		auto& t = buff[n++];
+		memcpy(t.prefix, cls.prefix, sizeof(t.prefix));
+		t.latency = cls.srtt >> 3;
+		t.deviation = cls.rttvar >> 2;
+		t.timeout = classTimeout(cls);
+		t.samples = cls.samples;
+	}
+
+	return n;
+}
+
+/*!
+ * Get the reply latency A6lib learned for a command class.
+ * \param prefix the class prefix, e.g "+CMGS"
+ * \param timing receives the timing of the class
+ * \return true if the class is known
+ */
+bool A6lib::getCommandTiming(const char* prefix, CommandTiming* timing) const {
+	for (const auto& cls : classes) {
+		if (!cls.prefix[0] || strcmp(cls.prefix, prefix) != 0)
+			continue;
+		memcpy(timing->prefix, cls.prefix, sizeof(timing->prefix));
+		timing->latency = cls.srtt >> 3;
+		timing->deviation = cls.rttvar >> 2;
+		timing->timeout = classTimeout(cls);
+		timing->samples = cls.samples;
+		return true;
+	}
+
+	return false;
+}
+
+/*!
+ * Get how long modem took to give the SMS prompt (">") of the last AT+CMGS, from the command being written.
+ * The payload is written as soon as the prompt arrives, so this is the time modem needs before it takes a message.
+ * \return the latency in ms, 0 if no prompt has arrived yet
+ */
+uint16_t A6lib::getPromptLatency() const {
+	return prompt_latency;
+}
+
+#ifdef A6_PERF_COUNTERS
+/*!
+ * Get the performance counters of command classes, they're collected when A6_PERF_COUNTERS is defined.
+ * \param buff input buffer to store the counters
+ * \param len size of buff
+ * \return number of counters stored in \a buff
+ */
+uint8_t A6lib::getCommandStats(CommandStats* buff, uint8_t len) const {
+	if (buff == nullptr)
+		return 0;
+
+	uint8_t n = 0;
+	for (const auto& cls : classes) {
+		if (n == len)
+			break;
+		if (!cls.prefix[0])
+			continue;
+		auto& st = buff[n++];
+		memcpy(st.prefix, cls.prefix, sizeof(st.prefix));
+		st.count = cls.count;
+		st.success = cls.success;
+		st.retries = cls.retries;
+		st.timeouts = cls.timeouts;
+		st.tx_bytes = cls.tx_bytes;
+		st.rx_bytes = cls.rx_bytes;
+		st.min_latency = cls.min_latency;
+		st.avg_latency = cls.success ? cls.sum_latency / cls.success : 0;
+		st.max_latency = cls.max_latency;
+		st.prompts = cls.prompts;
+		st.avg_prompt_latency = cls.prompts ? cls.sum_prompt / cls.prompts : 0;
+		st.max_prompt_latency = cls.max_prompt;
+
+		/* the upper bound of the bucket which holds the 95th percentile */
+		st.p95_latency = 0;
+		uint32_t seen = 0;
+		for (uint8_t i = 0; i < countof(cls.histogram); i++) {
+			seen += cls.histogram[i];
+			if (seen * 100 >= cls.success * 95UL && cls.success) {
+				st.p95_latency = minimum(i ? (1UL << i) - 1 : 0UL, (unsigned long)cls.max_latency);
+				break;
+			}
+		}
+	}
+
+	return n;
+}
+
+/*!
+ * Clear the performance counters of all command classes, the learned latencies are kept.
+ */
+void A6lib::resetCommandStats() {
+	for (auto& cls : classes) {
+		cls.count = cls.success = cls.retries = cls.timeouts = 0;
+		cls.tx_bytes = cls.rx_bytes = 0;
+		cls.min_latency = cls.max_latency = 0;
+		cls.sum_latency = 0;
+		memset(cls.histogram, 0, sizeof(cls.histogram));
+		cls.prompts = cls.max_prompt = 0;
+		cls.sum_prompt = 0;
+	}
+}
+#endif
+
+/*!
+ * Block until the given command is finished. A6lib will call the handler added via A6lib::addHandler() meanwhile.
+ * \param handle the command handle
+ * \return true if the command got its expected reply
+ */
+bool A6lib::waitForCommand(cmd_handle_t handle) {
+	const auto was_waiting = isWaiting;
+	isWaiting = true;
+	auto state = commandState(handle);
+	while (state == Cmd_Queued || state == Cmd_Waiting) {
+		yield();
+		if (handler_cb)
+			handler_cb();
+		runEngine();
+		state = commandState(handle);
+	}
+	isWaiting = was_waiting;
+
+	return state == Cmd_Success;
+}
+
 ///@cond INTERNAL
 // Dial a number.
 void A6lib::dial(String number) {
-	char buffer[50];
-
-	dbg("Dialing number...");
+	dbg(PSTR("Dialing number..."));
 
-	sprintf(buffer, "ATD%s;", number.c_str());
-	cmd(buffer, "OK", "yy", A6_CMD_TIMEOUT, 2);
+	ATCall call;
+	if (prepareAT(&call, AT_DIAL, number.c_str()))
+		cmd(call);
 }
 
 
 // Redial the last number.
 void A6lib::redial() {
-	dbg("Redialing last number...");
-	cmd("AT+DLST", "OK", "CONNECT", A6_CMD_TIMEOUT, 2);
+	dbg(PSTR("Redialing last number..."));
+	at(AT_REDIAL);
 }
 
 
 // Answer a call.
 void A6lib::answer() {
-	cmd("ATA", "OK", "yy", A6_CMD_TIMEOUT, 2);
+	at(AT_ANSWER);
 }
 
 
 // Hang up the phone.
 void A6lib::hangUp() {
-	cmd("ATH", "OK", "yy", A6_CMD_TIMEOUT, 2);
+	at(AT_HANGUP);
 }
 
 
 // Check whether there is an active call.
 callInfo A6lib::checkCallStatus() {
-	char number[50];
 	String response = "";
-	uint32_t respStart = 0, matched = 0;
 	callInfo cinfo;
 
 	// Issue the command and wait for the response.
-	cmd("AT+CLCC", "OK", "+CLCC", A6_CMD_TIMEOUT, 2, &response);
+	at(AT_CLCC, &response);
 
 	// Parse the response if it contains a valid +CLCC.
-	respStart = response.indexOf("+CLCC");
-	if (respStart >= 0) {
-		matched = sscanf(response.substring(respStart).c_str(), "+CLCC: %d,%d,%d,%d,%d,\"%s\",%d", &cinfo.index, &cinfo.direction, &cinfo.state, &cinfo.mode, &cinfo.multiparty, number, &cinfo.type);
-		cinfo.number = String(number);
-	}
-
-	uint8_t comma_index = cinfo.number.indexOf('"');
-	if (comma_index != -1) {
-		dbg("Extra comma found.");
-		cinfo.number = cinfo.number.substring(0, comma_index);
+	Span fields[7];
+	if (replyFields(response, "+CLCC:", fields, 7) == 7) {
+		cinfo.index = spanToInt(fields[0]);
+		cinfo.direction = static_cast<call_direction>(spanToInt(fields[1]));
+		cinfo.state = static_cast<call_state>(spanToInt(fields[2]));
+		cinfo.mode = static_cast<call_mode>(spanToInt(fields[3]));
+		cinfo.multiparty = spanToInt(fields[4]);
+		cinfo.type = spanToInt(fields[6]);
+		char number[50];
+		if (copyField(fields[5], number, sizeof(number)))
+			cinfo.number = String(number);
 	}
 
 	return cinfo;
@@ -652,23 +1486,21 @@ callInfo A6lib::checkCallStatus() {
 // Set the volume for the speaker. level should be a number between 5 and
 // 8 inclusive.
 void A6lib::setVol(byte level) {
-	char buffer[30];
-
 	// level should be between 5 and 8.
 	level = minimum(maximum(level, 5), 8);
-	sprintf(buffer, "AT+CLVL=%d", level);
-	cmd(buffer, "OK", "yy", A6_CMD_TIMEOUT, 2);
+	ATCall call;
+	if (prepareAT(&call, AT_CLVL, level))
+		cmd(call);
 }
 
 // Enable the speaker, rather than the headphones. Pass 0 to route audio through
 // headphones, 1 through speaker.
 void A6lib::enableSpeaker(byte enable) {
-	char buffer[30];
-
 	// enable should be between 0 and 1.
 	enable = minimum(maximum(enable, 0), 1);
-	sprintf(buffer, "AT+SNFS=%d", enable);
-	cmd(buffer, "OK", "yy", A6_CMD_TIMEOUT, 2);
+	ATCall call;
+	if (prepareAT(&call, AT_SNFS, enable))
+		cmd(call);
 }
 ///@cond INTERNAL
 
@@ -680,15 +1512,18 @@ void A6lib::enableSpeaker(byte enable) {
 * \return String contain USSD result
 */
 String A6lib::sendUSSD(const String& ussd_code, uint16_t timeout) {
-	char buff[64];
-	sprintf(buff, Literal(AT_PREFIX CUSD_CMD "=1,\"%s\",15").c_str(), ussd_code.c_str());
+	ATCall call;
+	if (!prepareAT(&call, AT_CUSD, ussd_code.c_str()))
+		return String();
+	if (timeout != UINT16_MAX)
+		call.timeout = timeout;
 	String reply;
-	uint16_t time_out = (timeout == UINT16_MAX) ? A6_CMD_TIMEOUT * 1.5 : timeout;
-	if (cmd(buff, CUSD_CMD, RES_ERR, time_out, A6_CMD_MAX_RETRY, &reply)) {
-		char buff[128];
-		const auto ok = sscanf(reply.c_str(), Literal("%*[^+]+CUSD: %*d, \"%[^\"], %*d%*s").c_str(), buff);
-		if (ok > 0)
-			return String(buff);
+	if (cmd(call, &reply)) {
+		Span fields[2];
+		if (replyFields(reply, CUSD_CMD ":", fields, 2) == 2) {
+			const auto begin = fields[1].data - reply.c_str();
+			return reply.substring(begin, begin + fields[1].len);
+		}
 	}
 
 	return reply;
@@ -701,264 +1536,438 @@ String A6lib::sendUSSD(const String& ussd_code, uint16_t timeout) {
  * \return true on success
  */
 bool A6lib::setSMSStorageArea(SMSStorageArea area) {
-	String command(AT_PREFIX CPMS_CMD "=");
 	/*
 		SIM800 options: "SM", "ME", "SM_P", "ME_P", "MT"
 		A6 options: "SM", "ME", "MT"
 	*/
-	switch (area) {
-	default:
-	case ME:
-#ifdef A6_T
-		command.concat(Literal("ME,ME,ME").c_str());
-#elif defined(SIM800_T)
-		command.concat(Literal("\"ME\",\"ME\",\"ME\"").c_str());
-#endif
-		break;
-	case SM:
-#ifdef A6_T
-		command.concat(Literal("SM,SM,SM").c_str());
-#elif defined(SIM800_T)
-		command.concat(Literal("\"SM\",\"SM\",\"SM\"").c_str());
-#endif
-		break;
-	case MT:
-#ifdef A6_T
-		command.concat(Literal("MT,MT,MT").c_str());
-#elif defined(SIM800_T)
-		command.concat(Literal("\"MT\",\"MT\",\"MT\"").c_str());
-#endif
-		break;
-#ifdef SIM800_T
-	case SM_P:
-		command.concat(Literal("\"SM_P\",\"SM_P\",\"SM_P\"").c_str());
-		break;
-	case ME_P:
-		command.concat(Literal("\"ME_P\",\"ME_P\",\"ME_P\"").c_str());
-		break;
-#endif
-	}
+	if (area < ME || area >= countof(storage_names))
+		area = ME;
+	char name[sizeof(storage_names[0])];
+	strcpy_P(name, storage_names[area]);
+	ATCall call;
 
-	return cmd(command.c_str(), CPMS_CMD, RES_OK, A6_CMD_TIMEOUT, A6_CMD_MAX_RETRY);
+	return prepareAT(&call, AT_CPMS, name, name, name) && cmd(call);
 }
 ///@cond INTERNAL
+/* <stat> of +CMGL in PDU mode for each SMSRecordType */
+static const char pdu_stats[] = { '4', '0', '1', '2', '3' };
+
 String A6lib::recordTypeToString(SMSRecordType type) {
-	switch (type) {
-	default:
-	case All:
-		return Literal("ALL");
-		break;
-	case Unread:
-		return Literal("REC UNREAD");
-		break;
-	case Read:
-		return Literal("REC READ");
-		break;
+	return FPSTR(record_names[type <= Sent ? type : All]);
+}
+
+/* <stat> argument of AT+CMGL: the numeric one in PDU mode, the quoted name in text mode */
+static void listStat(char* stat, SMSRecordType record, SMSFormat format) {
+	if (record > Sent)
+		record = All;
+	if (format == Format_PDU) {
+		stat[0] = pdu_stats[record];
+		stat[1] = 0;
+	} else {
+		stat[0] = '"';
+		strcpy_P(stat + 1, record_names[record]);
+		strcat(stat, "\"");
 	}
 }
 ///@endcond
-/*!
- * Get the list of available SMS in prefered storage area.
- * \param buff input buffer to store SMS indexes.
- * \param len size of buff
- * \param record on of the ::SMSRecordType.
- * \return if fail -1, otherwise number of founded SMS.
- */
-int8_t A6lib::getSMSList(int8_t* buff, uint8_t len, SMSRecordType record) {
-	if (buff == nullptr || len < 0)
-		return -1;
+///@cond INTERNAL
+/* state of a +CMGL listing being streamed by A6lib::listSink() */
+struct A6lib::SMSList {
+	A6lib* modem;
+	sms_rx_cb_t cb;
+	SMSInfo* buff;
+	uint8_t len;
+	int16_t count; /* number of listed SMS so far */
+	bool open; /* info has a header waiting for the rest of its body */
+	bool body_next; /* the next line is a SMS body, whatever it looks like */
+	SMSInfo info;
 
-	String command(AT_PREFIX CMGL_CMD "=\"");
-	command.concat(recordTypeToString(record));
-	command.concat('"');
+	void flush() {
+		if (!open)
+			return;
+		open = false;
+		if (cb)
+			cb(info.index, info);
+		if (buff && count < len)
+			buff[count] = info;
+		count++;
+	}
+};
+
+void A6lib::listSink(void* ctx, uint8_t type, const Span& line) {
+	auto list = static_cast<SMSList*>(ctx);
+	auto& info = list->info;
+	if (type == Line_Empty)
+		list->body_next = false;
+	if (type != Line_Intermediate)
+		return;
 
-	String reply;
-	if (!cmd(command.c_str(), CMGL_CMD, RES_OK, A6_CMD_TIMEOUT * 2.5, A6_CMD_MAX_RETRY, &reply))
+	if (!list->body_next && spanStartsWith(line, CMGL_CMD ":")) {
+		list->flush();
+		info = SMSInfo();
+		list->open = true;
+		list->body_next = true;
+
+		/* text: <index>,<stat>,<oa>,[<alpha>],<scts>  PDU: <index>,<stat>,[<alpha>],<length> */
+		Span fields[5];
+		const auto n = splitFields(line, fields, countof(fields));
+		info.index = n > 0 ? spanToInt(fields[0]) : 0;
+		if (list->modem->sms_format == Format_PDU) {
+			const auto stat = n > 1 ? spanToInt(fields[1]) : 4;
+			for (uint8_t i = 0; i < countof(pdu_stats); i++) {
+				if (pdu_stats[i] - '0' == stat)
+					info.status = static_cast<SMSRecordType>(i);
+			}
+			return;
+		}
+
+		for (uint8_t i = Unread; n > 1 && i <= Sent; i++) {
+			if (fields[1].len == strlen_P(record_names[i]) && memcmp_P(fields[1].data, record_names[i], fields[1].len) == 0)
+				info.status = static_cast<SMSRecordType>(i);
+		}
+		if (n > 2) {
+			const auto number = skipPlus(fields[2]);
+			info.number.reserve(number.len);
+			for (uint16_t i = 0; i < number.len; i++)
+				info.number.concat(number.data[i]);
+		}
+		if (n > 4) {
+			char time[32];
+			if (copyField(fields[4], time, sizeof(time)))
+				info.dateTime = toTime(time, PSTR(SMS_TIME_FORMAT));
+		}
+		return;
+	}
+
+	list->body_next = false;
+	if (!list->open)
+		return;
+	if (list->modem->sms_format == Format_PDU) {
+		list->modem->decodeSMS(line, &info);
+		return;
+	}
+
+	/* text mode body, it may span more than a line */
+	if (info.message.length())
+		info.message.concat('\n');
+	info.message.reserve(info.message.length() + line.len);
+	for (uint16_t i = 0; i < line.len; i++)
+		info.message.concat(line.data[i]);
+}
+
+/* state of a +CMGL listing being streamed by indexSink() */
+struct SMSIndexList {
+	int8_t* buff;
+	uint8_t len;
+	int8_t count;
+	bool body_next; /* the next line is a SMS body, whatever it looks like */
+};
+
+static void indexSink(void* ctx, uint8_t type, const Span& line) {
+	auto list = static_cast<SMSIndexList*>(ctx);
+	if (type == Line_Empty)
+		list->body_next = false;
+	if (type != Line_Intermediate)
+		return;
+	if (list->body_next || !spanStartsWith(line, CMGL_CMD ":")) {
+		list->body_next = false;
+		return;
+	}
+	list->body_next = true;
+
+	Span field;
+	const auto indx = splitFields(line, &field, 1) ? spanToInt(field) : 0;
+	if (indx <= 0 || list->count == list->len)
+		return;
+	/* a retried listing repeats the indexes */
+	for (int8_t i = 0; i < list->count; i++) {
+		if (list->buff[i] == indx)
+			return;
+	}
+	list->buff[list->count++] = indx;
+}
+///@endcond
+
+/*!
+ * Get the list of available SMS in prefered storage area.
+ * The listing is parsed line by line as it arrives, only a line of it is kept in memory at a time.
+ * \param buff input buffer to store SMS indexes.
+ * \param len size of buff, indexes which don't fit are dropped
+ * \param record on of the ::SMSRecordType.
+ * \return if fail -1, otherwise number of founded SMS.
+ */
+int8_t A6lib::getSMSList(int8_t* buff, uint8_t len, SMSRecordType record) {
+	if (buff == nullptr)
 		return -1;
 
-	if (reply.startsWith(CR LF))
-		reply.remove(0, 2);
+	char stat[sizeof(record_names[0]) + 2];
+	listStat(stat, record, sms_format);
+	ATCall call;
+	if (!prepareAT(&call, AT_CMGL_INDEXES, stat))
+		return -1;
 
 	memset(buff, 0, len);
-	int8_t count = 0; // total number of SMSs
-	char c_str[reply.length() + 1];
-	c_str[reply.length()] = 0;
-	reply.toCharArray(c_str, reply.length());
-	reply.remove(0);
-	auto  tok = strtok(c_str, CR LF);
-	while (tok != nullptr) {
-		if (strstr(tok, CMGL_CMD)) {
-			int indx;
-			const auto ok = sscanf(tok, Literal("+CMGL: %d,%*s").c_str(), &indx);
-			if (ok > 0 && indx > 0)
-				buff[count++] = indx;
-		}
-		tok = strtok(nullptr, CR LF);
-	}
+	SMSIndexList list{ buff, len, 0, false };
+	if (!cmd(call, nullptr, indexSink, &list))
+		return -1;
 
-	return count;
+	return list.count;
+}
+
+/*!
+ * Read the SMS in prefered storage area with a single AT+CMGL, each SMS is passed to \a cb as soon as it's parsed.
+ * Only a line of the listing is kept in memory at a time. \a cb must not issue modem commands.
+ * Note: just like A6lib::readSMS(), listing unread SMS marks them as read.
+ * \param record on of the ::SMSRecordType.
+ * \param cb called with the index and information of each SMS
+ * \return if fail -1, otherwise number of founded SMS.
+ */
+int16_t A6lib::readSMSList(SMSRecordType record, sms_rx_cb_t cb) {
+	SMSList list{ this, cb, nullptr, 0, 0, false, false, SMSInfo() };
+	return readSMSList(record, &list);
 }
 
+/*!
+ * Read the SMS in prefered storage area with a single AT+CMGL into \a buff.
+ * \param record on of the ::SMSRecordType.
+ * \param buff input buffer to store SMS
+ * \param len size of buff, the SMS which don't fit are counted but not stored.
+ * \return if fail -1, otherwise number of founded SMS.
+ */
+int16_t A6lib::readSMSList(SMSRecordType record, SMSInfo* buff, uint8_t len) {
+	if (buff == nullptr)
+		return -1;
+
+	SMSList list{ this, nullptr, buff, len, 0, false, false, SMSInfo() };
+	return readSMSList(record, &list);
+}
+
+///@cond INTERNAL
+int16_t A6lib::readSMSList(SMSRecordType record, SMSList* list) {
+	char stat[sizeof(record_names[0]) + 2];
+	listStat(stat, record, sms_format);
+	ATCall call;
+	if (!prepareAT(&call, AT_CMGL_LIST, stat) || !cmd(call, nullptr, listSink, list))
+		return -1;
+
+	list->flush();
+	return list->count;
+}
+///@endcond
+
 /*!
  * Send SMS (in text mode) to specified number.
+ * If modem is working in SMSFormat::Format_PDU, the SMS is sent via A6lib::sendPDU().
  * \param number valid destination number without +
  * \param text SMS content in ascii encoding
- * \return true on success
+ * \return true once modem reported the SMS sent (+CMGS)
  */
 bool A6lib::sendSMS(const String& number, const String& text) {
+	if (sms_format == Format_PDU)
+		return sendPDU(number, text);
+
 	if (text.length() > 80 * 2) {
-		dbg(Literal("TEXT mode: max ASCII chars exceeded!").c_str());
+		dbg(PSTR("TEXT mode: max ASCII chars exceeded!"));
 		return false;
 	}
 
-	dbg(Literal("sending SMS to %s").c_str(), number.c_str());
-	String command(AT_PREFIX CMGS_CMD "=\"");
-	command.concat(number);
-	command.concat('"');
-	auto success = cmd(command.c_str(), ">", CMGS_CMD, A6_CMD_TIMEOUT, A6_CMD_MAX_RETRY);
-	delay(5);
-	if (success) {
-		stream->print(text.c_str());
-		stream->print(CTRLZ);
-	}
-
-	return success;
+	dbg(PSTR("sending SMS to %s"), number.c_str());
+	ATCall call;
+	String reply;
+	/* the text is written on the prompt, then +CMGS tells it's sent */
+	return prepareAT(&call, AT_CMGS_TEXT, number.c_str()) &&
+		sendPayload(call, reinterpret_cast<const uint8_t*>(text.c_str()), text.length(), false, &reply) && parseMessageRef(reply, nullptr);
 }
 
 /*!
- * Send an ASCII SMS in PDU mode.
+ * Send an ASCII (or Latin-1) SMS in PDU mode.
+ * It's sent in GSM 7-bit alphabet, where chars like '{' or '~' take 2 septets, unless a char isn't in GSM alphabet (e.g '`') then in UCS2.
+ * Content longer than a SMS is sent as a concatenated SMS (153 septets or 67 UCS2 chars per part), all submitted in the same PDU session.
  * \param number the detination phone number which should begin with international code
- * \param content the SMS content in ASCII and up to 160 chars
+ * \param content the SMS content in ASCII or Latin-1
  * \return true on success
  */
 bool A6lib::sendPDU(const String& number, const String& content) {
-	if (content.length() > 80 * 2) {
-		dbg(Literal("PDU mode: max ASCII chars exceeded!").c_str());
-		return false;
-	}
-
-	/* switch to PDU mode */
-	auto success = cmd(AT_PREFIX CMGF_CMD "=0", RES_OK, RES_ERR, A6_CMD_TIMEOUT, A6_CMD_MAX_RETRY);
-	if (!success)
+	String sca;
+	if (!beginPDUSession(&sca))
 		return false;
 
-	auto sca = getSMSSca();
-	if (!sca.length()) {
-		cmd(AT_PREFIX CMGF_CMD "=1", RES_OK, RES_ERR, A6_CMD_TIMEOUT, A6_CMD_MAX_RETRY * 2);
-		return false;
-	}
+	const auto success = submitSMS(sca, number, textOf(content), nullptr);
+	endPDUSession();
 
-	dbg(Literal("send PDU to %s").c_str(), number.c_str());
-	String hex_str;
-	int nbyte = 0;
-	{
-		uint8_t pdu[140 + 20];
-		nbyte = pdu_encode(sca.c_str(), number.c_str(), content.c_str(), content.length(), pdu, sizeof(pdu));
-		hex_str.reserve(nbyte * 2);
-		toHex(&hex_str, pdu, nbyte);
-	}
-	dbg(Literal("PDU mode: encode ASCII SMS to %d byte PDU").c_str(), nbyte);
-	if (nbyte > 0) {
-		{
-			String command(AT_PREFIX CMGS_CMD "=");
-			auto tpdu_len = nbyte - ceilf(sca.length() / 2.0) - 2;
-			command.concat(String((int)tpdu_len, DEC));
-			success = cmd(command.c_str(), ">", CMGS_CMD, A6_CMD_TIMEOUT, A6_CMD_MAX_RETRY);
-		}
-		delay(100);
-		if (success) {
-			stream->print(hex_str);
-			stream->print(CTRLZ);
-		}
-		wait(CMGS_CMD, PLACE_HOLDER, A6_CMD_TIMEOUT * 2, nullptr);
-		cmd(AT_PREFIX CMGF_CMD "=1", RES_OK, RES_ERR, A6_CMD_TIMEOUT * 2.5, A6_CMD_MAX_RETRY * 2);
-	}
 	return success;
 }
 
 /*!
  * Send a UCS2 SMS in PDU mode.
+ * If every char of \a content is in GSM 7-bit alphabet (default or extension table) it's sent in GSM 7-bit, which takes less SMS.
+ * Content longer than a SMS is sent as a concatenated SMS, all submitted in the same PDU session.
+ * An escaped GSM char or a surrogate pair is never split between two parts.
  * \param number the detination phone number which should begin with international code
- * \param content the SMS content coded in UCS2 format and up to 70 chars.
+ * \param content the SMS content coded in UCS2 format
  * \param len the number of UCS2 chars in \a content
  * \return true on success
  */
-bool A6lib::sendPDU(const String& number, uint16_t* content, uint8_t len) {
-	if (len > 70) {
-		dbg(Literal("PDU mode: max UCS2 chars length exceeded!").c_str());
+bool A6lib::sendPDU(const String& number, uint16_t* content, uint16_t len) {
+	String sca;
+	if (!beginPDUSession(&sca))
 		return false;
-	}
 
-	/* switch to PDU mode */
-	auto success = cmd(AT_PREFIX CMGF_CMD "=0", RES_OK, RES_ERR, A6_CMD_TIMEOUT, A6_CMD_MAX_RETRY);
-	if (!success)
-		return false;
+	const pdu_text_t text = { content, len, PDU_TEXT_UCS2 };
+	const auto success = submitSMS(sca, number, text, nullptr);
+	endPDUSession();
+
+	return success;
+}
 
-	auto sca = getSMSSca();
-	if (!sca.length()) {
-		cmd(AT_PREFIX CMGF_CMD "=1", RES_OK, RES_ERR, A6_CMD_TIMEOUT, A6_CMD_MAX_RETRY * 2);
+/*!
+ * Send a UTF-8 SMS in PDU mode, it's transcoded as it's encoded: there is no UCS2 copy of \a content.
+ * It's sent in GSM 7-bit alphabet if every char of \a content is in it, otherwise in UCS2 where a char outside BMP (e.g an emoji) takes a surrogate pair.
+ * Content longer than a SMS is sent as a concatenated SMS, all submitted in the same PDU session.
+ * \param number the detination phone number which should begin with international code
+ * \param content the SMS content in UTF-8, it's not sent if it's not valid UTF-8
+ * \param len the number of bytes in \a content
+ * \return true on success
+ */
+bool A6lib::sendPDU(const String& number, const char* content, uint16_t len) {
+	String sca;
+	if (!beginPDUSession(&sca))
 		return false;
+
+	const pdu_text_t text = { content, len, PDU_TEXT_UTF8 };
+	const auto success = submitSMS(sca, number, text, nullptr);
+	endPDUSession();
+
+	return success;
+}
+
+/*!
+ * Add an ASCII (or Latin-1) SMS to the outbound queue, it's sent on the next A6lib::flushSMSQueue() call or in the background (see A6lib::setAsyncSMSQueue()).
+ * It's coded as A6lib::sendPDU() does and content longer than a SMS is sent as a concatenated SMS.
+ * \param number the detination phone number which should begin with international code
+ * \param content the SMS content in ASCII or Latin-1
+ * \return the job id which is passed to the callback registered with A6lib::onQueuedSMSSent(), or 0 if the queue is full
+ */
+uint16_t A6lib::queueSMS(const String& number, const String& content) {
+	const auto text = textOf(content);
+	pdu_plan_t plan;
+	if (sms_queue_len == A6_SMS_QUEUE_SIZE || pdu_plan(&text, 8, &plan) != 0) {
+		dbg(PSTR("SMS queue: can't queue SMS to %s"), number.c_str());
+		return 0;
 	}
 
-	dbg(Literal("send PDU to %s").c_str(), number.c_str());
-	String hex_str;
-	int nbyte = 0;
-	{
-		uint8_t pdu[140 + 20];
-		nbyte = pdu_encodew(sca.c_str(), number.c_str(), content, len, pdu, sizeof(pdu));
-		hex_str.reserve(nbyte * 2);
-		toHex(&hex_str, pdu, nbyte);
-	}
-	dbg(Literal("PDU mode: encode UCS2 SMS to %d byte PDU").c_str(), nbyte);
-	if (nbyte > 0) {
-		{
-			String command(AT_PREFIX CMGS_CMD "=");
-			auto tpdu_len = nbyte - ceilf(sca.length() / 2.0) - 2;
-			command.concat(String((int)tpdu_len, DEC));
-			success = cmd(command.c_str(), ">", CMGS_CMD, A6_CMD_TIMEOUT, A6_CMD_MAX_RETRY);
-		}
-		delay(100);
-		if (success) {
-			stream->print(hex_str);
-			stream->print(CTRLZ);
+	auto& job = sms_queue[(sms_queue_head + sms_queue_len++) % A6_SMS_QUEUE_SIZE];
+	job.id = next_sms_job++;
+	if (next_sms_job == 0)
+		next_sms_job = 1;
+	job.number = number;
+	job.content = content;
+
+	return job.id;
+}
+
+/*!
+ * Send every queued SMS in a single PDU session: modem is switched to PDU mode and SCA is read once, then all the jobs are submitted back to back.
+ * The result of each job is reported via the callback registered with A6lib::onQueuedSMSSent().
+ * With asynchronous queue, it blocks until the background sending empties the queue.
+ * \return the number of jobs sent successfully, or -1 if the PDU session can't be started (jobs are kept in the queue)
+ */
+int16_t A6lib::flushSMSQueue() {
+	if (sms_queue_len == 0)
+		return 0;
+
+	const auto jobs_sent = sms_jobs_sent;
+#if A6_ASYNC_SMS
+	if (async_sms && sms_format == Format_PDU) {
+		while (sms_queue_len) {
+			yield();
+			if (handler_cb)
+				handler_cb();
+			handle();
 		}
-		wait(CMGS_CMD, PLACE_HOLDER, A6_CMD_TIMEOUT * 2, nullptr);
-		cmd(AT_PREFIX CMGF_CMD "=1", RES_OK, RES_ERR, A6_CMD_TIMEOUT * 2.5, A6_CMD_MAX_RETRY * 2);
+		return sms_jobs_sent - jobs_sent;
 	}
+#endif
 
-	return success;
+	String sca;
+	if (!beginPDUSession(&sca))
+		return -1;
+
+	/* the callback may queue more jobs, they're sent in this session too */
+	while (sms_queue_len) {
+		const auto& job = sms_queue[sms_queue_head];
+		uint8_t mr = 0;
+		const auto success = submitSMS(sca, job.number, textOf(job.content), &mr);
+		finishSMSJob(success, mr);
+	}
+	endPDUSession();
+
+	return sms_jobs_sent - jobs_sent;
 }
 
+/*!
+ * Get the number of SMS waiting in the outbound queue, including the one being sent.
+ */
+uint8_t A6lib::queuedSMS() const {
+	return sms_queue_len;
+}
+
+#if A6_ASYNC_SMS
+/*!
+ * Send the queued SMS in the background: each A6lib::handle() call advances the queue by a step and never blocks on modem,
+ * so several modems can send at the same time from a single loop. Modem must be working in SMSFormat::Format_PDU,
+ * the jobs just wait in the queue otherwise. The result of each job is reported via the callback registered with A6lib::onQueuedSMSSent().
+ * \param enable true to send in the background, false to send only on A6lib::flushSMSQueue()
+ */
+void A6lib::setAsyncSMSQueue(bool enable) {
+	async_sms = enable;
+}
+#endif
+
 /*!
  * Read a SMS in modem prefered storage area
  * \param index sms index in storage area
+ * In SMSFormat::Format_PDU the SMS-DELIVER pdu is decoded by A6lib and UCS2 content is returned as UTF-8.
  * \return a SMSInfo object contain SMS information(number+date+timestamp) on success, and if fail an empty SMSInfo object.
  */
 SMSInfo A6lib::readSMS(uint8_t index) {
 	String reply;
-	String command(AT_PREFIX CMGR_CMD "=");
-	command.concat(String(index, DEC));
-
+	ATCall call;
 	SMSInfo info;
-	if (cmd(command.c_str(), CMGR_CMD, RES_OK, A6_CMD_TIMEOUT, A6_CMD_MAX_RETRY, &reply)) {
+	if (prepareAT(&call, AT_CMGR, index) && cmd(call, &reply)) {
+		if (sms_format == Format_PDU) {
+			/* the pdu is on the line after +CMGR */
+			auto begin = reply.indexOf(CMGR_CMD ":");
+			if (begin != -1)
+				begin = reply.indexOf('\n', begin);
+			if (begin != -1) {
+				auto end = reply.indexOf('\r', ++begin);
+				if (end == -1)
+					end = reply.length();
+				decodeSMS(Span{ reply.c_str() + begin, static_cast<uint16_t>(end - begin) }, &info);
+			}
+			return info;
+		}
+
+		/* "stat","number","alpha","time" then the text up to the final OK, alpha is left empty by A6 */
+		Span rest = toSpan(reply), line, fields[4];
+		bool found = false;
+		while (!found && takeLine(&rest, &line))
+			found = spanStartsWith(line, CMGR_CMD ":");
 		char phone[16];
 		char time[32];
-		char content[160];
-#ifdef A6_T
-		const auto ok = sscanf(reply.c_str(), Literal("%*[^+]+CMGR: \"%*[^\"]\",\"+%[^\"]\",,\"%[^\"]\"\r\n%[^OK]").c_str(), phone, time, content);
-#else
-		bool ok = false, has_contact_part = reply.indexOf(",\"\",") == -1;
-		if (has_contact_part)
-			ok = sscanf(reply.c_str(), Literal("%*[^+]+CMGR: \"%*[^\"]\",\"+%[^\"]\",\"%*[^\"]\",\"%[^\"]\"\r\n%[^OK]").c_str(), phone, time, content);
-		else
-			ok = sscanf(reply.c_str(), Literal("%*[^+]+CMGR: \"%*[^\"]\",\"+%[^\"]\",\"\",\"%[^\"]\"\r\n%[^OK]").c_str(), phone, time, content);
-#endif
-		if (ok > 0) {
+		if (found && splitFields(line, fields, 4) == 4 && copyField(skipPlus(fields[1]), phone, sizeof(phone)) && copyField(fields[3], time, sizeof(time))) {
+			const auto begin = rest.data;
+			auto end = begin;
+			while (takeLine(&rest, &line) && !(line.len == 2 && memcmp(line.data, "OK", 2) == 0)) {
+				if (line.len)
+					end = line.data + line.len;
+			}
 			info.number = String(phone);
-			info.dateTime = toTime(time, Literal("%Y/%m/%d,%H:%M:%S"));
-			info.message = String(content);
-			if (info.message.endsWith(CR LF))
-				info.message.remove(info.message.length() - 2, 2);
+			info.dateTime = toTime(time, PSTR(SMS_TIME_FORMAT));
+			info.message.reserve(end - begin);
+			for (auto p = begin; p < end; p++)
+				info.message.concat(*p);
 			return info;
 		}
 	}
@@ -973,13 +1982,10 @@ SMSInfo A6lib::readSMS(uint8_t index) {
  * \return true on success
  */
 bool A6lib::deleteSMS(uint8_t index, bool del_all) {
-	String command(AT_PREFIX CMGD_CMD "=");
-	if (del_all)
-		command.concat(Literal("1,4"));
-	else
-		command.concat(String(index, DEC));
+	ATCall call;
+	const auto ok = del_all ? prepareAT(&call, AT_CMGD_ALL) : prepareAT(&call, AT_CMGD, index);
 
-	return cmd(command.c_str(), RES_OK, RES_ERR, A6_CMD_TIMEOUT, A6_CMD_MAX_RETRY);
+	return ok && cmd(call);
 }
 
 /*!
@@ -989,28 +1995,30 @@ bool A6lib::deleteSMS(uint8_t index, bool del_all) {
  * \return true on success.
  */
 bool A6lib::setCharSet(CharSet set) {
-	String command(AT_PREFIX CSCS_CMD "=");
-	command.concat("\"" + charsetToString(set) + "\"");
+	char name[sizeof(charset_names[0])];
+	strcpy_P(name, charset_names[set <= Pccp936 ? set : Gsm]);
+	ATCall call;
 
-	return cmd(command.c_str(), RES_OK, RES_ERR, A6_CMD_TIMEOUT, A6_CMD_MAX_RETRY);
+	return prepareAT(&call, AT_CSCS, name) && cmd(call);
+}
+
+/*!
+ * Set the SMS message format of modem.
+ * It's SMSFormat::Format_Text by default and is applied again by A6lib::start().
+ * \param format could be on of the ::SMSFormat value
+ * \return true on success
+ */
+bool A6lib::setSMSFormat(SMSFormat format) {
+	ATCall call;
+	const auto success = prepareAT(&call, AT_CMGF, format == Format_PDU ? 0 : 1) && cmd(call);
+	if (success)
+		sms_format = format;
+
+	return success;
 }
 ///@cond INTERNAL
 String A6lib::charsetToString(CharSet set) {
-	switch (set) {
-	default:
-	case Gsm:
-		return Literal("GSM");
-		break;
-	case Ucs2:
-		return Literal("UCS2");
-		break;
-	case Hex:
-		return Literal("HEX");
-		break;
-	case Pccp936:
-		return Literal("PCCP936");
-		break;
-	}
+	return FPSTR(charset_names[set <= Pccp936 ? set : Gsm]);
 }
 ///@endcond
 /*!
@@ -1036,6 +2044,17 @@ void A6lib::onSMSSent(sms_tx_cb_t cb) {
 		sms_tx_cb = nullptr;
 }
 
+/*!
+ * This function will register your callback and will call it for each job of the outbound queue once it's finished.
+ * The callback gets the job id, whether it was sent, the message reference of its (last) part from +CMGS and \a ctx.
+ * \param cb pointer to callback function
+ * \param ctx passed to the callback as is
+ */
+void A6lib::onQueuedSMSSent(sms_job_cb_t cb, void* ctx) {
+	sms_job_cb = cb;
+	sms_job_ctx = ctx;
+}
+
 /*!
  * This function will register your callback and will call it when new SMS arrives.
  * \param cb pointer to callback function
@@ -1058,60 +2077,452 @@ void A6lib::onSMSStorageFull(sms_full_cb_t cb) {
 		sms_full_cb = nullptr;
 }
 
+/*!
+ * This function will register your callback and will call it with ctx once SMS sent successfully.
+ * \param cb pointer to callback function, nullptr removes it
+ * \param ctx passed back to the callback as is
+ */
+void A6lib::onSMSSent(ctx_cb_t cb, void* ctx) {
+	setURCHandler(URC_CMGS, reinterpret_cast<void(*)()>(cb), ctx);
+}
+
+/*!
+ * This function will register your callback and will call it with ctx, the storage index and the content of each received SMS.
+ * \param cb pointer to callback function, nullptr removes it
+ * \param ctx passed back to the callback as is
+ */
+void A6lib::onSMSReceived(sms_index_cb_t cb, void* ctx) {
+	setURCHandler(URC_CMTI, reinterpret_cast<void(*)()>(cb), ctx);
+}
+
+/*!
+ * This function will register your callback and will call it with ctx once modem prefered storage is full.
+ * \param cb pointer to callback function, nullptr removes it
+ * \param ctx passed back to the callback as is
+ */
+void A6lib::onSMSStorageFull(ctx_cb_t cb, void* ctx) {
+	setURCHandler(URC_CIEV, reinterpret_cast<void(*)()>(cb), ctx);
+}
+
+/*!
+ * This function will register your callback and will call it for each SMS which modem routes directly to A6lib
+ * instead of storing it (+CMT, e.g AT+CNMI=2,2). It's parsed according to the current SMSFormat.
+ * \param cb pointer to callback function, nullptr removes it
+ * \param ctx passed back to the callback as is
+ */
+void A6lib::onDirectSMS(sms_cb_t cb, void* ctx) {
+	setURCHandler(URC_CMT, reinterpret_cast<void(*)()>(cb), ctx);
+}
+
+/*!
+ * This function will register your callback and will call it on each RING of an incoming call.
+ * \param cb pointer to callback function, nullptr removes it
+ * \param ctx passed back to the callback as is
+ */
+void A6lib::onRing(ctx_cb_t cb, void* ctx) {
+	setURCHandler(URC_RING, reinterpret_cast<void(*)()>(cb), ctx);
+}
+
+/*!
+ * This function will register your callback and will call it with the number and its type (129, 145,...) of an incoming call.
+ * Caller id must be enabled first (AT+CLIP=1).
+ * \param cb pointer to callback function, nullptr removes it
+ * \param ctx passed back to the callback as is
+ */
+void A6lib::onCallerId(clip_cb_t cb, void* ctx) {
+	setURCHandler(URC_CLIP, reinterpret_cast<void(*)()>(cb), ctx);
+}
+
+/*!
+ * This function will register your callback and will call it each time network registration of modem changes.
+ * Registration notifications must be enabled first (AT+CREG=1 or AT+CREG=2).
+ * \param cb pointer to callback function, nullptr removes it
+ * \param ctx passed back to the callback as is
+ */
+void A6lib::onRegistration(creg_cb_t cb, void* ctx) {
+	setURCHandler(URC_CREG, reinterpret_cast<void(*)()>(cb), ctx);
+}
+
+/*!
+ * This function will register your callback and will call it with the status and text of each network initiated USSD message.
+ * \param cb pointer to callback function, nullptr removes it
+ * \param ctx passed back to the callback as is
+ */
+void A6lib::onUSSD(ussd_cb_t cb, void* ctx) {
+	setURCHandler(URC_CUSD, reinterpret_cast<void(*)()>(cb), ctx);
+}
+
+/*!
+ * This function will register your callback and will call it with the message reference, the status (TP-ST, 0 -> delivered)
+ * and the recipient of each SMS status report (+CDS). Status reports must be enabled first (AT+CNMI=...,1 and TP-SRR of the SMS).
+ * \param cb pointer to callback function, nullptr removes it
+ * \param ctx passed back to the callback as is
+ */
+void A6lib::onStatusReport(status_report_cb_t cb, void* ctx) {
+	setURCHandler(URC_CDS, reinterpret_cast<void(*)()>(cb), ctx);
+}
+
+/*!
+ * Register a callback for a notification (unsolicited result code) which has no built-in parser, e.g "+CRING" or "+CPIN".
+ * The callback gets ctx, the notification line and its body line if has_body is true (an empty span otherwise).
+ * A built-in notification could be taken over this way too, its registered handler won't be called any more.
+ * \param prefix the notification prefix, everything before ':' or the whole line if it has no ':'
+ * \param cb pointer to callback function, nullptr removes an existing one
+ * \param ctx passed back to the callback as is
+ * \param has_body the line following the notification belongs to it
+ * \return false if the prefix is a command reply or result code, or there's no room for another one (see A6_URC_HOOKS)
+ */
+bool A6lib::onURC(const char* prefix, urc_cb_t cb, void* ctx, bool has_body) {
+	const auto len = prefix ? strlen(prefix) : 0;
+	if (len == 0 || len > A6_URC_PREFIX_LEN)
+		return false;
+
+	for (uint8_t i = 0; i < urc_hooks_len; i++) {
+		auto& hook = urc_hooks[i];
+		if (strcmp(hook.prefix, prefix) == 0) {
+			hook.cb = cb;
+			hook.ctx = ctx;
+			hook.has_body = has_body;
+			return true;
+		}
+	}
+
+	for (const auto& p : line_prefixes) {
+		if (p.type != Line_Notification && p.len == len && memcmp(p.prefix, prefix, len) == 0)
+			return false;
+	}
+	if (!cb || urc_hooks_len == A6_URC_HOOKS)
+		return !cb;
+
+	auto& hook = urc_hooks[urc_hooks_len];
+	memcpy(hook.prefix, prefix, len + 1);
+	hook.cb = cb;
+	hook.ctx = ctx;
+	hook.has_body = has_body;
+
+	return indexLinePrefix(hook.prefix, len, 0x80 | urc_hooks_len++);
+}
+
 
 ///@cond INTERNAL
-String A6lib::toTime(const char* cclk_str, const String& format) {
+String A6lib::toTime(const char* cclk_str, PGM_P format) {
 	/* cclk_str should be in this format: yy/MM/dd,hh:mm:ss+tz */
 	struct tm time_stamp;
-	time_stamp.tm_isdst = -1;
 	int tz = 0;
-	const auto ok = sscanf(cclk_str, Literal("%d/%d/%d,%d:%d:%d+%d").c_str(), &time_stamp.tm_year, &time_stamp.tm_mon, &time_stamp.tm_mday, &time_stamp.tm_hour, &time_stamp.tm_min, &time_stamp.tm_sec, &tz);
-	if (ok) {
-		/* sim800 return time's year as 2-digit but A6 as 4-digit */
-		auto y = time_stamp.tm_year;
-		if (y > 999)
-			time_stamp.tm_year += -1900;
-		else
-			time_stamp.tm_year += 2000 - 1900;
-		time_stamp.tm_mon -= 1;
+	if (parseTime(Span{ cclk_str, static_cast<uint16_t>(strlen(cclk_str)) }, &time_stamp, &tz)) {
 		auto epoch = mktime(&time_stamp) + (tz * 15 * 60);
 
+		char fmt[24];
+		strncpy_P(fmt, format, sizeof(fmt) - 1);
+		fmt[sizeof(fmt) - 1] = 0;
 		char buff[32];
-		strftime(buff, sizeof(buff), format.c_str(), localtime(&epoch));
+		strftime(buff, sizeof(buff), fmt, localtime(&epoch));
 		return String(buff);
 	}
 
 	return String();
 }
 
+static const char hex_digits[] = "0123456789ABCDEF";
+
 void A6lib::toHex(String* in, uint8_t* pdu, uint8_t len) {
 	if (!in || !pdu || len == 0)
 		return;
 
-	auto hex = [](uint8_t h) {
-		char tmp[3];
-		sprintf(tmp, "%02x", h);
-		String str(tmp);
-		str.toUpperCase();
+	in->reserve(in->length() + len * 2);
+	for (size_t i = 0; i < len; i++) {
+		in->concat(hex_digits[pdu[i] >> 4]);
+		in->concat(hex_digits[pdu[i] & 0x0F]);
+	}
+}
+
+/* write uppercase hex of pdu to out, a chunk at a time */
+void A6lib::toHex(Print* out, const uint8_t* pdu, uint8_t len) {
+	if (!out || !pdu)
+		return;
+
+	char chunk[32];
+	uint8_t n = 0;
+	for (size_t i = 0; i < len; i++) {
+		chunk[n++] = hex_digits[pdu[i] >> 4];
+		chunk[n++] = hex_digits[pdu[i] & 0x0F];
+		if (n == sizeof(chunk)) {
+			out->write(chunk, n);
+			n = 0;
+		}
+	}
+	if (n)
+		out->write(chunk, n);
+}
+
+/* parse hex into pdu, return the number of octets or -1 on a bad digit or small pdu */
+int A6lib::fromHex(const char* hex, uint16_t hex_len, uint8_t* pdu, uint8_t pdu_size) {
+	if (!hex || !pdu || hex_len % 2 || hex_len / 2 > pdu_size)
+		return -1;
+
+	for (uint16_t i = 0; i < hex_len; i += 2) {
+		uint8_t octet = 0;
+		for (uint8_t j = 0; j < 2; j++) {
+			const char c = hex[i + j];
+			octet <<= 4;
+			if (c >= '0' && c <= '9')
+				octet |= c - '0';
+			else if (c >= 'A' && c <= 'F')
+				octet |= c - 'A' + 10;
+			else if (c >= 'a' && c <= 'f')
+				octet |= c - 'a' + 10;
+			else
+				return -1;
+		}
+		pdu[i / 2] = octet;
+	}
+
+	return hex_len / 2;
+}
+
+/* switch modem to PDU mode if needed and get the SCA for pdu_encode() */
+bool A6lib::beginPDUSession(String* sca) {
+	ATCall call;
+	if (sms_format == Format_Text && !(prepareAT(&call, AT_CMGF, 0) && cmd(call)))
+		return false;
+
+	*sca = getSMSSca();
+	if (!sca->length()) {
+		endPDUSession();
+		return false;
+	}
+
+	return true;
+}
+
+/* pick the coding of text and its concatenation info, before its first part */
+bool A6lib::beginConcat(const pdu_text_t& text, pdu_concat_t* concat, uint8_t* coding) {
+	pdu_plan_t plan;
+	const int err = pdu_plan(&text, 8, &plan);
+	if (err != 0) {
+		dbg(err == PDU_MALFORMED_ERR ? PSTR("PDU mode: invalid UTF-8 content!") : PSTR("PDU mode: max SMS parts exceeded!"));
+		return false;
+	}
+
+	*concat = { plan.parts > 1 ? ++concat_ref : concat_ref, static_cast<uint8_t>(plan.parts > 1 ? plan.parts : 0), 0, 8 };
+	*coding = plan.coding;
+
+	return true;
+}
+
+/* encode the part of text which begins at from, from and concat are moved to the next part */
+int A6lib::encodeSMSPart(const String& sca, const String& number, const pdu_text_t& text, uint8_t coding, uint16_t* from, pdu_concat_t* concat, uint8_t* pdu) {
+	concat->seq++;
+	const int nbyte = pdu_encode_text_part(sca.c_str(), number.c_str(), &text, from, coding, concat, pdu, PDU_MAX_LEN);
+	dbg(PSTR("PDU mode: encode %s SMS to %d byte PDU"), coding == PDU_CODING_GSM7 ? "GSM" : "UCS2", nbyte);
+
+	return nbyte;
+}
+
+/* encode text (in as many parts as needed) and submit it, mr gets the message reference of the last part */
+bool A6lib::submitSMS(const String& sca, const String& number, const pdu_text_t& text, uint8_t* mr) {
+	pdu_concat_t concat;
+	uint8_t coding;
+	if (!beginConcat(text, &concat, &coding))
+		return false;
+
+	dbg(PSTR("send PDU to %s in %d part(s)"), number.c_str(), concat.total ? concat.total : 1);
+	bool success = true;
+	uint16_t from = 0;
+	do {
+		uint8_t pdu[PDU_MAX_LEN];
+		const int nbyte = encodeSMSPart(sca, number, text, coding, &from, &concat, pdu);
+		success = nbyte > 0 && submitPDU(pdu, nbyte, mr);
+	} while (success && from < text.len);
+
+	return success;
+}
+
+/* send a pdu made by pdu_encode() and wait for its +CMGS, mr gets the message reference */
+bool A6lib::submitPDU(const uint8_t* pdu, uint8_t pdu_len, uint8_t* mr) {
+	/* length of TPDU, excluding SCA */
+	const uint8_t tpdu_len = pdu_len - pdu[0] - 1;
+	ATCall call;
+	String reply;
+
+	return prepareAT(&call, AT_CMGS_PDU, tpdu_len) && sendPayload(call, pdu, pdu_len, true, &reply) && parseMessageRef(reply, mr);
+}
+
+/* submit AT+CMGS of a pdu, the engine writes the pdu on the prompt so it must stay valid until the command is finished */
+cmd_handle_t A6lib::queuePDU(const uint8_t* pdu, uint8_t pdu_len, String* response) {
+	const uint8_t tpdu_len = pdu_len - pdu[0] - 1;
+	ATCall call;
+	if (!prepareAT(&call, AT_CMGS_PDU, tpdu_len))
+		return INVALID_CMD_HANDLE;
+
+	return queuePayload(call, pdu, pdu_len, true, response);
+}
+
+/* submit a command whose payload is written on the SMS prompt (in hex if asked), payload must stay valid until the command is finished */
+cmd_handle_t A6lib::queuePayload(const ATCall& call, const uint8_t* payload, uint16_t len, bool hex, String* response) {
+	const auto handle = submitCommand(call.command, call.resp1, call.resp2, call.timeout, call.max_retry, response);
+	if (handle != INVALID_CMD_HANDLE) {
+		auto c = findCommand(handle);
+		c->payload = payload;
+		c->payload_len = len;
+		c->payload_hex = hex;
+	}
+
+	return handle;
+}
+
+/* the same as queuePayload(), but blocks until the command is finished */
+bool A6lib::sendPayload(const ATCall& call, const uint8_t* payload, uint16_t len, bool hex, String* response) {
+	auto handle = queuePayload(call, payload, len, hex, response);
+	/* engine is full of submitted commands, let them go first */
+	while (handle == INVALID_CMD_HANDLE && activeCommand()) {
+		yield();
+		runEngine();
+		handle = queuePayload(call, payload, len, hex, response);
+	}
+
+	return handle != INVALID_CMD_HANDLE && waitForCommand(handle);
+}
+
+#if A6_ASYNC_SMS
+/*
+	advance the outbound queue without blocking: submit AT+CMGS of the next part,
+	and once it's finished move to the next part or report the job.
+*/
+void A6lib::pumpSMSQueue() {
+	if (sms_pump.handle != INVALID_CMD_HANDLE) {
+		const auto state = commandState(sms_pump.handle);
+		if (state == Cmd_Queued || state == Cmd_Waiting)
+			return;
+
+		sms_pump.handle = INVALID_CMD_HANDLE;
+		/* no SCA yet, so it was AT+CSCA? */
+		if (!sms_pump.sca.length()) {
+			char buff[32];
+			Span field;
+			if (state == Cmd_Success && replyFields(sms_pump.reply, CSCA_CMD ":", &field, 1) && copyField(skipPlus(field), buff, sizeof(buff)) && buff[0])
+				sms_pump.sca = storeFact(Fact_SCA, buff);
+			else if (sms_queue_len)
+				finishSMSJob(false, 0);
+			return;
+		}
+		sms_pump.pdu_len = 0;
+		uint8_t mr = 0;
+		const auto success = state == Cmd_Success && parseMessageRef(sms_pump.reply, &mr);
+		if (!success || sms_pump.from >= sms_queue[sms_queue_head].content.length()) {
+			sms_pump.from = 0;
+			finishSMSJob(success, mr);
+		}
+	}
+
+	if (!async_sms || sms_format != Format_PDU || sms_queue_len == 0)
+		return;
+
+	/* SCA is looked up for each job (facts may be invalidated meanwhile), without blocking like getSMSSca() would */
+	if (!sms_pump.sca.length() && !lookupFact(Fact_SCA, &sms_pump.sca)) {
+		ATCall call;
+		if (prepareAT(&call, AT_CSCA))
+			sms_pump.handle = submitCommand(call.command, call.resp1, call.resp2, call.timeout, call.max_retry, &sms_pump.reply);
+		return;
+	}
 
-		return str;
-	};
+	auto& job = sms_queue[sms_queue_head];
+	if (!sms_pump.pdu_len) {
+		const auto& sca = sms_pump.sca;
+		const auto text = textOf(job.content);
+		const bool began = sms_pump.from > 0 || beginConcat(text, &sms_pump.concat, &sms_pump.coding);
+		const int nbyte = began ? encodeSMSPart(sca, job.number, text, sms_pump.coding, &sms_pump.from, &sms_pump.concat, sms_pump.pdu) : -1;
+		if (nbyte <= 0) {
+			sms_pump.from = 0;
+			finishSMSJob(false, 0);
+			return;
+		}
+		sms_pump.pdu_len = nbyte;
+	}
 
-	for (size_t i = 0; i < len; i++)
-		in->concat(hex(pdu[i]));
+	/* the engine may be full, it's tried again on the next call */
+	sms_pump.handle = queuePDU(sms_pump.pdu, sms_pump.pdu_len, &sms_pump.reply);
+}
+#endif
+
+/* remove the job at the head of queue and report it */
+void A6lib::finishSMSJob(bool sent, uint8_t mr) {
+	auto& job = sms_queue[sms_queue_head];
+	const auto id = job.id;
+	job.number = String();
+	job.content = String();
+	sms_queue_head = (sms_queue_head + 1) % A6_SMS_QUEUE_SIZE;
+	sms_queue_len--;
+	if (sent)
+		sms_jobs_sent++;
+#if A6_ASYNC_SMS
+	/* the parts of a job share a SCA, the next job looks it up again */
+	sms_pump.sca.remove(0);
+#endif
+	if (sms_job_cb)
+		sms_job_cb(id, sent, mr, sms_job_ctx);
+}
+
+/* switch modem back to text mode if that's the format it's working in */
+void A6lib::endPDUSession() {
+	if (sms_format == Format_Text)
+		at(AT_CMGF_RESTORE);
+}
+
+/* decode the hex of a SMS-DELIVER pdu into info */
+bool A6lib::decodeSMS(const Span& hex, SMSInfo* info) {
+	uint8_t pdu[PDU_MAX_LEN];
+	const int pdu_len = fromHex(hex.data, hex.len, pdu, sizeof(pdu));
+	pdu_sms_t sms;
+	if (pdu_len <= 0 || pdu_decode(pdu, pdu_len, &sms) != 0) {
+		dbg(PSTR("PDU mode: can't decode SMS"));
+		return false;
+	}
+
+	/* pdu isn't needed anymore, the time and then the text are converted in it */
+	char* out = reinterpret_cast<char*>(pdu);
+	snprintf(out, sizeof(pdu), "%02u/%02u/%02u,%02u:%02u:%02u%+d", sms.scts.year, sms.scts.month, sms.scts.day,
+		sms.scts.hour, sms.scts.minute, sms.scts.second, sms.scts.tz);
+	info->number = String(sms.oa);
+	info->dateTime = toTime(out, PSTR(SMS_TIME_FORMAT));
+	info->message.remove(0);
+	info->message.reserve(sms.text_len);
+	if (sms.coding == PDU_CODING_GSM7 || sms.coding == PDU_CODING_UCS2) {
+		const bool gsm = sms.coding == PDU_CODING_GSM7;
+		/* a septet takes up to 2 bytes in UTF-8 and a UCS2 char up to 3, so a piece of text at a time fits in pdu.
+		 * a piece never ends between an escape and its code or inside a surrogate pair */
+		const uint8_t piece = (sizeof(pdu) - 1) / (gsm ? 2 : 3);
+		for (uint8_t i = 0; i < sms.text_len;) {
+			uint8_t end = i;
+			while (end < sms.text_len) {
+				const uint8_t w = (gsm ? sms.ud.text[end] == 0x1B : (sms.ud.wtext[end] & 0xFC00) == 0xD800) ? 2 : 1;
+				if (end + w - i > piece)
+					break;
+				end += w;
+			}
+			end = minimum(end, sms.text_len);
+			const int n = gsm ? pdu_gsm7_to_utf8(sms.ud.text + i, end - i, out, sizeof(pdu)) :
+				pdu_ucs2_to_utf8(sms.ud.wtext + i, end - i, out, sizeof(pdu));
+			if (n < 0)
+				break;
+			info->message.concat(out);
+			i = end;
+		}
+	} else {
+		for (uint8_t i = 0; i < sms.text_len; i++)
+			info->message.concat(static_cast<char>(sms.ud.data[i]));
+	}
+
+	return true;
 }
 
 bool A6lib::begin() {
 	bool success = true;
 
-	/* SMS format -> text mode */
-	success = success && cmd(AT_PREFIX CMGF_CMD "=1", RES_OK, RES_ERR, A6_CMD_TIMEOUT, A6_CMD_MAX_RETRY);
+	/* SMS format -> text mode unless PDU mode is asked */
+	success = success && setSMSFormat(sms_format);
 	/* SMS indications -> On */
-#ifdef A6_T
-	success = success && cmd(AT_PREFIX CNMI_CMD "=0,1,0,0,0", RES_OK, PLACE_HOLDER, A6_CMD_TIMEOUT, A6_CMD_MAX_RETRY);
-#elif defined(SIM800_T)
-	success = success && cmd(AT_PREFIX CNMI_CMD "=1,1,0,0,0", RES_OK, RES_ERR, A6_CMD_TIMEOUT, A6_CMD_MAX_RETRY);
-#endif
+	success = success && at(AT_CNMI);
 	/* SMS storage area -> SIM */
 	success = success && setSMSStorageArea(SMSStorageArea::SM);
 	/* char set -> UCS2 */
@@ -1132,87 +2543,528 @@ void A6lib::powerOn(uint8_t pin) const {
 
 bool A6lib::setBaudRate(unsigned long baud) {
 	if (ports.testState(PortState::Using_SoftWareSerial))
-		dbg(Literal("starting with SoftwareSerial object").c_str());
+		dbg(PSTR("starting with SoftwareSerial object"));
 	else if (ports.testState(PortState::Using_HardWareSerial))
-		dbg(Literal("starting with HardwareSerial object").c_str());
+		dbg(PSTR("starting with HardwareSerial object"));
 	else
-		dbg(Literal("starting with new SoftwareSerial object").c_str());
+		dbg(PSTR("starting with new SoftwareSerial object"));
 
+	openPort(baud);
+
+	dbg(PSTR("setting baud rate(%lu) on the module..."), baud);
+	ATCall call;
+	if (!prepareAT(&call, AT_IPR, baud))
+		return false;
+	/* there's no point in waiting for a modem talking at another rate, move it from where it is */
+	if (!probeModem()) {
+		if (!detectBaudRate() || !cmd(call))
+			return false;
+		openPort(baud);
+		probeModem();
+	}
+	if (!cmd(call))
+		return false;
+
+	baud_rate = baud;
+	return true;
+}
+
+void A6lib::openPort(unsigned long baud) {
 	if (ports.isSoftwareSerial())
 		ports.sport->begin(baud);
 	else
 		ports.hport->begin(baud);
 	delay(50);
+	/* whatever came in at the old rate is noise now */
+	clearRx();
+}
 
-	dbg(Literal("setting baud rate(%lu) on the module...").c_str(), baud);
-	String command(AT_PREFIX IPR_CMD "=");
-	command.concat(baud);
+bool A6lib::probeModem() {
+	ATCall call;
 
-	return cmd(command.c_str(), RES_OK, IPR_CMD, A6_CMD_TIMEOUT, A6_CMD_MAX_RETRY * 4);
+	return prepareAT(&call, AT_PROBE) && cmd(call);
 }
 
-String A6lib::streamData() const {
+/* probe the standard rates until modem answers, the port is left at the rate found */
+unsigned long A6lib::detectBaudRate() {
+	for (uint8_t i = 0; i < countof(baud_rates); i++) {
+		const unsigned long baud = pgm_read_dword(&baud_rates[i]);
+		openPort(baud);
+		if (probeModem()) {
+			dbg(PSTR("modem answered at %lu"), baud);
+			return baud_rate = baud;
+		}
+	}
+
+	dbg(PSTR("modem doesn't answer at any rate"));
+	return baud_rate = 0;
+}
+
+bool A6lib::linkReference(String* reference) {
+	reference->remove(0);
+	for (uint8_t i = 0; i < countof(link_commands); i++) {
+		ATCall call;
+		String reply;
+		if (!prepareAT(&call, link_commands[i]))
+			return false;
+		call.timeout = A6_BAUD_PROBE_TIMEOUT;
+		call.max_retry = 1;
+		if (!cmd(call, &reply))
+			return false;
+		reference->concat(reply);
+	}
+
+	return true;
+}
+
+/* the replies of link_commands must come back A6_BAUD_CHECKS times as they did at a known good rate */
+bool A6lib::checkLink(const String& reference) {
 	String reply;
-	if (stream->available())
-		reply = stream->readString();
+	for (uint8_t i = 0; i < A6_BAUD_CHECKS; i++) {
+		if (!linkReference(&reply) || reply != reference)
+			return false;
+	}
+
+	return true;
+}
 
-	/* replace NULLs with 0xFF so we can match on them. */
-	for (size_t x = 0; x < reply.length(); x++) {
-		if (reply.charAt(x) == 0)
-			reply.setCharAt(x, 0xFF);
+uint16_t A6lib::fillRx() {
+	uint16_t n = 0;
+	while (!rx.isFull() && stream->available()) {
+		char c = stream->read();
+		/* replace NULLs with 0xFF so we can match on them. */
+		rx.push(c == 0 ? char(0xFF) : c);
+		n++;
 	}
+	if (n)
+		last_rx = millis();
+	/* ask modem to hold on while there's little room left */
+	if (rts_pin >= 0)
+		digitalWrite(rts_pin, rx.length() + A6_RX_BUFFER_SIZE / 4 >= A6_RX_BUFFER_SIZE ? HIGH : LOW);
 
-	return reply;
+	return n;
 }
 
-bool A6lib::cmd(const char *command, const char *resp1, const char *resp2, uint16_t timeout, uint8_t max_retry, String *response) {
-	bool success = false;
-	while (max_retry-- && !success) {
-		dbg(Literal("issuing command: %s").c_str(), command);
-		stream->println(command);
-		stream->flush();
-		yield();
-		success = wait(resp1, resp2, timeout, response);
+void A6lib::clearRx() {
+	rx.clear();
+	line_start = 0;
+	line_scan = 0;
+	body_next = false;
+	urc_body = false;
+	line_cut = false;
+}
+
+/* drop the lines nextLine() went through, the partial one after them stays */
+void A6lib::consumeLines() {
+	rx.consume(line_start);
+	line_scan -= line_start;
+	line_start = 0;
+}
+
+/*
+	tokenize next complete line received after line_start, notifications are queued as soon as they're seen.
+	lines stay in rx buffer, it's up to caller to consume them.
+*/
+uint8_t A6lib::nextLine(Span* line) {
+	auto eol = rx.indexOf('\n', line_scan);
+	if (eol == -1) {
+		line_scan = rx.length();
+		return Line_None;
 	}
 
-	return success;
+	auto data = rx.linearize();
+	uint16_t len = eol - line_start;
+	if (len && data.data[line_start + len - 1] == '\r')
+		len--;
+	*line = Span{ data.data + line_start, len };
+	line_start = line_scan = eol + 1;
+
+	if (line_cut) {
+		/* the rest of a line spillRx() moved out, it's not a line of its own whatever it looks like */
+		line_cut = false;
+		body_next = false;
+		if (urc_body) {
+			/* the notification is dropped, its body is lost */
+			urc_body = false;
+			urc_len = urc_last;
+		}
+		return nextLine(line);
+	}
+
+	if (len == 0) {
+		body_next = false; // an empty SMS body
+		urc_body = false;
+		return Line_Empty;
+	}
+
+	if (body_next) {
+		body_next = false;
+		if (urc_body) {
+			urc_body = false;
+			queueNotificationBody(*line);
+			return Line_Notification;
+		}
+		return Line_Intermediate;
+	}
+
+	const auto cls = classifyLine(*line);
+	body_next = cls.body == Body_Always || (cls.body == Body_PDU && sms_format == Format_PDU);
+	if (cls.type == Line_Notification)
+		urc_body = queueNotification(*line) && body_next;
+
+	return cls.type;
 }
 
-bool A6lib::wait(const char *response1, const char *response2, uint16_t timeout, String *response) {
-	dbg(Literal("waiting for reply...").c_str());
-	auto start = millis();
-	isWaiting = true;
-	bool success = false;
-	String reply;
-	reply.reserve(64);
+/* make room in a full rx buffer by moving its complete lines out */
+void A6lib::spillRx(String* response) {
+	auto data = rx.linearize();
+	uint16_t end = line_start;
+	if (end == 0) { // a single huge line, it's moved out as it is and nextLine() drops the rest of it
+		end = data.len;
+		line_cut = true;
+	}
 
-	do {
-		yield();
-		if (handler_cb)
-			handler_cb();
-		reply.concat(streamData());
-		if (reply.length() && (reply.indexOf(response1) != -1 || reply.indexOf(response2) != -1)) {
-			success = true;
-			dbg("reply in %lu ms:\n", millis() - start);
-#ifdef DEBUG
-			if (dbg_stream)
-				dbg_stream->print(reply);
+	if (response) {
+		response->reserve(response->length() + end);
+		for (uint16_t i = 0; i < end; i++)
+			response->concat(data.data[i]);
+	}
+	rx.consume(end);
+	line_start -= minimum(end, line_start);
+	line_scan -= minimum(end, line_scan);
+}
+
+/*
+	find or make the class of command by its prefix: the command without "AT" up to '=' or '?',
+	waiting without a command is classed by the expected reply after '~' e.g "~+CMGS"
+*/
+uint8_t A6lib::commandClass(const char* command, const char* resp) {
+	char prefix[A6_CMD_PREFIX_LEN + 1];
+	uint8_t len = 0;
+	if (!command[0]) {
+		if (!resp[0])
+			return NO_CMD_CLASS;
+		prefix[len++] = '~';
+		command = resp;
+	} else if ((command[0] == 'A' || command[0] == 'a') && (command[1] == 'T' || command[1] == 't') && command[2]) {
+		command += 2;
+	}
+	while (len < A6_CMD_PREFIX_LEN && *command && *command != '=' && *command != '?')
+		prefix[len++] = *command++;
+	prefix[len] = 0;
+
+	/* a new class takes a free slot or the one with the fewest samples */
+	uint8_t victim = 0;
+	for (uint8_t i = 0; i < A6_CMD_CLASSES; i++) {
+		if (strcmp(classes[i].prefix, prefix) == 0)
+			return i;
+		if (classes[i].samples < classes[victim].samples || (!classes[i].prefix[0] && classes[victim].prefix[0]))
+			victim = i;
+	}
+
+	auto& cls = classes[victim];
+	memset(&cls, 0, sizeof(cls));
+	memcpy(cls.prefix, prefix, len + 1);
+
+	return victim;
+}
+
+uint16_t A6lib::classTimeout(const CommandClass& cls) const {
+	const uint32_t rto = (cls.srtt >> 3) + cls.rttvar;
+	return minimum(maximum(rto, (uint32_t)min_timeout), (uint32_t)max_timeout);
+}
+
+/* update the smoothed latency and deviation of a class, the same as TCP RTT estimator (RFC 6298) */
+void A6lib::sampleLatency(uint8_t cls, unsigned long latency) {
+	if (cls == NO_CMD_CLASS)
+		return;
+
+	auto& c = classes[cls];
+	if (latency > 0xFFFF)
+		latency = 0xFFFF;
+	if (c.samples == 0) {
+		c.srtt = latency << 3;
+		c.rttvar = latency << 1;
+	} else {
+		const int32_t err = latency - (c.srtt >> 3);
+		c.srtt += err; // srtt += err / 8
+		c.rttvar += (err < 0 ? -err : err) - (c.rttvar >> 2); // rttvar += (|err| - rttvar) / 4
+	}
+	if (c.samples < 0xFFFF)
+		c.samples++;
+}
+
+#ifdef A6_PERF_COUNTERS
+void A6lib::countReply(uint8_t cls, unsigned long latency) {
+	if (cls == NO_CMD_CLASS)
+		return;
+
+	auto& c = classes[cls];
+	if (latency > 0xFFFF)
+		latency = 0xFFFF;
+	if (c.success == 0 || latency < c.min_latency)
+		c.min_latency = latency;
+	if (latency > c.max_latency)
+		c.max_latency = latency;
+	c.sum_latency += latency;
+	c.count++;
+	c.success++;
+
+	uint8_t bucket = 0;
+	while (latency >> bucket)
+		bucket++;
+	if (c.histogram[bucket] < 0xFFFF)
+		c.histogram[bucket]++;
+}
+
+void A6lib::countPrompt(uint8_t cls, uint16_t latency) {
+	if (cls == NO_CMD_CLASS)
+		return;
+
+	auto& c = classes[cls];
+	if (latency > c.max_prompt)
+		c.max_prompt = latency;
+	c.sum_prompt += latency;
+	c.prompts++;
+}
 #endif
-			/* maybe some notifications included in command's reply, so we check for sure */
-			if (hasNotifications(reply))
-				lastInterestedReply = reply; // schedule for calling callbacks
 
-			if (response)
-				*response = reply;
-			break;
+/* a missed reply doubles the timeout of its class */
+void A6lib::backoff(uint8_t cls) {
+	if (cls == NO_CMD_CLASS || classes[cls].samples == 0)
+		return;
+
+	auto& c = classes[cls];
+	c.srtt = minimum(c.srtt * 2, (uint32_t)0xFFFF << 3);
+	c.rttvar = minimum(c.rttvar * 2, (uint32_t)0xFFFF << 2);
+}
+
+A6lib::Command* A6lib::findCommand(cmd_handle_t handle) {
+	for (auto& c : commands) {
+		if (c.state != Cmd_Invalid && c.id == handle)
+			return &c;
+	}
+
+	return nullptr;
+}
+
+A6lib::Command* A6lib::activeCommand() {
+	Command* active = nullptr;
+	for (auto& c : commands) {
+		if ((c.state == Cmd_Queued || c.state == Cmd_Waiting) && (!active || (int16_t)(c.id - active->id) < 0))
+			active = &c;
+	}
+
+	return active;
+}
+
+void A6lib::runEngine() {
+	auto c = activeCommand();
+	if (!c)
+		return;
+
+	Span line;
+	if (c->state == Cmd_Queued) {
+		c->attempts--;
+		/* whatever arrived before this point doesn't belong to the command, a line still arriving (e.g +CMTI) is kept */
+		fillRx();
+		while (nextLine(&line)) {}
+		consumeLines();
+		if (c->response)
+			c->response->remove(0);
+		if (c->command[0]) {
+			dbg(PSTR("issuing command: %s"), c->command);
+			stream->println(c->command);
+			PERF(if (c->cls != NO_CMD_CLASS) classes[c->cls].tx_bytes += strlen(c->command) + 2);
 		}
-	} while (millis() - start < timeout);
-	isWaiting = false;
-	if ((millis() - start > timeout) && !reply.length()) {
-		success = false;
-		dbg("reply timeout out!");
+		PERF(if (c->cls != NO_CMD_CLASS && c->retried) classes[c->cls].retries++);
+		dbg(PSTR("waiting for reply..."));
+		c->limit = c->timeout;
+		if (adaptive_timeout && c->cls != NO_CMD_CLASS && classes[c->cls].samples >= MIN_LATENCY_SAMPLES)
+			c->limit = classTimeout(classes[c->cls]);
+		c->started = millis();
+		c->matched = false;
+		c->final = false;
+		c->prompted = false;
+		c->payload_pos = 0;
+		c->state = Cmd_Waiting;
+		return;
 	}
 
-	return success;
+	const auto received = fillRx();
+	PERF(if (c->cls != NO_CMD_CLASS) classes[c->cls].rx_bytes += received);
+	(void)received;
+	while (auto type = nextLine(&line)) {
+		if (type == Line_Final)
+			c->final = true;
+		if (spanIndexOf(line, c->resp1) != -1 || spanIndexOf(line, c->resp2) != -1)
+			c->matched = true;
+		if (c->sink)
+			c->sink(c->sink_ctx, type, line);
+	}
+	/* the sink took the complete lines, only the partial one is kept */
+	if (c->sink && line_start)
+		consumeLines();
+
+	/* the rest of the payload, then we keep waiting for the result of the submit */
+	if (c->prompted && !c->payload_sent) {
+		writePayload(c);
+		if (millis() - c->started < c->limit)
+			return;
+	}
+
+	/* the SMS prompt has no line ending */
+	bool prompt = false;
+	if (line_start < rx.length() && rx.at(line_start) == '>') {
+		if (c->payload && !c->prompted) {
+			/* the payload goes right after the prompt */
+			c->prompted = true;
+			prompt_latency = minimum(millis() - c->started, 0xFFFFUL);
+			PERF(countPrompt(c->cls, prompt_latency));
+			clearRx();
+			writePayload(c);
+			return;
+		}
+		prompt = true;
+		c->matched = c->matched || rx.indexOf(c->resp1, line_start) != -1 || rx.indexOf(c->resp2, line_start) != -1;
+	}
+
+	/* no final result code, so wait for the modem to go quiet */
+	if (c->matched && (c->final || prompt || millis() - last_rx >= quiet_time)) {
+		dbg(PSTR("reply in %lu ms:\n"), millis() - c->started);
+		auto reply = rx.linearize();
+		/* the partial line is left for whoever comes next, it's not a part of the reply */
+		const uint16_t taken = prompt ? reply.len : line_start;
+#ifdef DEBUG
+		if (dbg_stream)
+			dbg_stream->write(reply.data, taken);
+#endif
+		if (c->response) {
+			c->response->reserve(c->response->length() + taken);
+			for (uint16_t i = 0; i < taken; i++)
+				c->response->concat(reply.data[i]);
+		}
+		rx.consume(taken);
+		line_start = 0;
+		line_scan = 0;
+		c->state = Cmd_Success;
+		if (!c->retried)
+			sampleLatency(c->cls, millis() - c->started);
+		PERF(countReply(c->cls, millis() - c->started));
+	} else if (millis() - c->started >= c->limit) {
+		clearRx();
+		if (c->response)
+			c->response->remove(0);
+		backoff(c->cls);
+		c->retried = true;
+		PERF(if (c->cls != NO_CMD_CLASS) classes[c->cls].timeouts++);
+		/* modem waits for the rest of a payload cut short, ESC makes it drop the message */
+		if (c->prompted && !c->payload_sent)
+			stream->write(char(0x1B));
+		/* once the payload is written, a retry could send the SMS twice */
+		if (c->attempts && !c->payload_sent) {
+			c->state = Cmd_Queued;
+		} else {
+			c->state = Cmd_Failed;
+			PERF(if (c->cls != NO_CMD_CLASS) classes[c->cls].count++);
+			dbg(PSTR("reply timeout out!"));
+		}
+	} else if (rx.isFull()) {
+		spillRx(c->response);
+	}
 }
-///@endcond
\ No newline at end of file
+
+/*
+	write the next chunk of the payload and its Ctrl-Z, as much as the port takes without blocking
+	and, under hardware flow control, only while modem is ready for it
+*/
+void A6lib::writePayload(Command* c) {
+	if (cts_pin >= 0 && digitalRead(cts_pin) == HIGH)
+		return;
+
+	/*
+		SoftwareSerial has no tx buffer, it writes in place. a port which doesn't know its room says 0
+		(it's Print's default) forever, it gets a whole chunk too and write() waits as it always did.
+		once a port reported some room, 0 means its tx buffer is full and we try again on the next step
+	*/
+	int room = 0;
+	if (!ports.isSoftwareSerial()) {
+		room = stream->availableForWrite();
+		tx_room_known = tx_room_known || room > 0;
+	}
+	if (room <= 0) {
+		if (tx_room_known)
+			return;
+		room = A6_TX_CHUNK;
+	}
+
+	const uint16_t total = (c->payload_hex ? c->payload_len * 2 : c->payload_len) + 1;
+	char chunk[A6_TX_CHUNK];
+	const uint16_t n = minimum(minimum(total - c->payload_pos, room), A6_TX_CHUNK);
+	for (uint16_t i = 0; i < n; i++) {
+		const uint16_t at = c->payload_pos + i;
+		if (at == total - 1)
+			chunk[i] = CTRLZ;
+		else if (c->payload_hex)
+			chunk[i] = hex_digits[at & 1 ? c->payload[at / 2] & 0x0F : c->payload[at / 2] >> 4];
+		else
+			chunk[i] = c->payload[at];
+	}
+	const auto written = stream->write(chunk, n);
+	c->payload_pos += written;
+	PERF(if (c->cls != NO_CMD_CLASS) classes[c->cls].tx_bytes += written);
+	c->payload_sent = c->payload_pos == total;
+}
+
+bool A6lib::cmd(const char *command, const char *resp1, const char *resp2, uint16_t timeout, uint8_t max_retry, String *response, line_sink_t sink, void* sink_ctx) {
+	auto handle = submitCommand(command, resp1, resp2, timeout, max_retry, response);
+	/* engine is full of submitted commands, let them go first */
+	while (handle == INVALID_CMD_HANDLE && activeCommand()) {
+		yield();
+		runEngine();
+		handle = submitCommand(command, resp1, resp2, timeout, max_retry, response);
+	}
+	if (sink && handle != INVALID_CMD_HANDLE) {
+		auto c = findCommand(handle);
+		c->sink = sink;
+		c->sink_ctx = sink_ctx;
+	}
+
+	return handle != INVALID_CMD_HANDLE && waitForCommand(handle);
+}
+
+bool A6lib::wait(const char *response1, const char *response2, uint16_t timeout, String *response) {
+	return cmd("", response1, response2, timeout, 1, response);
+}
+
+/* format a command of at_commands with its arguments and pick its replies, timeout and retries from flash */
+bool A6lib::prepareAT(ATCall* call, uint8_t at, ...) const {
+	const auto& spec = at_commands[at];
+	char format[sizeof(spec.format)];
+	strcpy_P(format, spec.format);
+	va_list args;
+	va_start(args, at);
+	const auto len = vsnprintf(call->command, sizeof(call->command), format, args);
+	va_end(args);
+	call->resp1 = static_cast<const char*>(pgm_read_ptr(&spec.resp1));
+	call->resp2 = static_cast<const char*>(pgm_read_ptr(&spec.resp2));
+	call->timeout = pgm_read_word(&spec.timeout);
+	call->max_retry = pgm_read_byte(&spec.max_retry);
+	if (len < 0 || len > A6_CMD_MAX_LEN) {
+		dbg(PSTR("command is too long!"));
+		return false;
+	}
+
+	return true;
+}
+
+/* issue a command of at_commands which takes no argument */
+bool A6lib::at(uint8_t at, String* response) {
+	ATCall call;
+	return prepareAT(&call, at) && cmd(call, response);
+}
+
+bool A6lib::cmd(const ATCall& call, String* response, line_sink_t sink, void* sink_ctx) {
+	return cmd(call.command, call.resp1, call.resp2, call.timeout, call.max_retry, response, sink, sink_ctx);
+}
+///@endcond
@@ -3,16 +3,137 @@
 
 extern "C" {
 #include<time.h>
+#include "pdu.h"
 }
 
 #include <Arduino.h>
 #include <SoftwareSerial.h>
 #include <HardwareSerial.h>
 
+#include "ringbuffer.h"
+
 /* comment the following to disable them */
 //#define DEBUG
 #define SIM800_T
 //#define A6_T
+/* count commands, retries, timeouts, bytes and reply latencies per command class, see A6lib::getCommandStats() */
+//#define A6_PERF_COUNTERS
+
+/* number of AT commands the command engine can hold (including the one in progress) */
+#ifndef A6_CMD_QUEUE_SIZE
+#	ifdef __AVR__
+#		define A6_CMD_QUEUE_SIZE 2
+#	else
+#		define A6_CMD_QUEUE_SIZE 4
+#	endif
+#endif
+/* size of the receive buffer, longer replies are moved out line by line when caller asked for them.
+   it should hold the longest reply line, which is a +CMGR/+CMGL pdu line (up to 352 chars) in PDU mode */
+#ifndef A6_RX_BUFFER_SIZE
+#	ifdef __AVR__
+#		define A6_RX_BUFFER_SIZE 256
+#	else
+#		define A6_RX_BUFFER_SIZE 1024
+#	endif
+#endif
+/* room for notification lines waiting to be dispatched by A6lib::handle().
+   a +CMT notification carries the whole SMS (up to 352 hex chars in PDU mode), it's dropped if there's no room */
+#ifndef A6_URC_BUFFER_SIZE
+#	ifdef __AVR__
+#		define A6_URC_BUFFER_SIZE 64
+#	else
+#		define A6_URC_BUFFER_SIZE 512
+#	endif
+#endif
+/* number of notification prefixes which could be registered via A6lib::onURC() */
+#ifndef A6_URC_HOOKS
+#	ifdef __AVR__
+#		define A6_URC_HOOKS 2
+#	else
+#		define A6_URC_HOOKS 8
+#	endif
+#endif
+/* maximum length of a notification prefix registered via A6lib::onURC() */
+#ifndef A6_URC_PREFIX_LEN
+#	define A6_URC_PREFIX_LEN 11
+#endif
+/* slots of the hash index of reply line prefixes, a power of two well above the 19 built-in ones + A6_URC_HOOKS */
+#ifndef A6_LINE_INDEX_SIZE
+#	ifdef __AVR__
+#		define A6_LINE_INDEX_SIZE 32
+#	else
+#		define A6_LINE_INDEX_SIZE 64
+#	endif
+#endif
+/* number of SMS the outbound queue can hold until they're sent */
+#ifndef A6_SMS_QUEUE_SIZE
+#	ifdef __AVR__
+#		define A6_SMS_QUEUE_SIZE 2
+#	else
+#		define A6_SMS_QUEUE_SIZE 32
+#	endif
+#endif
+/* send the queued SMS in the background (see A6lib::setAsyncSMSQueue()), 0 -> only A6lib::flushSMSQueue() sends them.
+   it keeps a pdu and two Strings in every A6lib object */
+#ifndef A6_ASYNC_SMS
+#	ifdef __AVR__
+#		define A6_ASYNC_SMS 0
+#	else
+#		define A6_ASYNC_SMS 1
+#	endif
+#endif
+/* keep the modem facts (IMEI, firmware, ...) once read (see A6lib::setFactTTL()), 0 -> they're asked from modem every time */
+#ifndef A6_FACT_CACHE
+#	ifdef __AVR__
+#		define A6_FACT_CACHE 0
+#	else
+#		define A6_FACT_CACHE 1
+#	endif
+#endif
+/* maximum length of a modem fact A6lib can keep, longer ones are asked from modem every time */
+#ifndef A6_FACT_MAX_LEN
+#	define A6_FACT_MAX_LEN 31
+#endif
+/* number of command classes (commands with the same prefix e.g "+CMGR") whose reply latency is learned */
+#ifndef A6_CMD_CLASSES
+#	ifdef __AVR__
+#		define A6_CMD_CLASSES 4
+#	else
+#		define A6_CMD_CLASSES 16
+#	endif
+#endif
+/* maximum length of a command class prefix, longer ones are cut */
+#ifndef A6_CMD_PREFIX_LEN
+#	define A6_CMD_PREFIX_LEN 7
+#endif
+/* maximum length of a submitted AT command (without CR LF), the longest built-in one is AT+CMGS with a 20 digits number */
+#ifndef A6_CMD_MAX_LEN
+#	ifdef __AVR__
+#		define A6_CMD_MAX_LEN 40
+#	else
+#		define A6_CMD_MAX_LEN 64
+#	endif
+#endif
+/* the highest baud rate A6lib::autoBaud() steps modem up to, a 16MHz AVR UART is off by 2-3% above 57600 */
+#ifndef A6_MAX_BAUD
+#	ifdef __AVR__
+#		define A6_MAX_BAUD 57600
+#	else
+#		define A6_MAX_BAUD 460800
+#	endif
+#endif
+/* number of times the reference replies must come back intact before a baud rate is taken */
+#ifndef A6_BAUD_CHECKS
+#	define A6_BAUD_CHECKS 4
+#endif
+/* maximum bytes of an SMS payload written at once, the rest goes out on the next steps of the engine so replies keep being read meanwhile */
+#ifndef A6_TX_CHUNK
+#	ifdef __AVR__
+#		define A6_TX_CHUNK 16
+#	else
+#		define A6_TX_CHUNK 64
+#	endif
+#endif
 
 ///@cond INTERNAL
 enum call_direction {
@@ -77,12 +198,22 @@ enum RegisterStatus {
 	Registered_Roaming = 5,
 };
 
+enum SMSRecordType {
+	All,
+	Unread,
+	Read,
+	Unsent, /* stored, not sent yet */
+	Sent, /* stored and sent */
+};
+
 class SMSInfo {
 public:
-	SMSInfo() : number{}, dateTime{}, message{} {
+	SMSInfo() : index{}, status{ All }, number{}, dateTime{}, message{} {
 
 	}
 
+	uint8_t index; /* index in storage area, only set by A6lib::readSMSList() */
+	SMSRecordType status; /* only set by A6lib::readSMSList() */
 	String number;
 	String dateTime;
 	String message;
@@ -98,16 +229,90 @@ enum SMSStorageArea {
 #endif
 };
 
-enum SMSRecordType {
-	All,
-	Unread,
-	Read,
+/*!
+ * The SMS message format modem is working in (AT+CMGF).
+ * In PDU format incoming SMS are decoded by A6lib itself, and sending PDU doesn't need to switch modem format back and forth.
+ */
+enum SMSFormat {
+	Format_PDU = 0,
+	Format_Text = 1,
+};
+
+/*!
+ * The state of a command submitted to the command engine via A6lib::submitCommand().
+ */
+enum CommandState {
+	Cmd_Invalid = 0, /* unknown handle, or the command slot has been reused */
+	Cmd_Queued, /* waiting for the commands ahead of it */
+	Cmd_Waiting, /* sent to modem, waiting for the expected reply */
+	Cmd_Success,
+	Cmd_Failed, /* no expected reply after all retries */
 };
 
+/*!
+ * The modem facts which hardly ever change, A6lib keeps them once read (see A6lib::setFactTTL()).
+ */
+enum ModemFact {
+	Fact_IMEI = 0, /* A6lib::getIMEI() */
+	Fact_FirmWare, /* A6lib::getFirmWareVer() */
+	Fact_SCA, /* A6lib::getSMSSca() */
+	Fact_Operator, /* A6lib::getOperatorName() */
+	Fact_SIMNumber, /* A6lib::getSIMNumber() */
+	Fact_Count
+};
+
+#define FACT_TTL_FOREVER 0xFFFFFFFFUL
+
+typedef uint16_t cmd_handle_t;
+#define INVALID_CMD_HANDLE 0
+
+/*!
+ * The reply latency A6lib learned for a class of commands, e.g all the "AT+CMGR=..." commands (see A6lib::getCommandTimings()).
+ */
+struct CommandTiming {
+	char prefix[A6_CMD_PREFIX_LEN + 1]; /* the command without "AT" up to '=' or '?', e.g "+CMGR" */
+	uint16_t latency; /* smoothed reply latency in ms */
+	uint16_t deviation; /* smoothed mean deviation of the latency in ms */
+	uint16_t timeout; /* the timeout of this class when adaptive timeouts are enabled, in ms */
+	uint16_t samples; /* number of replies measured */
+};
+
+#ifdef A6_PERF_COUNTERS
+/*!
+ * The performance counters of a class of commands (see A6lib::getCommandStats()).
+ */
+struct CommandStats {
+	char prefix[A6_CMD_PREFIX_LEN + 1]; /* the same as CommandTiming::prefix */
+	uint16_t count; /* finished commands */
+	uint16_t success; /* commands got their expected reply */
+	uint16_t retries; /* attempts made after the first one */
+	uint16_t timeouts; /* attempts timed out */
+	uint32_t tx_bytes; /* command bytes written */
+	uint32_t rx_bytes; /* reply bytes read */
+	uint16_t min_latency; /* reply latency of the successful commands in ms */
+	uint16_t avg_latency;
+	uint16_t max_latency;
+	uint16_t p95_latency; /* upper bound of the 95th percentile, from a power of two histogram */
+	uint16_t prompts; /* commands which got the SMS prompt (">") */
+	uint16_t avg_prompt_latency; /* how long the prompt took in ms */
+	uint16_t max_prompt_latency;
+};
+#endif
+
 typedef void(*void_cb_t)(void);
 typedef void (*sms_rx_cb_t)(uint8_t indx, const SMSInfo&);
 typedef void(*sms_tx_cb_t)(void);
+typedef void(*sms_job_cb_t)(uint16_t job, bool sent, uint8_t mr, void* ctx);
 typedef void_cb_t sms_full_cb_t;
+/* handlers of the unsolicited result codes, ctx is the pointer given on registration */
+typedef void(*ctx_cb_t)(void* ctx);
+typedef void(*sms_index_cb_t)(void* ctx, uint8_t indx, const SMSInfo&); /* +CMTI */
+typedef void(*sms_cb_t)(void* ctx, const SMSInfo&); /* +CMT */
+typedef void(*clip_cb_t)(void* ctx, const char* number, uint8_t type); /* +CLIP */
+typedef void(*creg_cb_t)(void* ctx, RegisterStatus status); /* +CREG */
+typedef void(*ussd_cb_t)(void* ctx, uint8_t status, const char* text); /* +CUSD */
+typedef void(*status_report_cb_t)(void* ctx, uint8_t mr, uint8_t status, const char* number); /* +CDS */
+typedef void(*urc_cb_t)(void* ctx, const Span& line, const Span& body); /* A6lib::onURC() */
 
 class A6lib {
 public:
@@ -121,6 +326,11 @@ public:
 	void handle();
 	bool start(uint8_t max_retry);
 	bool waitForNetwork(unsigned long baud, uint16_t time_out /* ms */);
+	unsigned long autoBaud(unsigned long max_baud = A6_MAX_BAUD);
+	unsigned long getBaudRate() const {
+		return baud_rate;
+	}
+	bool setFlowControl(bool enable, int8_t cts_pin = -1, int8_t rts_pin = -1);
 #ifdef A6_T
 	void powerUp(int pin);
 	void softReset();
@@ -137,6 +347,9 @@ public:
 	String getIMEI();
 	String getSMSSca();
 	RegisterStatus getRegisterStatus();
+	void setFactTTL(ModemFact fact, unsigned long ttl);
+	void invalidateFacts();
+	void invalidateFact(ModemFact fact);
 #ifdef SIM800_T
 	String getOperatorName();
 	int getADCValue();
@@ -152,12 +365,22 @@ public:
 	String sendUSSD(const String& ussd_code, uint16_t timeout = -1);
 	bool setSMSStorageArea(SMSStorageArea);
 	bool setCharSet(CharSet);
+	bool setSMSFormat(SMSFormat);
 	bool sendSMS(const String& number, const String& text);
 	bool sendPDU(const String& number, const String& content);
-	bool sendPDU(const String& number, uint16_t* content, uint8_t len);
+	bool sendPDU(const String& number, uint16_t* content, uint16_t len);
+	bool sendPDU(const String& number, const char* content, uint16_t len);
 	SMSInfo readSMS(uint8_t index);
 	bool deleteSMS(uint8_t index, bool del_all = false);
 	int8_t getSMSList(int8_t* buff, uint8_t len, SMSRecordType record);
+	int16_t readSMSList(SMSRecordType record, sms_rx_cb_t cb);
+	int16_t readSMSList(SMSRecordType record, SMSInfo* buff, uint8_t len);
+	uint16_t queueSMS(const String& number, const String& content);
+	int16_t flushSMSQueue();
+	uint8_t queuedSMS() const;
+#if A6_ASYNC_SMS
+	void setAsyncSMSQueue(bool enable);
+#endif
 
 	///@cond INTERNAL
 	void dial(String number);
@@ -173,11 +396,22 @@ public:
 	void onSMSSent(sms_tx_cb_t);
 	void onSMSReceived(sms_rx_cb_t);
 	void onSMSStorageFull(sms_full_cb_t);
+	void onQueuedSMSSent(sms_job_cb_t, void* ctx = nullptr);
+	void onSMSSent(ctx_cb_t, void* ctx);
+	void onSMSReceived(sms_index_cb_t, void* ctx);
+	void onSMSStorageFull(ctx_cb_t, void* ctx);
+	void onDirectSMS(sms_cb_t, void* ctx = nullptr);
+	void onRing(ctx_cb_t, void* ctx = nullptr);
+	void onCallerId(clip_cb_t, void* ctx = nullptr);
+	void onRegistration(creg_cb_t, void* ctx = nullptr);
+	void onUSSD(ussd_cb_t, void* ctx = nullptr);
+	void onStatusReport(status_report_cb_t, void* ctx = nullptr);
+	bool onURC(const char* prefix, urc_cb_t, void* ctx = nullptr, bool has_body = false);
 
 	///@cond INTERNAL
 	bool isSIMInserted();
 	bool isBusy() {
-		return isWaiting;
+		return isWaiting || activeCommand() != nullptr;
 	}
 	bool isRegsitered() {
 		const auto status = getRegisterStatus();
@@ -187,25 +421,83 @@ public:
 	///@endcond
 
 	String sendCommand(const String& command, uint16_t reply_timeout = 2000);
+	cmd_handle_t submitCommand(const char* command, const char* resp1, const char* resp2, uint16_t timeout = 2000, uint8_t max_retry = 1, String* response = nullptr);
+	cmd_handle_t submitRegisterStatus(String* response);
+	CommandState commandState(cmd_handle_t handle) const;
+	bool waitForCommand(cmd_handle_t handle);
+	void setAdaptiveTimeout(bool enable, uint16_t min_timeout = 300, uint16_t max_timeout = 10000);
+	uint8_t getCommandTimings(CommandTiming* buff, uint8_t len) const;
+	bool getCommandTiming(const char* prefix, CommandTiming* timing) const;
+	uint16_t getPromptLatency() const;
+#ifdef A6_PERF_COUNTERS
+	uint8_t getCommandStats(CommandStats* buff, uint8_t len) const;
+	void resetCommandStats();
+#endif
 
 protected:
 	///@cond INTERNAL
-	void dbg(const char* format, ...) const;
-	static String toTime(const char* cclk_str, const String& format);
+	void dbg(PGM_P format, ...) const;
+	bool lookupFact(ModemFact fact, String* value) const;
+	String storeFact(ModemFact fact, const char* value);
+	static String toTime(const char* cclk_str, PGM_P format);
 	static void toHex(String* in, uint8_t* pdu, uint8_t pdu_len);
+	static void toHex(Print* out, const uint8_t* pdu, uint8_t pdu_len);
+	static int fromHex(const char* hex, uint16_t hex_len, uint8_t* pdu, uint8_t pdu_size);
 
 	bool begin();
 	bool setBaudRate(unsigned long baud);
+	void openPort(unsigned long baud);
+	bool probeModem();
+	unsigned long detectBaudRate();
+	bool linkReference(String* reference);
+	bool checkLink(const String& reference);
 
 	void powerOn(uint8_t pin) const;
 	void powerOff(uint8_t pin) const;
 
-	void parseForNotifications(String* data);
-	bool hasNotifications(const String& arg);
-
-	String streamData() const;
-	bool cmd(const char *command, const char *resp1, const char *resp2, uint16_t timeout, uint8_t max_retry, String *response = nullptr);
+	void parseForNotifications(const Span& line, const Span& body);
+	bool queueNotification(const Span& line);
+	void queueNotificationBody(const Span& line);
+
+	uint16_t fillRx();
+	void clearRx();
+	void consumeLines();
+	uint8_t nextLine(Span* line);
+	void spillRx(String* response);
+	void runEngine();
+	/* receives every reply line of a command as it's tokenized, instead of collecting them in a response */
+	typedef void(*line_sink_t)(void* ctx, uint8_t type, const Span& line);
+	bool cmd(const char *command, const char *resp1, const char *resp2, uint16_t timeout, uint8_t max_retry, String *response = nullptr, line_sink_t sink = nullptr, void* sink_ctx = nullptr);
 	bool wait(const char *resp1, const char *resp2, uint16_t timeout, String *response);
+	/* a command of the flash command table, formatted and ready to be submitted */
+	struct ATCall {
+		char command[A6_CMD_MAX_LEN + 1];
+		const char* resp1;
+		const char* resp2;
+		uint16_t timeout;
+		uint8_t max_retry;
+	};
+	bool prepareAT(ATCall* call, uint8_t at, ...) const;
+	bool at(uint8_t at, String* response = nullptr);
+	bool cmd(const ATCall& call, String* response = nullptr, line_sink_t sink = nullptr, void* sink_ctx = nullptr);
+
+	bool beginPDUSession(String* sca);
+	bool submitSMS(const String& sca, const String& number, const pdu_text_t& text, uint8_t* mr);
+	bool submitPDU(const uint8_t* pdu, uint8_t pdu_len, uint8_t* mr = nullptr);
+	cmd_handle_t queuePDU(const uint8_t* pdu, uint8_t pdu_len, String* response);
+	cmd_handle_t queuePayload(const ATCall& call, const uint8_t* payload, uint16_t len, bool hex, String* response);
+	bool sendPayload(const ATCall& call, const uint8_t* payload, uint16_t len, bool hex, String* response);
+	bool beginConcat(const pdu_text_t& text, pdu_concat_t* concat, uint8_t* coding);
+	int encodeSMSPart(const String& sca, const String& number, const pdu_text_t& text, uint8_t coding, uint16_t* from, pdu_concat_t* concat, uint8_t* pdu);
+#if A6_ASYNC_SMS
+	void pumpSMSQueue();
+#endif
+	void finishSMSJob(bool sent, uint8_t mr);
+	void endPDUSession();
+	bool decodeSMS(const Span& hex, SMSInfo* info);
+	struct SMSList;
+	static void listSink(void* ctx, uint8_t type, const Span& line);
+	int16_t readSMSList(SMSRecordType record, SMSList* list);
 	///@endcond
 
 private:
@@ -213,7 +505,164 @@ private:
 	Stream* dbg_stream = nullptr;
 #endif
 	Stream* stream = nullptr;
+	unsigned long baud_rate = 0; /* the rate modem talks at, 0 -> unknown */
 	bool isWaiting = false;
+	SMSFormat sms_format = Format_Text;
+	uint8_t concat_ref = 0; /* reference number of the last concatenated SMS */
+
+#if A6_FACT_CACHE
+	struct Fact {
+		char value[A6_FACT_MAX_LEN + 1];
+		unsigned long stamp; /* when it was read */
+		unsigned long ttl;
+		bool valid;
+	};
+	Fact facts[Fact_Count] = {
+		{ {}, 0, FACT_TTL_FOREVER, false },
+		{ {}, 0, FACT_TTL_FOREVER, false },
+		{ {}, 0, FACT_TTL_FOREVER, false },
+		{ {}, 0, FACT_TTL_FOREVER, false },
+		{ {}, 0, FACT_TTL_FOREVER, false },
+	};
+#endif
+
+	struct SMSJob {
+		uint16_t id;
+		String number;
+		String content;
+	};
+	SMSJob sms_queue[A6_SMS_QUEUE_SIZE];
+	uint8_t sms_queue_head = 0;
+	uint8_t sms_queue_len = 0;
+	uint16_t next_sms_job = 1;
+	uint16_t sms_jobs_sent = 0;
+#if A6_ASYNC_SMS
+	bool async_sms = false;
+	struct SMSPump {
+		cmd_handle_t handle; /* AT+CMGS of the part in flight */
+		uint16_t from; /* where the next part begins in content */
+		pdu_concat_t concat;
+		uint8_t coding; /* PDU_CODING_XXX picked for the job */
+		uint8_t pdu[PDU_MAX_LEN]; /* the encoded part, it's written by the engine on the prompt */
+		uint8_t pdu_len; /* 0 -> next part isn't encoded yet */
+		String sca; /* of the job in flight, looked up by the pump itself */
+		String reply;
+	} sms_pump = {};
+#endif
+
+	struct Command {
+		cmd_handle_t id;
+		CommandState state;
+		char command[A6_CMD_MAX_LEN + 1]; /* empty -> only wait for the reply */
+		const char* resp1;
+		const char* resp2;
+		uint16_t timeout;
+		uint8_t attempts; /* number of remaining attempts */
+		unsigned long started;
+		String* response;
+		bool matched; /* got one of the expected replies */
+		bool final; /* got the final result code */
+		line_sink_t sink;
+		void* sink_ctx;
+		uint8_t cls; /* index in classes */
+		uint16_t limit; /* the timeout of the current attempt */
+		bool retried; /* the reply can't be told apart from a previous attempt */
+		const uint8_t* payload; /* written on the SMS prompt (a pdu in hex), followed by Ctrl-Z */
+		uint16_t payload_len;
+		bool payload_hex;
+		bool prompted; /* got the prompt, the payload is being written */
+		uint16_t payload_pos; /* chars of the payload (and its Ctrl-Z) written so far */
+		bool payload_sent;
+	};
+	Command commands[A6_CMD_QUEUE_SIZE] = {};
+	cmd_handle_t next_cmd_id = 1;
+	RingBuffer<A6_RX_BUFFER_SIZE> rx; /* bytes received for the command in progress or pending notifications */
+	uint16_t line_start = 0; /* where the next line to tokenize begins in rx */
+	uint16_t line_scan = 0; /* how far we looked for the end of that line */
+	bool body_next = false; /* the next line is an SMS body */
+	bool urc_body = false; /* that body belongs to the last queued notification */
+	bool line_cut = false; /* the line at line_start lost its head to spillRx() */
+	char urc_pending[A6_URC_BUFFER_SIZE]; /* '\n' separated notification lines, a body follows its line after '\r' */
+	uint16_t urc_len = 0;
+	uint16_t urc_last = 0; /* where the last queued notification begins */
+	bool urc_dispatching = false; /* A6lib::handle() is parsing them */
+
+	/* the handler of each built-in notification, fn is cast back to its real type on dispatch */
+	enum URCKind {
+		URC_None = 0,
+		URC_CMTI,
+		URC_CMGS,
+		URC_CIEV,
+		URC_RING,
+		URC_CLIP,
+		URC_CREG,
+		URC_CUSD,
+		URC_CDS,
+		URC_CMT,
+		URC_Count
+	};
+	struct URCHandler {
+		void(*fn)();
+		void* ctx;
+	};
+	URCHandler urc_handlers[URC_Count] = {};
+	struct URCHook {
+		char prefix[A6_URC_PREFIX_LEN + 1];
+		urc_cb_t cb;
+		void* ctx;
+		bool has_body;
+	};
+	URCHook urc_hooks[A6_URC_HOOKS] = {};
+	uint8_t urc_hooks_len = 0;
+	/* open addressing hash index of line prefixes: 0 -> empty, 1..0x7F -> built-in + 1, 0x80 | hook */
+	uint8_t line_index[A6_LINE_INDEX_SIZE] = {};
+	struct LineClass {
+		uint8_t type;
+		uint8_t body;
+		uint8_t urc;
+		uint8_t hook;
+	};
+	void indexLinePrefixes();
+	bool indexLinePrefix(const char* prefix, uint8_t len, uint8_t value);
+	LineClass classifyLine(const Span& line) const;
+	void setURCHandler(URCKind kind, void(*fn)(), void* ctx);
+	Command* activeCommand();
+	Command* findCommand(cmd_handle_t handle);
+	void writePayload(Command* c);
+	int8_t cts_pin = -1; /* modem holds it low while it takes data, -1 -> not used */
+	int8_t rts_pin = -1; /* held high while rx is nearly full, -1 -> not used */
+	bool tx_room_known = false; /* availableForWrite() said more than 0 once, from then on 0 means the tx buffer is full */
+	uint16_t prompt_latency = 0;
+
+	struct CommandClass {
+		char prefix[A6_CMD_PREFIX_LEN + 1]; /* empty -> free */
+		uint32_t srtt; /* smoothed latency << 3 */
+		uint32_t rttvar; /* smoothed deviation << 2 */
+		uint16_t samples;
+#ifdef A6_PERF_COUNTERS
+		uint16_t count, success, retries, timeouts;
+		uint32_t tx_bytes, rx_bytes;
+		uint16_t min_latency, max_latency;
+		uint32_t sum_latency;
+		uint16_t histogram[17]; /* [0] -> 0 ms, [i] -> [2^(i-1), 2^i) ms */
+		uint16_t prompts, max_prompt;
+		uint32_t sum_prompt;
+#endif
+	};
+	CommandClass classes[A6_CMD_CLASSES] = {};
+	bool adaptive_timeout = false;
+	uint16_t min_timeout = 0, max_timeout = 0;
+	uint8_t commandClass(const char* command, const char* resp);
+	uint16_t classTimeout(const CommandClass& cls) const;
+	void sampleLatency(uint8_t cls, unsigned long latency);
+	void backoff(uint8_t cls);
+#ifdef A6_PERF_COUNTERS
+	void countReply(uint8_t cls, unsigned long latency);
+	void countPrompt(uint8_t cls, uint16_t latency);
+#endif
+	unsigned long last_rx = 0;
+	uint16_t quiet_time = 0; /* silence after which a reply without final result code is complete */
+
 	struct SerialPorts {
 		enum PortState {
 			Using_SoftWareSerial = 1,
@@ -234,12 +683,12 @@ private:
 	} ports;
 	using PortState = SerialPorts::PortState;
 
-	void_cb_t handler_cb;
-	sms_rx_cb_t sms_rx_cb;
-	sms_tx_cb_t sms_tx_cb;
-	sms_full_cb_t sms_full_cb;
-
-	String lastInterestedReply;
+	void_cb_t handler_cb = nullptr;
+	sms_rx_cb_t sms_rx_cb = nullptr;
+	sms_tx_cb_t sms_tx_cb = nullptr;
+	sms_full_cb_t sms_full_cb = nullptr;
+	sms_job_cb_t sms_job_cb = nullptr;
+	void* sms_job_ctx = nullptr;
 };
 
 #endif // !A6LIB_H
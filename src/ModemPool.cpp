@@ -0,0 +1,336 @@
+#include "A6lib.h"
+
+/* the pool is built only along with the background SMS queue it sends through */
+#if A6_ASYNC_SMS
+#include "ModemPool.h"
+#include "replyparser.h"
+
+///@cond INTERNAL
+#define NO_MODEM 0xFF
+#define UNKNOWN_LATENCY 1000 // ms, until AT+CMGS latency of a modem is measured
+///@endcond
+
+ModemPool::ModemPool() {
+
+}
+
+ModemPool::~ModemPool() {
+	for (uint8_t i = 0; i < members_len; i++)
+		delete members[i].modem;
+}
+
+/*!
+ * Add a modem to the pool, the pool owns the A6lib object of it.
+ * \param port the serial port modem is connected to
+ * \return the modem index in the pool, or -1 if the pool is full
+ */
+int8_t ModemPool::addModem(HardwareSerial* port) {
+	return members_len < A6_POOL_SIZE ? addModem(new A6lib(port)) : -1;
+}
+
+/*!
+ * Add a modem to the pool, the pool owns the A6lib object of it.
+ * \param port the serial port modem is connected to
+ * \return the modem index in the pool, or -1 if the pool is full
+ */
+int8_t ModemPool::addModem(SoftwareSerial* port) {
+	return members_len < A6_POOL_SIZE ? addModem(new A6lib(port)) : -1;
+}
+
+///@cond INTERNAL
+int8_t ModemPool::addModem(A6lib* modem) {
+	auto& m = members[members_len];
+	m.pool = this;
+	m.modem = modem;
+	m.index = members_len;
+	m.healthy = false;
+	m.status = RegisterStatus::Unknown;
+	m.failures = 0;
+	m.sent = m.failed = 0;
+	m.check = INVALID_CMD_HANDLE;
+	m.checked = 0;
+
+	return members_len++;
+}
+///@endcond
+
+/*!
+ * Get the number of modems in the pool.
+ */
+uint8_t ModemPool::size() const {
+	return members_len;
+}
+
+/*!
+ * Get the A6lib object of a modem, e.g to bring it up with A6lib::waitForNetwork() and A6lib::start() before ModemPool::begin().
+ * \param index the modem index in the pool
+ */
+A6lib& ModemPool::modem(uint8_t index) {
+	return *members[index].modem;
+}
+
+/*!
+ * Prepare the modems for pooled sending: each one is switched to SMSFormat::Format_PDU, its SCA is read
+ * and its registration is checked. Modems must be started already.
+ * \return the number of healthy modems
+ */
+uint8_t ModemPool::begin() {
+	uint8_t healthy = 0;
+	for (uint8_t i = 0; i < members_len; i++) {
+		auto& m = members[i];
+		m.modem->setAsyncSMSQueue(true);
+		m.modem->onQueuedSMSSent(&ModemPool::jobDone, &m);
+		m.status = m.modem->getRegisterStatus();
+		m.healthy = m.modem->setSMSFormat(Format_PDU) && m.modem->getSMSSca().length() &&
+			(m.status == Registered_HomeNetwork || m.status == Registered_Roaming);
+		m.failures = 0;
+		m.checked = millis();
+		if (m.healthy)
+			healthy++;
+	}
+
+	return healthy;
+}
+
+/*!
+ * The main handler of the pool, it needs to be called inside main loop regularly.
+ * It calls A6lib::handle() of every modem, checks their health and hands the waiting SMS to them.
+ */
+void ModemPool::handle() {
+	for (uint8_t i = 0; i < members_len; i++) {
+		members[i].modem->handle();
+		check(members[i]);
+	}
+	dispatch();
+}
+
+/*!
+ * Add an ASCII (or Latin-1) SMS to the pool, it's sent by the least loaded healthy modem.
+ * \param number the detination phone number which should begin with international code
+ * \param content the SMS content in ASCII or Latin-1
+ * \return the job id which is passed to the callback registered with ModemPool::onSMSSent(), or 0 if the pool is full
+ */
+uint16_t ModemPool::queueSMS(const String& number, const String& content) {
+	for (auto& job : jobs) {
+		if (job.state != Job_Free)
+			continue;
+
+		job.id = next_job++;
+		if (next_job == 0)
+			next_job = 1;
+		job.state = Job_Pending;
+		job.number = number;
+		job.content = content;
+		job.modem = NO_MODEM;
+		job.modem_job = 0;
+		job.attempts = 0;
+		return job.id;
+	}
+
+	return 0;
+}
+
+/*!
+ * Get the number of SMS in the pool which are not finished yet.
+ */
+uint16_t ModemPool::pending() const {
+	uint16_t n = 0;
+	for (const auto& job : jobs) {
+		if (job.state != Job_Free)
+			n++;
+	}
+
+	return n;
+}
+
+/*!
+ * Block until every SMS in the pool is finished. Once no SMS finished for \a timeout ms (e.g no modem is healthy),
+ * the SMS waiting in the pool are reported failed, the ones handed to a modem are waited for until modem finishes them.
+ * \param timeout ms without progress before the waiting SMS are given up
+ * \return the number of SMS sent successfully meanwhile
+ */
+int16_t ModemPool::flush(unsigned long timeout) {
+	const auto sent = jobs_sent;
+	auto done = jobs_done;
+	auto progress = millis();
+	while (pending()) {
+		yield();
+		handle();
+		if (done != jobs_done) {
+			done = jobs_done;
+			progress = millis();
+		} else if (millis() - progress >= timeout) {
+			for (auto& job : jobs) {
+				if (job.state == Job_Pending)
+					finishJob(job, false, 0);
+			}
+		}
+	}
+
+	return jobs_sent - sent;
+}
+
+/*!
+ * Get the state of a modem in the pool.
+ * \param index the modem index in the pool
+ * \param health receives the modem state
+ * \return false if there's no such modem
+ */
+bool ModemPool::getModemHealth(uint8_t index, ModemHealth* health) const {
+	if (index >= members_len || !health)
+		return false;
+
+	const auto& m = members[index];
+	CommandTiming timing;
+	health->healthy = m.healthy;
+	health->status = m.status;
+	health->queued = m.modem->queuedSMS();
+	health->latency = m.modem->getCommandTiming("+CMGS", &timing) ? timing.latency : 0;
+	health->failures = m.failures;
+	health->sent = m.sent;
+	health->failed = m.failed;
+
+	return true;
+}
+
+/*!
+ * This function will register your callback and will call it for each SMS of the pool once it's finished.
+ * The callback gets the job id, the index of the modem which sent it (last tried it on failure), whether it was sent
+ * and the message reference of its (last) part from +CMGS.
+ * \param cb pointer to callback function
+ */
+void ModemPool::onSMSSent(pool_job_cb_t cb) {
+	job_cb = cb;
+}
+
+///@cond INTERNAL
+/* ask modem its registration status without blocking, a modem which doesn't answer is unhealthy */
+void ModemPool::check(Member& m) {
+	if (m.check != INVALID_CMD_HANDLE) {
+		const auto state = m.modem->commandState(m.check);
+		if (state == Cmd_Queued || state == Cmd_Waiting)
+			return;
+
+		m.check = INVALID_CMD_HANDLE;
+		m.checked = millis();
+		Span line, fields[2];
+		int32_t status;
+		if (state != Cmd_Success || !findLine(Span{ m.reply.c_str(), static_cast<uint16_t>(m.reply.length()) }, "+CREG:", &line) ||
+			splitFields(line, fields, 2) != 2 || !parseInt(fields[1], &status)) {
+			m.healthy = false;
+			m.status = RegisterStatus::Unknown;
+			return;
+		}
+		m.status = static_cast<RegisterStatus>(status);
+		const auto registered = m.status == Registered_HomeNetwork || m.status == Registered_Roaming;
+		if (registered && !m.healthy)
+			m.failures = 0;
+		m.healthy = registered;
+		return;
+	}
+
+	const unsigned long interval = m.healthy ? A6_POOL_CHECK_INTERVAL : A6_POOL_RECOVER_INTERVAL;
+	if (millis() - m.checked >= interval)
+		m.check = m.modem->submitRegisterStatus(&m.reply);
+}
+
+/* hand the waiting SMS to modems, oldest first */
+void ModemPool::dispatch() {
+	for (;;) {
+		Job* oldest = nullptr;
+		for (auto& job : jobs) {
+			if (job.state == Job_Pending && (!oldest || (int16_t)(job.id - oldest->id) < 0))
+				oldest = &job;
+		}
+		if (!oldest)
+			return;
+
+		const auto index = pickModem(oldest->modem);
+		if (index < 0)
+			return;
+
+		auto& m = members[index];
+		const auto modem_job = m.modem->queueSMS(oldest->number, oldest->content);
+		if (!modem_job)
+			return;
+
+		oldest->state = Job_Assigned;
+		oldest->modem = index;
+		oldest->modem_job = modem_job;
+		next_modem = (index + 1) % members_len;
+	}
+}
+
+/* the healthy modem with room and the shortest expected wait, the one a SMS failed on is the last resort */
+int8_t ModemPool::pickModem(uint8_t avoid) const {
+	int8_t best = -1;
+	uint32_t best_wait = 0;
+	bool best_avoided = false;
+	for (uint8_t n = 0; n < members_len; n++) {
+		const uint8_t i = (next_modem + n) % members_len;
+		const auto& m = members[i];
+		if (!m.healthy || m.modem->queuedSMS() >= A6_POOL_MODEM_DEPTH)
+			continue;
+
+		const auto wait = expectedWait(m);
+		const auto avoided = i == avoid;
+		if (best < 0 || (best_avoided && !avoided) || (avoided == best_avoided && wait < best_wait)) {
+			best = i;
+			best_wait = wait;
+			best_avoided = avoided;
+		}
+	}
+
+	return best;
+}
+
+uint32_t ModemPool::expectedWait(const Member& m) const {
+	CommandTiming timing;
+	const uint32_t latency = m.modem->getCommandTiming("+CMGS", &timing) && timing.samples ? timing.latency + 1 : UNKNOWN_LATENCY;
+
+	return (m.modem->queuedSMS() + 1UL) * latency;
+}
+
+void ModemPool::finishJob(Job& job, bool sent, uint8_t mr) {
+	const auto id = job.id;
+	const int8_t modem = job.modem;
+	job.state = Job_Free;
+	job.number = String();
+	job.content = String();
+	if (sent)
+		jobs_sent++;
+	jobs_done++;
+	if (job_cb)
+		job_cb(id, modem, sent, mr);
+}
+
+/* a modem finished a SMS, a failed one goes back to the pool to be tried on another modem */
+void ModemPool::jobDone(uint16_t modem_job, bool sent, uint8_t mr, void* ctx) {
+	auto& m = *static_cast<Member*>(ctx);
+	auto pool = m.pool;
+	for (auto& job : pool->jobs) {
+		if (job.state != Job_Assigned || job.modem != m.index || job.modem_job != modem_job)
+			continue;
+
+		if (sent) {
+			m.failures = 0;
+			m.sent++;
+			pool->finishJob(job, true, mr);
+			return;
+		}
+
+		m.failed++;
+		if (++m.failures >= A6_POOL_MAX_FAILURES && m.healthy) {
+			/* don't wait for the next check, the modem answers one to get back in rotation */
+			m.healthy = false;
+			m.checked = millis();
+		}
+		if (++job.attempts >= A6_POOL_MAX_ATTEMPTS)
+			pool->finishJob(job, false, 0);
+		else
+			job.state = Job_Pending;
+		return;
+	}
+}
+///@endcond
+#endif
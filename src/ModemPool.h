@@ -0,0 +1,140 @@
+#ifndef MODEMPOOL_H
+#define MODEMPOOL_H
+
+#include "A6lib.h"
+
+#if !A6_ASYNC_SMS
+#	error "ModemPool sends through the background SMS queue, it needs A6_ASYNC_SMS"
+#endif
+
+/* number of modems a pool can hold */
+#ifndef A6_POOL_SIZE
+#	ifdef __AVR__
+#		define A6_POOL_SIZE 2
+#	else
+#		define A6_POOL_SIZE 8
+#	endif
+#endif
+/* number of SMS the pool can hold until they're sent */
+#ifndef A6_POOL_QUEUE_SIZE
+#	ifdef __AVR__
+#		define A6_POOL_QUEUE_SIZE 8
+#	else
+#		define A6_POOL_QUEUE_SIZE 64
+#	endif
+#endif
+/* number of SMS handed to a modem at once, the rest wait in the pool for whichever modem gets free first */
+#ifndef A6_POOL_MODEM_DEPTH
+#	define A6_POOL_MODEM_DEPTH 2
+#endif
+/* ms between registration checks of a healthy modem */
+#ifndef A6_POOL_CHECK_INTERVAL
+#	define A6_POOL_CHECK_INTERVAL 30000
+#endif
+/* ms between checks of an unhealthy modem, it's back in rotation once it answers registered */
+#ifndef A6_POOL_RECOVER_INTERVAL
+#	define A6_POOL_RECOVER_INTERVAL 3000
+#endif
+/* consecutive failed SMS after which a modem is taken out of rotation */
+#ifndef A6_POOL_MAX_FAILURES
+#	define A6_POOL_MAX_FAILURES 2
+#endif
+/* ms ModemPool::flush() waits without any SMS finishing before it fails the SMS no modem took */
+#ifndef A6_POOL_FLUSH_TIMEOUT
+#	define A6_POOL_FLUSH_TIMEOUT 30000
+#endif
+/* number of modems a SMS is tried on before it's reported failed */
+#ifndef A6_POOL_MAX_ATTEMPTS
+#	define A6_POOL_MAX_ATTEMPTS 3
+#endif
+
+/*!
+ * The state of a modem in a ModemPool (see ModemPool::getModemHealth()).
+ */
+struct ModemHealth {
+	bool healthy; /* it's given new SMS */
+	RegisterStatus status; /* network registration of the last check */
+	uint8_t queued; /* SMS handed to the modem, not finished yet */
+	uint16_t latency; /* smoothed latency of AT+CMGS in ms, 0 if not measured yet */
+	uint8_t failures; /* consecutive failed SMS */
+	uint16_t sent;
+	uint16_t failed;
+};
+
+typedef void(*pool_job_cb_t)(uint16_t job, int8_t modem, bool sent, uint8_t mr);
+
+/*!
+ * A set of modems which share the outbound SMS. Each SMS goes to the least loaded healthy modem, it's
+ * the one with the shortest expected wait: (SMS queued on it + 1) * its AT+CMGS latency. Modems send in the background
+ * (see A6lib::setAsyncSMSQueue()), so they all make progress from a single ModemPool::handle() loop.
+ * A modem is taken out of rotation when it's not registered or it fails A6_POOL_MAX_FAILURES SMS in a row,
+ * its failed SMS are tried on the other modems.
+ */
+class ModemPool {
+public:
+	ModemPool();
+	~ModemPool();
+	/* the pool owns its modems */
+	ModemPool(const ModemPool&) = delete;
+	ModemPool& operator=(const ModemPool&) = delete;
+
+	int8_t addModem(HardwareSerial* port);
+	int8_t addModem(SoftwareSerial* port);
+	uint8_t size() const;
+	A6lib& modem(uint8_t index);
+
+	uint8_t begin();
+	void handle();
+	uint16_t queueSMS(const String& number, const String& content);
+	uint16_t pending() const;
+	int16_t flush(unsigned long timeout = A6_POOL_FLUSH_TIMEOUT);
+	bool getModemHealth(uint8_t index, ModemHealth* health) const;
+	void onSMSSent(pool_job_cb_t cb);
+
+private:
+	struct Member {
+		ModemPool* pool;
+		A6lib* modem;
+		uint8_t index;
+		bool healthy;
+		RegisterStatus status;
+		uint8_t failures;
+		uint16_t sent, failed;
+		cmd_handle_t check; /* AT+CREG? in flight */
+		unsigned long checked; /* when the last check finished */
+		String reply;
+	};
+	Member members[A6_POOL_SIZE];
+	uint8_t members_len = 0;
+
+	enum JobState {
+		Job_Free = 0,
+		Job_Pending, /* waiting in the pool */
+		Job_Assigned, /* handed to a modem */
+	};
+	struct Job {
+		uint16_t id = 0;
+		JobState state = Job_Free;
+		String number;
+		String content;
+		uint8_t modem; /* the modem it's assigned to or it failed on last */
+		uint16_t modem_job; /* the job id in modem queue */
+		uint8_t attempts;
+	};
+	Job jobs[A6_POOL_QUEUE_SIZE];
+	uint16_t next_job = 1;
+	uint8_t next_modem = 0; /* ties go round robin from here */
+	uint16_t jobs_sent = 0;
+	uint16_t jobs_done = 0; /* sent or failed, it tells flush() the pool makes progress */
+	pool_job_cb_t job_cb = nullptr;
+
+	int8_t addModem(A6lib* modem);
+	void check(Member& m);
+	void dispatch();
+	int8_t pickModem(uint8_t avoid) const;
+	uint32_t expectedWait(const Member& m) const;
+	void finishJob(Job& job, bool sent, uint8_t mr);
+	static void jobDone(uint16_t job, bool sent, uint8_t mr, void* ctx);
+};
+
+#endif // !MODEMPOOL_H
@@ -21,190 +21,992 @@
 
 #define HEX(arg) (uint8_t)(arg - 48)
 
-/* 
-	reverse every 2 char of string <in> of size <len>, to hex <out> 
-	e.g in: "1234" out: 0x21 0x43
-*/
-bool str_reverse(const char* in, uint8_t len, uint8_t* out) {
-	if (in == NULL || out == NULL || len == 0)
-		return false;
+/* 64-bit shifts are expensive on 8-bit AVR, it keeps the septet at a time loops */
+#ifndef PDU_WORD_KERNELS
+#	ifdef __AVR__
+#		define PDU_WORD_KERNELS 0
+#	else
+#		define PDU_WORD_KERNELS 1
+#	endif
+#endif
 
-	for (uint8_t i = 0; i < len;) {
-		uint8_t f = HEX(in[i++]);
-		uint8_t s = HEX(in[i++]) << 4;
-		*out++ = s | f;
-	}
+#if PDU_WORD_KERNELS
+/* <len> bytes as a little endian word, whatever the host byte order is */
+static inline uint64_t load_word(const void* in, uint8_t len) {
+	uint64_t w = 0;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	memcpy(&w, in, len);
+#else
+	for (uint8_t i = 0; i < len; i++)
+		w |= (uint64_t)((const uint8_t*)in)[i] << (i * 8);
+#endif
+	return w;
+}
 
-	return true;
+static inline void store_word(uint64_t w, void* out, uint8_t len) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	memcpy(out, &w, len);
+#else
+	for (uint8_t i = 0; i < len; i++)
+		((uint8_t*)out)[i] = (uint8_t)(w >> (i * 8));
+#endif
 }
 
-/* convert input ASCII string to 7-bit GSM alphabet */
-int ascii_to_gsm(const char* in, uint8_t len, uint8_t* out) {
-	if (in == NULL || out == NULL || len == 0)
-		return -1;
+/* pack 8 septets into 7 octets: septet i goes to bits 7i..7i+6, lanes are merged pairwise 8 -> 4 -> 2 -> 1 */
+static void pack_word(const char* in, uint8_t* out) {
+	uint64_t w = load_word(in, 8);
 
-	uint8_t bytes_written = 0;
-	uint16_t bit_count = 0;
-	uint16_t bit_queue = 0;
+	w &= 0x7F7F7F7F7F7F7F7FULL;
+	w = ((w >> 1) & 0x3F803F803F803F80ULL) | (w & 0x007F007F007F007FULL);
+	w = ((w >> 2) & 0x0FFFC0000FFFC000ULL) | (w & 0x00003FFF00003FFFULL);
+	w = ((w >> 4) & 0x00FFFFFFF0000000ULL) | (w & 0x000000000FFFFFFFULL);
+
+	store_word(w, out, 7);
+}
+
+/* unpack 7 octets into 8 septets, the reverse of pack_word(). it reads 8 octets, the last one is dropped */
+static void unpack_word(const uint8_t* in, char* out) {
+	uint64_t w = load_word(in, 8) & 0x00FFFFFFFFFFFFFFULL;
+
+	w = ((w & 0x00FFFFFFF0000000ULL) << 4) | (w & 0x000000000FFFFFFFULL);
+	w = ((w & 0x0FFFC0000FFFC000ULL) << 2) | (w & 0x00003FFF00003FFFULL);
+	w = ((w & 0x3F803F803F803F80ULL) << 1) | (w & 0x007F007F007F007FULL);
+
+	store_word(w, out, 8);
+}
+
+/* 0x80 in each byte of <w> which is 0 */
+static inline uint64_t zero_bytes(uint64_t w) {
+	return ~(((w & 0x7F7F7F7F7F7F7F7FULL) + 0x7F7F7F7F7F7F7F7FULL) | w | 0x7F7F7F7F7F7F7F7FULL);
+}
+
+/*
+	true if all 8 chars of <w> are their own GSM code (see gsm_same_as_ascii, only '\n' and '\r' are left to the table):
+	0x20-0x3F except '$', and 0x40-0x7F whose low 5 bits are 1-26 (letters)
+*/
+static inline bool gsm_ascii_word(uint64_t w) {
+	const uint64_t low5 = w & 0x1F1F1F1F1F1F1F1FULL;
+	const uint64_t high = (w << 1) & 0x8080808080808080ULL; // 0x40 bit of each byte
+	const uint64_t bad = (w & 0x8080808080808080ULL) | // not ASCII
+		((w - 0x2020202020202020ULL) & ~w & 0x8080808080808080ULL) | // control chars
+		zero_bytes(w ^ 0x2424242424242424ULL) | // '$'
+		((zero_bytes(low5) | ((low5 + 0x6565656565656565ULL) & 0x8080808080808080ULL)) & high); // '@', '[' to '`', '{' to DEL
+	return bad == 0;
+}
+#endif
+
+/* pack septets one at a time through a bit queue, only whole octets are written */
+static uint8_t* pack_bits(const char* in, uint8_t len, uint16_t* bit_queue, uint8_t* bit_count, uint8_t* out) {
 	while (len--) {
-		bit_queue |= (*in & 0x7F) << bit_count;
-		bit_count += 7;
-		if (bit_count >= 8) {
-			*out++ = (uint8_t)bit_queue;
-			bytes_written++;
-			bit_count -= 8;
-			bit_queue >>= 8;
+		*bit_queue |= (*in & 0x7F) << *bit_count;
+		*bit_count += 7;
+		if (*bit_count >= 8) {
+			*out++ = (uint8_t)*bit_queue;
+			*bit_count -= 8;
+			*bit_queue >>= 8;
 		}
 		in++;
 	}
 
-	if (bit_count > 0) {
+	return out;
+}
+
+/* pack 7-bit GSM chars of <in>, after <fill_bits> zero bits */
+int pdu_pack_septets(const char* in, uint8_t len, uint8_t fill_bits, uint8_t* out) {
+	if (len == 0)
+		return 0;
+
+	const uint8_t* begin = out;
+	uint16_t bit_queue = 0;
+	uint8_t bit_count = fill_bits;
+#if PDU_WORD_KERNELS
+	/* the fill bits are used up after as many septets, from there every 8 septets fill 7 octets */
+	const uint8_t head = fill_bits < len ? fill_bits : len;
+	out = pack_bits(in, head, &bit_queue, &bit_count, out);
+	in += head;
+	len -= head;
+	if (bit_count == 0) {
+		for (; len >= 8; len -= 8, in += 8, out += 7)
+			pack_word(in, out);
+	}
+#endif
+	out = pack_bits(in, len, &bit_queue, &bit_count, out);
+
+	if (bit_count > 0)
 		*out++ = (uint8_t)bit_queue;
-		bytes_written++;
+
+	return out - begin;
+}
+
+/* the alphabet tables stay in flash on AVR */
+#ifdef __AVR__
+#	include <avr/pgmspace.h>
+#	define GSM_READ_BYTE(addr) pgm_read_byte(addr)
+#	define GSM_READ_WORD(addr) pgm_read_word(addr)
+#else
+#	ifndef PROGMEM
+#		define PROGMEM
+#	endif
+#	define GSM_READ_BYTE(addr) (*(addr))
+#	define GSM_READ_WORD(addr) (*(addr))
+#endif
+
+#define GSM_ESC 0x1B
+#define GSM_NONE 0xFF
+
+/* GSM 03.38 default alphabet -> unicode, ESC (0x1B) on its own reads as a no-break space */
+static const uint16_t gsm_default[128] PROGMEM = {
+	0x0040, 0x00A3, 0x0024, 0x00A5, 0x00E8, 0x00E9, 0x00F9, 0x00EC,
+	0x00F2, 0x00C7, 0x000A, 0x00D8, 0x00F8, 0x000D, 0x00C5, 0x00E5,
+	0x0394, 0x005F, 0x03A6, 0x0393, 0x039B, 0x03A9, 0x03A0, 0x03A8,
+	0x03A3, 0x0398, 0x039E, 0x00A0, 0x00C6, 0x00E6, 0x00DF, 0x00C9,
+	0x0020, 0x0021, 0x0022, 0x0023, 0x00A4, 0x0025, 0x0026, 0x0027,
+	0x0028, 0x0029, 0x002A, 0x002B, 0x002C, 0x002D, 0x002E, 0x002F,
+	0x0030, 0x0031, 0x0032, 0x0033, 0x0034, 0x0035, 0x0036, 0x0037,
+	0x0038, 0x0039, 0x003A, 0x003B, 0x003C, 0x003D, 0x003E, 0x003F,
+	0x00A1, 0x0041, 0x0042, 0x0043, 0x0044, 0x0045, 0x0046, 0x0047,
+	0x0048, 0x0049, 0x004A, 0x004B, 0x004C, 0x004D, 0x004E, 0x004F,
+	0x0050, 0x0051, 0x0052, 0x0053, 0x0054, 0x0055, 0x0056, 0x0057,
+	0x0058, 0x0059, 0x005A, 0x00C4, 0x00D6, 0x00D1, 0x00DC, 0x00A7,
+	0x00BF, 0x0061, 0x0062, 0x0063, 0x0064, 0x0065, 0x0066, 0x0067,
+	0x0068, 0x0069, 0x006A, 0x006B, 0x006C, 0x006D, 0x006E, 0x006F,
+	0x0070, 0x0071, 0x0072, 0x0073, 0x0074, 0x0075, 0x0076, 0x0077,
+	0x0078, 0x0079, 0x007A, 0x00E4, 0x00F6, 0x00F1, 0x00FC, 0x00E0,
+};
+
+/* GSM 03.38 extension table, each char is sent as ESC followed by its code */
+static const struct {
+	uint8_t code;
+	uint16_t unicode;
+} gsm_extension[] PROGMEM = {
+	{ 0x0A, 0x000C }, { 0x14, 0x005E }, { 0x28, 0x007B }, { 0x29, 0x007D }, { 0x2F, 0x005C },
+	{ 0x3C, 0x005B }, { 0x3D, 0x007E }, { 0x3E, 0x005D }, { 0x40, 0x007C }, { 0x65, 0x20AC },
+};
+
+/* ASCII -> GSM code, 0x80 | code for the extension table ones and GSM_NONE for '`', DEL and most control chars */
+static const uint8_t ascii_gsm[128] PROGMEM = {
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x0A, 0xFF, 0x8A, 0x0D, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0x20, 0x21, 0x22, 0x23, 0x02, 0x25, 0x26, 0x27, 0x28, 0x29, 0x2A, 0x2B, 0x2C, 0x2D, 0x2E, 0x2F,
+	0x30, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x3B, 0x3C, 0x3D, 0x3E, 0x3F,
+	0x00, 0x41, 0x42, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49, 0x4A, 0x4B, 0x4C, 0x4D, 0x4E, 0x4F,
+	0x50, 0x51, 0x52, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5A, 0xBC, 0xAF, 0xBE, 0x94, 0x11,
+	0xFF, 0x61, 0x62, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6A, 0x6B, 0x6C, 0x6D, 0x6E, 0x6F,
+	0x70, 0x71, 0x72, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7A, 0xA8, 0xC0, 0xA9, 0xBD, 0xFF,
+};
+
+/* ASCII chars which are their own GSM code, a bit each */
+static const uint8_t gsm_same_as_ascii[16] PROGMEM = {
+	0x00, 0x24, 0x00, 0x00, 0xEF, 0xFF, 0xFF, 0xFF, 0xFE, 0xFF, 0xFF, 0x07, 0xFE, 0xFF, 0xFF, 0x07,
+};
+
+static inline bool is_gsm_ascii(uint8_t c) {
+	return c < 0x80 && (GSM_READ_BYTE(&gsm_same_as_ascii[c >> 3]) >> (c & 7)) & 1;
+}
+
+/* the number of leading chars of <in> (up to <len>) which are their own GSM code */
+static uint8_t gsm_ascii_run(const char* in, uint8_t len) {
+	uint8_t run = 0;
+#if PDU_WORD_KERNELS
+	while (run + 8 <= len && gsm_ascii_word(load_word(in + run, 8)))
+		run += 8;
+#endif
+	while (run < len && is_gsm_ascii(in[run]))
+		run++;
+
+	return run;
+}
+
+/* GSM code(s) of unicode char <c> into <out>, return the number of septets it takes (2 for the extension table) or 0 if it has none */
+static inline uint8_t gsm_encode_char(uint32_t c, uint8_t* out) {
+	uint8_t code = GSM_NONE;
+	if (c < 0x80) {
+		code = GSM_READ_BYTE(&ascii_gsm[c]);
+	} else if (c == 0x20AC) { // the only non ASCII char of extension table
+		code = 0x80 | 0x65;
+	} else if (c < 0x400) { // Latin-1 and Greek
+		for (uint8_t i = 0; i < 128; i++) {
+			if (i != GSM_ESC && GSM_READ_WORD(&gsm_default[i]) == c) {
+				code = i;
+				break;
+			}
+		}
+	}
+
+	if (code == GSM_NONE)
+		return 0;
+	if (code & 0x80) {
+		out[0] = GSM_ESC;
+		out[1] = code & 0x7F;
+		return 2;
 	}
+	out[0] = code;
 
-	return bytes_written;
+	return 1;
 }
 
-int pdu_encode(const char* sca, const char* phone, const char* text, uint8_t text_len, uint8_t* pdu, uint8_t pdu_size) {
-	if (sca == NULL || phone == NULL || text == NULL || pdu == NULL || pdu_size < PDU_MIN_LEN)
+/* unicode char of the GSM code(s) at <pos> of <in>, <pos> is moved past them */
+static uint16_t gsm_decode_char(const char* in, uint8_t len, uint8_t* pos) {
+	const uint8_t code = in[(*pos)++] & 0x7F;
+	if (code != GSM_ESC || *pos == len)
+		return GSM_READ_WORD(&gsm_default[code]);
+
+	/* an unknown extension reads as the default char of its code */
+	const uint8_t ext = in[(*pos)++] & 0x7F;
+	for (uint8_t i = 0; i < sizeof(gsm_extension) / sizeof(gsm_extension[0]); i++) {
+		if (GSM_READ_BYTE(&gsm_extension[i].code) == ext)
+			return GSM_READ_WORD(&gsm_extension[i].unicode);
+	}
+
+	return GSM_READ_WORD(&gsm_default[ext]);
+}
+
+#define BAD_CHAR 0xFFFFFFFFUL
+
+/* decode the UTF-8 sequence at <pos>, BAD_CHAR if it's truncated, overlong, a surrogate or beyond U+10FFFF */
+static inline uint32_t next_utf8(const uint8_t* in, uint16_t len, uint16_t* pos) {
+	const uint8_t lead = in[(*pos)++];
+	if (lead < 0x80)
+		return lead;
+
+	uint8_t more;
+	uint32_t c;
+	uint32_t min;
+	if ((lead & 0xE0) == 0xC0) {
+		more = 1;
+		c = lead & 0x1F;
+		min = 0x80;
+	} else if ((lead & 0xF0) == 0xE0) {
+		more = 2;
+		c = lead & 0x0F;
+		min = 0x800;
+	} else if ((lead & 0xF8) == 0xF0) {
+		more = 3;
+		c = lead & 0x07;
+		min = 0x10000;
+	} else { // a continuation byte or 0xF8-0xFF
+		return BAD_CHAR;
+	}
+
+	for (; more; more--) {
+		if (*pos == len || (in[*pos] & 0xC0) != 0x80)
+			return BAD_CHAR;
+		c = (c << 6) | (in[(*pos)++] & 0x3F);
+	}
+	if (c < min || c > 0x10FFFF || (c >= 0xD800 && c <= 0xDFFF))
+		return BAD_CHAR;
+
+	return c;
+}
+
+/* the next char of <text> at <pos> (a surrogate pair is a single char), <pos> is moved past it */
+static inline uint32_t next_char(const pdu_text_t* text, uint16_t* pos) {
+	if (text->format == PDU_TEXT_UTF8)
+		return next_utf8((const uint8_t*)text->data, text->len, pos);
+	if (text->format == PDU_TEXT_UCS2) {
+		const uint16_t* w = (const uint16_t*)text->data;
+		uint32_t c = w[(*pos)++];
+		if (c >= 0xD800 && c <= 0xDBFF && *pos < text->len && w[*pos] >= 0xDC00 && w[*pos] <= 0xDFFF)
+			c = 0x10000 + ((c - 0xD800) << 10) + (w[(*pos)++] - 0xDC00);
+		return c;
+	}
+
+	return ((const uint8_t*)text->data)[(*pos)++];
+}
+
+/* the number of UCS2 chars the next char of <text> takes (2 for a surrogate pair), 0 if it's not valid UTF-8 */
+static inline uint8_t next_units(const pdu_text_t* text, uint16_t* pos) {
+	const uint16_t i = *pos;
+	if (text->format == PDU_TEXT_LATIN1) {
+		*pos = i + 1;
+		return 1;
+	}
+	if (text->format == PDU_TEXT_UTF8) {
+		/* ASCII and 2 byte sequences take the short way */
+		const uint8_t* in = (const uint8_t*)text->data;
+		if (in[i] < 0x80) {
+			*pos = i + 1;
+			return 1;
+		}
+		if (in[i] >= 0xC2 && in[i] < 0xE0 && i + 1 < text->len && (in[i + 1] & 0xC0) == 0x80) {
+			*pos = i + 2;
+			return 1;
+		}
+	}
+
+	const uint32_t c = next_char(text, pos);
+	return c == BAD_CHAR ? 0 : c >= 0x10000 ? 2 : 1;
+}
+
+/* translate up to <max> septets of <text> from <pos> into GSM codes, a char which has none becomes '?' */
+static int text_to_gsm(const pdu_text_t* text, uint16_t* pos, uint8_t max, char* out) {
+	/* ASCII is the same in both 8-bit formats */
+	const uint8_t* bytes = text->format != PDU_TEXT_UCS2 ? (const uint8_t*)text->data : NULL;
+	const uint16_t len = text->len;
+	uint16_t i = *pos;
+	uint8_t n = 0;
+	while (i < len) {
+		/* a char of default table takes the short way */
+		const uint8_t c = bytes && bytes[i] < 0x80 ? GSM_READ_BYTE(&ascii_gsm[bytes[i]]) : GSM_NONE;
+		if (c < 0x80) {
+			if (n == max)
+				break;
+			out[n++] = c;
+			i++;
+			continue;
+		}
+
+		uint16_t next = i;
+		const uint32_t unicode = next_char(text, &next);
+		if (unicode == BAD_CHAR)
+			return PDU_MALFORMED_ERR;
+
+		uint8_t code[2];
+		uint8_t septets = gsm_encode_char(unicode, code);
+		if (septets == 0) {
+			code[0] = '?';
+			septets = 1;
+		}
+		if (n + septets > max) // an escape is never split from its char
+			break;
+
+		out[n++] = code[0];
+		if (septets == 2)
+			out[n++] = code[1];
+		i = next;
+	}
+	*pos = i;
+
+	return n;
+}
+
+/*
+	the same as text_to_gsm(), but the leading chars which are their own GSM code (plain ASCII) aren't translated.
+	if that's all of them, <septets> points into <text> itself, otherwise to <buff> which gets the translation
+*/
+static int text_septets(const pdu_text_t* text, uint16_t* pos, uint8_t max, char* buff, const char** septets) {
+	uint8_t run = 0;
+	if (text->format != PDU_TEXT_UCS2) {
+		const char* in = (const char*)text->data + *pos;
+		const uint8_t limit = text->len - *pos < max ? text->len - *pos : max;
+		run = gsm_ascii_run(in, limit);
+		*pos += run;
+		if (run == limit) {
+			*septets = in;
+			return run;
+		}
+		memcpy(buff, in, run);
+	}
+
+	*septets = buff;
+	const int n = text_to_gsm(text, pos, max - run, buff + run);
+	return n < 0 ? n : run + n;
+}
+
+/* write up to <max> UCS2 chars of <text> from <pos> in big endian, a char outside BMP takes a surrogate pair which is never split */
+static int text_to_ucs2(const pdu_text_t* text, uint16_t* pos, uint8_t max, uint8_t* out) {
+	const uint16_t* ucs2 = text->format == PDU_TEXT_UCS2 ? (const uint16_t*)text->data : NULL;
+	const uint8_t* utf8 = text->format == PDU_TEXT_UTF8 ? (const uint8_t*)text->data : NULL;
+	const uint16_t len = text->len;
+	uint16_t i = *pos;
+	uint8_t n = 0;
+	while (i < len && n < max) {
+		/* UCS2 text is copied as is, unless it's a surrogate pair */
+		if (ucs2 && (ucs2[i] < 0xD800 || ucs2[i] > 0xDBFF)) {
+			out[n * 2] = ucs2[i] >> 8;
+			out[n * 2 + 1] = ucs2[i];
+			n++;
+			i++;
+			continue;
+		}
+		/* as well as UTF-8 ASCII and 2 byte sequences */
+		if (utf8 && utf8[i] < 0x80) {
+			out[n * 2] = 0;
+			out[n * 2 + 1] = utf8[i];
+			n++;
+			i++;
+			continue;
+		}
+		if (utf8 && utf8[i] >= 0xC2 && utf8[i] < 0xE0 && i + 1 < len && (utf8[i + 1] & 0xC0) == 0x80) {
+			out[n * 2] = (utf8[i] >> 2) & 0x07;
+			out[n * 2 + 1] = (utf8[i] << 6) | (utf8[i + 1] & 0x3F);
+			n++;
+			i += 2;
+			continue;
+		}
+
+		uint16_t next = i;
+		uint32_t c = next_char(text, &next);
+		if (c == BAD_CHAR)
+			return PDU_MALFORMED_ERR;
+		if (c >= 0x10000) {
+			if (n + 2 > max)
+				break;
+			c -= 0x10000;
+			const uint16_t high = 0xD800 + (c >> 10);
+			out[n * 2] = high >> 8;
+			out[n * 2 + 1] = high;
+			n++;
+			c = 0xDC00 + (c & 0x3FF);
+		}
+		out[n * 2] = c >> 8;
+		out[n * 2 + 1] = c;
+		n++;
+		i = next;
+	}
+	*pos = i;
+
+	return n;
+}
+
+/* convert input ASCII (or Latin-1) string to 7-bit GSM alphabet */
+int ascii_to_gsm(const char* in, uint8_t len, uint8_t* out) {
+	if (in == NULL || out == NULL || len == 0)
+		return -1;
+
+	const pdu_text_t text = { in, len, PDU_TEXT_LATIN1 };
+	uint16_t pos = 0;
+	char buff[GSM_CODING_MAX_CHAR];
+	const char* septets;
+	const int n = text_septets(&text, &pos, sizeof(buff), buff, &septets);
+	if (pos < len)
 		return PDU_INVALID_ARG_ERR;
 
-	uint8_t indx = 0;
-	
-	uint8_t sca_len = strlen(sca);
-	if (sca_len == 0)
+	return pdu_pack_septets(septets, n, 0, out);
+}
+
+/*
+	encode international <addr> as length, type of address and swapped digits
+	e.g "12345" -> 0x05 0x91 0x21 0x43 0xF5, SCA length is in octets and DA length in digits
+*/
+static int encode_address(const char* addr, bool is_sca, uint8_t* out) {
+	const uint8_t len = strlen(addr);
+	if (len == 0 || len > PDU_ADDR_MAX_LEN)
 		return PDU_INVALID_ARG_ERR;
-	
-	char *r_sca = malloc(sca_len + 2);
-	if (r_sca == NULL)
-		return PDU_UNEXPECTED_ERR;
-
-	memcpy(r_sca, sca, sca_len);
-	r_sca[sca_len + 1] = 0;
-	if (sca_len % 2 == 0) { // no fill bits
-		r_sca[sca_len] = 0;
-		pdu[indx++] = sca_len / 2 + 1;
-		pdu[indx++] = 0x91; // type of address
-		str_reverse(r_sca, sca_len, pdu + indx);
-		indx += sca_len / 2;
-	} else { // append fill bits
-		r_sca[sca_len] = 63; // 63 - 48 = 0x0F
-		pdu[indx++] = sca_len / 2 + 2;
-		pdu[indx++] = 0x91; // type of address
-		str_reverse(r_sca, sca_len + 1, pdu + indx);
-		indx += (sca_len + 1) / 2;
-	}
-	free(r_sca);
-	pdu[indx++] = 0x11; // pdu type
-	pdu[indx++] = 0x00;
+
+	uint8_t indx = 0;
+	out[indx++] = is_sca ? (len + 1) / 2 + 1 : len;
+	out[indx++] = PDU_TOA_INTERNATIONAL;
+	for (uint8_t i = 0; i < len; i += 2) {
+		const uint8_t f = HEX(addr[i]);
+		const uint8_t s = i + 1 < len ? HEX(addr[i + 1]) : 0x0F; // fill bits
+		out[indx++] = (s << 4) | f;
+	}
+
+	return indx;
+}
+
+/* encode SMS-SUBMIT up to (excluding) TP-UDL */
+static int encode_submit_header(const char* sca, const char* phone, bool udhi, uint8_t dcs, uint8_t* pdu) {
+	uint8_t indx = 0;
+	int n = encode_address(sca, true, pdu + indx);
+	if (n < 0)
+		return n;
+	indx += n;
+
+	pdu[indx++] = udhi ? 0x51 : 0x11; // pdu type, TP-UDHI if there's a header
+	pdu[indx++] = 0x00; // TP-MR
 
 	/* build DA into PDU */
-	uint8_t phone_len = strlen(phone);
-	if (phone_len == 0)
-		return PDU_INVALID_ARG_ERR;
+	n = encode_address(phone, false, pdu + indx);
+	if (n < 0)
+		return n;
+	indx += n;
 
-	char* r_phone = malloc(phone_len + 2);
-	if (r_phone == NULL)
-		return PDU_UNEXPECTED_ERR;
-
-	memcpy(r_phone, phone, phone_len);
-	r_phone[phone_len + 1] = 0;
-	if (phone_len % 2 == 0) { // no fill bits
-		r_phone[phone_len] = 0;
-		pdu[indx++] = phone_len;
-		pdu[indx++] = 0x91; // type of address
-		str_reverse(r_phone, phone_len, pdu + indx);
-		indx += phone_len / 2;
-	} else { // append fill bits
-		r_phone[phone_len] = 63; // 63 - 48 = 0x0F
-		pdu[indx++] = phone_len;
-		pdu[indx++] = 0x91; // type of address
-		str_reverse(r_phone, phone_len + 1, pdu + indx);
-		indx += (phone_len + 1) / 2;
-	}
-	free(r_phone);
 	pdu[indx++] = 0x00; // TP-PID
-	pdu[indx++] = 0x00; // DCS -> defualt GSM alphabet
+	pdu[indx++] = dcs;
 	pdu[indx++] = 0x81; // TP-VP -> 0x81 * 5min
-	pdu[indx++] = text_len; // UDHL -> number of chars
 
-	/* convert text from ASCII to GSM alphabet representation */
-	int octets = ascii_to_gsm(text, text_len, pdu + indx);
-	indx += octets;
+	return indx;
+}
+
+/* write the concatenation UDH (including UDHL), return its length or 0 if there is none */
+static uint8_t encode_concat_udh(const pdu_concat_t* concat, uint8_t* udh) {
+	if (concat == NULL || concat->total == 0)
+		return 0;
+
+	uint8_t indx = 0;
+	if (concat->ref_bits == 16) {
+		udh[indx++] = 6;
+		udh[indx++] = 0x08;
+		udh[indx++] = 4;
+		udh[indx++] = concat->ref >> 8;
+	} else {
+		udh[indx++] = 5;
+		udh[indx++] = 0x00;
+		udh[indx++] = 3;
+	}
+	udh[indx++] = concat->ref;
+	udh[indx++] = concat->total;
+	udh[indx++] = concat->seq;
 
 	return indx;
 }
 
+int pdu_encode(const char* sca, const char* phone, const char* text, uint8_t text_len, uint8_t* pdu, uint8_t pdu_size) {
+	return pdu_encode_part(sca, phone, text, text_len, NULL, pdu, pdu_size);
+}
+
+int pdu_encode_part(const char* sca, const char* phone, const char* text, uint8_t text_len, const pdu_concat_t* concat, uint8_t* pdu, uint8_t pdu_size) {
+	if (text == NULL)
+		return PDU_INVALID_ARG_ERR;
+
+	const pdu_text_t t = { text, text_len, PDU_TEXT_LATIN1 };
+	uint16_t from = 0;
+	const int n = pdu_encode_text_part(sca, phone, &t, &from, PDU_CODING_GSM7, concat, pdu, pdu_size);
+	/* the whole text must fit */
+	return n >= 0 && from < text_len ? PDU_INVALID_ARG_ERR : n;
+}
+
 int pdu_encodew(const char* sca, const char* phone, const uint16_t* text, uint8_t text_len, uint8_t* pdu, uint8_t pdu_size) {
-	if (sca == NULL || phone == NULL || text == NULL || pdu == NULL || pdu_size < PDU_MIN_LEN)
+	return pdu_encodew_part(sca, phone, text, text_len, NULL, pdu, pdu_size);
+}
+
+int pdu_encodew_part(const char* sca, const char* phone, const uint16_t* text, uint8_t text_len, const pdu_concat_t* concat, uint8_t* pdu, uint8_t pdu_size) {
+	if (text == NULL)
 		return PDU_INVALID_ARG_ERR;
 
-	uint8_t indx = 0;
+	const pdu_text_t t = { text, text_len, PDU_TEXT_UCS2 };
+	uint16_t from = 0;
+	const int n = pdu_encode_text_part(sca, phone, &t, &from, PDU_CODING_UCS2, concat, pdu, pdu_size);
+	return n >= 0 && from < text_len ? PDU_INVALID_ARG_ERR : n;
+}
 
-	uint8_t sca_len = strlen(sca);
-	if (sca_len == 0)
+int pdu_plan(const pdu_text_t* text, uint8_t ref_bits, pdu_plan_t* plan) {
+	if (text == NULL || (text->data == NULL && text->len) || plan == NULL)
 		return PDU_INVALID_ARG_ERR;
 
-	char *r_sca = malloc(sca_len + 2);
-	if (r_sca == NULL)
-		return PDU_UNEXPECTED_ERR;
-
-	memcpy(r_sca, sca, sca_len);
-	r_sca[sca_len + 1] = 0;
-	if (sca_len % 2 == 0) { // no fill bits
-		r_sca[sca_len] = 0;
-		pdu[indx++] = sca_len / 2 + 1;
-		pdu[indx++] = 0x91; // type of address
-		str_reverse(r_sca, sca_len, pdu + indx);
-		indx += sca_len / 2;
-	} else { // append fill bits
-		r_sca[sca_len] = 63; // 63 - 48 = 0x0F
-		pdu[indx++] = sca_len / 2 + 2;
-		pdu[indx++] = 0x91; // type of address
-		str_reverse(r_sca, sca_len + 1, pdu + indx);
-		indx += (sca_len + 1) / 2;
-	}
-	free(r_sca);
-	pdu[indx++] = 0x11; // pdu type
-	pdu[indx++] = 0x00;
+	/* room in a part of concatenated SMS, its UDH takes 6 octets (7 with 16-bit reference) */
+	const uint8_t udh_len = ref_bits == 16 ? PDU_CONCAT_UDH_MAX_LEN : PDU_CONCAT_UDH_MAX_LEN - 1;
+	const uint8_t gsm_room = GSM_CODING_MAX_CHAR - (udh_len * 8 + 6) / 7;
+	const uint8_t ucs2_room = (PDU_UD_MAX_LEN - udh_len) / 2;
 
-	/* build DA into PDU */
-	uint8_t phone_len = strlen(phone);
-	if (phone_len == 0)
+	/* both codings are split into parts as it goes, an escape or a surrogate pair is never split between two parts */
+	bool gsm = true;
+	uint16_t septets = 0, units = 0;
+	uint16_t gsm_parts = 1, ucs2_parts = 1;
+	uint8_t gsm_fill = 0, ucs2_fill = 0;
+	const uint16_t len = text->len;
+	uint16_t pos = 0;
+	while (pos < len && gsm) {
+		const uint32_t c = next_char(text, &pos);
+		if (c == BAD_CHAR)
+			return PDU_MALFORMED_ERR;
+		const uint8_t u = c >= 0x10000 ? 2 : 1;
+		units += u;
+		if (ucs2_fill + u > ucs2_room) {
+			ucs2_parts++;
+			ucs2_fill = 0;
+		}
+		ucs2_fill += u;
+
+		uint8_t code[2];
+		const uint8_t s = gsm_encode_char(c, code);
+		gsm = s > 0;
+		septets += s;
+		if (gsm_fill + s > gsm_room) {
+			gsm_parts++;
+			gsm_fill = 0;
+		}
+		gsm_fill += s;
+		/* GSM7 never takes more parts than UCS2 */
+		if (gsm_parts > 255)
+			return PDU_INVALID_ARG_ERR;
+	}
+
+	/* only the size of the rest counts once it's UCS2 */
+	while (pos < len) {
+		const uint8_t u = next_units(text, &pos);
+		if (u == 0)
+			return PDU_MALFORMED_ERR;
+		units += u;
+		if (ucs2_fill + u > ucs2_room) {
+			ucs2_parts++;
+			ucs2_fill = 0;
+		}
+		ucs2_fill += u;
+	}
+	if (!gsm && ucs2_parts > 255)
 		return PDU_INVALID_ARG_ERR;
 
-	char* r_phone = malloc(phone_len + 2);
-	if (r_phone == NULL)
-		return PDU_UNEXPECTED_ERR;
-
-	memcpy(r_phone, phone, phone_len);
-	r_phone[phone_len + 1] = 0;
-	if (phone_len % 2 == 0) { // no fill bits
-		r_phone[phone_len] = 0;
-		pdu[indx++] = phone_len;
-		pdu[indx++] = 0x91; // type of address
-		str_reverse(r_phone, phone_len, pdu + indx);
-		indx += phone_len / 2;
-	} else { // append fill bits
-		r_phone[phone_len] = 63; // 63 - 48 = 0x0F
-		pdu[indx++] = phone_len;
-		pdu[indx++] = 0x91; // type of address
-		str_reverse(r_phone, phone_len + 1, pdu + indx);
-		indx += (phone_len + 1) / 2;
-	}
-	free(r_phone);
-	pdu[indx++] = 0x00; // TP-PID
-	pdu[indx++] = 0x08; // DCS -> defualt GSM alphabet
-	pdu[indx++] = 0x81; // TP-VP -> 0x81 * 5min
-	pdu[indx++] = text_len * 2; // UDHL -> number of chars
+	/* GSM7 whenever every char has a GSM code, it takes the least parts */
+	plan->coding = gsm ? PDU_CODING_GSM7 : PDU_CODING_UCS2;
+	plan->units = gsm ? septets : units;
+	if (plan->units <= (gsm ? GSM_CODING_MAX_CHAR : UCS2_CODING_MAX_CHAR))
+		plan->parts = 1;
+	else
+		plan->parts = gsm ? gsm_parts : ucs2_parts;
+
+	return 0;
+}
+
+int pdu_encode_text_part(const char* sca, const char* phone, const pdu_text_t* text, uint16_t* from, uint8_t coding,
+	const pdu_concat_t* concat, uint8_t* pdu, uint8_t pdu_size) {
+	if (sca == NULL || phone == NULL || text == NULL || (text->data == NULL && text->len) || from == NULL || pdu == NULL ||
+		pdu_size < PDU_MIN_LEN || (coding != PDU_CODING_GSM7 && coding != PDU_CODING_UCS2))
+		return PDU_INVALID_ARG_ERR;
+
+	uint8_t udh[PDU_CONCAT_UDH_MAX_LEN];
+	const uint8_t udh_len = encode_concat_udh(concat, udh);
+	uint8_t header[PDU_MAX_LEN - PDU_UD_MAX_LEN];
+	const int n = encode_submit_header(sca, phone, udh_len > 0, coding == PDU_CODING_GSM7 ? 0x00 : 0x08, header); // DCS -> default GSM alphabet or UCS2
+	if (n < 0)
+		return n;
+	if (n + 1 + udh_len > pdu_size)
+		return SMALL_INPUT_BUFF_ERR;
+
+	uint8_t indx = n;
+	memcpy(pdu, header, indx);
+	uint8_t* udl = pdu + indx++;
+	memcpy(pdu + indx, udh, udh_len);
+	indx += udh_len;
+
+	uint16_t pos = *from;
+	if (coding == PDU_CODING_GSM7) {
+		/* the header is padded to a septet boundary */
+		const uint8_t header_septets = (udh_len * 8 + 6) / 7;
+		char buff[GSM_CODING_MAX_CHAR];
+		const char* septets;
+		const int len = text_septets(text, &pos, GSM_CODING_MAX_CHAR - header_septets, buff, &septets);
+		if (len < 0)
+			return len;
+		const uint8_t ud_octets = ((header_septets + len) * 7 + 7) / 8;
+		if (n + 1 + ud_octets > pdu_size)
+			return SMALL_INPUT_BUFF_ERR;
+
+		*udl = header_septets + len; // TP-UDL -> number of septets
+		pdu_pack_septets(septets, len, header_septets * 7 - udh_len * 8, pdu + indx);
+		indx = n + 1 + ud_octets;
+	} else {
+		/* straight into user data */
+		const uint8_t room = (PDU_UD_MAX_LEN - udh_len) / 2;
+		const uint8_t fits = (pdu_size - indx) / 2 < room ? (pdu_size - indx) / 2 : room;
+		const int len = text_to_ucs2(text, &pos, fits, pdu + indx);
+		if (len < 0)
+			return len;
+		if (pos < text->len && fits < room)
+			return SMALL_INPUT_BUFF_ERR;
 
-	/* add UCS2 content as is */
-	for (size_t i = 0; i < text_len; i++) {
-		uint16_t w = text[i];
-		pdu[indx++] = w >> 8;
-		pdu[indx++] = w;
+		indx += len * 2;
+		*udl = udh_len + len * 2; // TP-UDL -> number of octets
 	}
+	*from = pos;
 
 	return indx;
 }
+
+/* two swapped BCD digits to a number e.g 0x21 -> 12 */
+static uint8_t bcd_swap(uint8_t b) {
+	return (b & 0x0F) * 10 + (b >> 4);
+}
+
+/* unpack <septets> 7-bit GSM chars, starting after <fill_bits> bits of <in> */
+int pdu_unpack_septets(const uint8_t* in, uint8_t in_len, uint8_t fill_bits, uint8_t septets, char* out) {
+	uint16_t bit = fill_bits;
+	for (uint8_t i = 0; i < septets; i++, bit += 7) {
+#if PDU_WORD_KERNELS
+		/* octet aligned again (after <fill_bits> septets), every 7 octets give 8 septets */
+		if ((bit & 7) == 0) {
+			for (; septets - i >= 8 && (bit >> 3) + 8 <= in_len; i += 8, bit += 56, out += 8)
+				unpack_word(in + (bit >> 3), out);
+			if (i == septets)
+				break;
+		}
+#endif
+		const uint8_t byte = bit >> 3;
+		const uint8_t shift = bit & 7;
+		/* the septet may spill into the next octet, which must be there too */
+		if (((bit + 6) >> 3) >= in_len)
+			return PDU_MALFORMED_ERR;
+
+		uint16_t v = in[byte] >> shift;
+		if (shift > 1)
+			v |= in[byte + 1] << (8 - shift);
+		*out++ = v & 0x7F;
+	}
+	*out = 0;
+
+	return septets;
+}
+
+/* convert 7-bit GSM alphabet to Latin-1 */
+int gsm_to_ascii(const uint8_t* in, uint8_t in_len, uint8_t septets, char* out) {
+	if (in == NULL || out == NULL)
+		return PDU_INVALID_ARG_ERR;
+
+	const int n = pdu_unpack_septets(in, in_len, 0, septets, out);
+	if (n < 0)
+		return n;
+
+	/* in place, an escaped char takes 2 septets. plain ASCII stays as it is */
+	uint8_t len = gsm_ascii_run(out, n);
+	for (uint8_t pos = len; pos < n;) {
+		const uint16_t c = gsm_decode_char(out, n, &pos);
+		out[len++] = c < 0x100 ? c : '?';
+	}
+	out[len] = 0;
+
+	return len;
+}
+/* decode <digits> semi-octets of <in> to a NUL terminated string of digits */
+static int decode_digits(const uint8_t* in, uint8_t digits, char* out) {
+	static const char semi_octets[] = "0123456789*#abc";
+	if (digits > PDU_ADDR_MAX_LEN)
+		return PDU_MALFORMED_ERR;
+
+	for (uint8_t i = 0; i < digits; i++) {
+		const uint8_t d = (i % 2) ? in[i / 2] >> 4 : in[i / 2] & 0x0F;
+		if (d == 0x0F)
+			break;
+		*out++ = semi_octets[d];
+	}
+	*out = 0;
+
+	return 0;
+}
+
+static void decode_udh(const uint8_t* udh, uint8_t udh_len, pdu_concat_t* concat) {
+	uint8_t i = 0;
+	while (i + 2 <= udh_len) {
+		const uint8_t iei = udh[i];
+		const uint8_t iel = udh[i + 1];
+		const uint8_t* ie = udh + i + 2;
+		if (i + 2 + iel > udh_len)
+			break;
+
+		if (iei == 0x00 && iel == 3) { /* 8-bit reference */
+			concat->ref_bits = 8;
+			concat->ref = ie[0];
+			concat->total = ie[1];
+			concat->seq = ie[2];
+		} else if (iei == 0x08 && iel == 4) { /* 16-bit reference */
+			concat->ref_bits = 16;
+			concat->ref = (ie[0] << 8) | ie[1];
+			concat->total = ie[2];
+			concat->seq = ie[3];
+		}
+		i += 2 + iel;
+	}
+}
+
+/* SCA at the beginning of pdu, its length is number of octets including type of address */
+static int decode_sca(const uint8_t* pdu, uint8_t pdu_len, char* sca) {
+	const uint8_t sca_len = pdu[0];
+	if (sca_len > 0) {
+		/* its type and up to PDU_ADDR_MAX_LEN digits, a longer one would wrap the digit count below */
+		if (sca_len > 1 + PDU_ADDR_MAX_LEN / 2 || 1 + sca_len > pdu_len)
+			return PDU_MALFORMED_ERR;
+		if (decode_digits(pdu + 2, (sca_len - 1) * 2, sca) < 0)
+			return PDU_MALFORMED_ERR;
+	}
+
+	return 1 + sca_len;
+}
+
+/* an OA/RA address, its length is number of useful semi-octets. returns the number of octets it takes */
+static int decode_address(const uint8_t* in, uint8_t in_len, uint8_t* type, char* out) {
+	if (in_len < 2)
+		return PDU_MALFORMED_ERR;
+
+	const uint8_t len = in[0];
+	*type = in[1];
+	const uint8_t octets = (len + 1) / 2;
+	if (2 + octets > in_len)
+		return PDU_MALFORMED_ERR;
+	if ((*type & 0x70) == 0x50) { // alphanumeric, coded in GSM 7-bit
+		const uint8_t septets = len * 4 / 7;
+		if (septets > PDU_ADDR_MAX_LEN || pdu_unpack_septets(in + 2, octets, 0, septets, out) < 0)
+			return PDU_MALFORMED_ERR;
+	} else if (decode_digits(in + 2, len, out) < 0) {
+		return PDU_MALFORMED_ERR;
+	}
+
+	return 2 + octets;
+}
+
+/* the 7 octets of a SCTS/DT time stamp */
+static void decode_timestamp(const uint8_t* in, pdu_timestamp_t* ts) {
+	ts->year = bcd_swap(in[0]);
+	ts->month = bcd_swap(in[1]);
+	ts->day = bcd_swap(in[2]);
+	ts->hour = bcd_swap(in[3]);
+	ts->minute = bcd_swap(in[4]);
+	ts->second = bcd_swap(in[5]);
+	ts->tz = bcd_swap(in[6] & 0xF7);
+	if (in[6] & 0x08)
+		ts->tz = -ts->tz;
+}
+
+int pdu_decode(const uint8_t* pdu, uint8_t pdu_len, pdu_sms_t* sms) {
+	if (pdu == NULL || sms == NULL || pdu_len < PDU_MIN_LEN)
+		return PDU_INVALID_ARG_ERR;
+
+	memset(sms, 0, sizeof(pdu_sms_t));
+	int n = decode_sca(pdu, pdu_len, sms->sca);
+	if (n < 0 || n >= pdu_len)
+		return PDU_MALFORMED_ERR;
+	uint8_t indx = n;
+
+	const uint8_t type = pdu[indx++];
+	if ((type & 0x03) != 0x00) // TP-MTI -> only SMS-DELIVER
+		return PDU_UNSUPPORTED_ERR;
+	const bool has_udh = type & 0x40; // TP-UDHI
+
+	n = decode_address(pdu + indx, pdu_len - indx, &sms->oa_type, sms->oa);
+	if (n < 0)
+		return PDU_MALFORMED_ERR;
+	indx += n;
+
+	if (indx + 10 > pdu_len) // PID + DCS + SCTS + UDL
+		return PDU_MALFORMED_ERR;
+	sms->pid = pdu[indx++];
+	sms->dcs = pdu[indx++];
+
+	/* DCS -> general data coding or message class groups */
+	if ((sms->dcs & 0xC0) == 0x00 || (sms->dcs & 0xF0) == 0xF0) {
+		const uint8_t alphabet = (sms->dcs & 0xF0) == 0xF0 ? (sms->dcs >> 2) & 0x01 : (sms->dcs >> 2) & 0x03;
+		if (sms->dcs & 0x20) // compressed
+			return PDU_UNSUPPORTED_ERR;
+		sms->coding = alphabet == 0 ? PDU_CODING_GSM7 : alphabet == 1 ? PDU_CODING_8BIT : PDU_CODING_UCS2;
+	} else if ((sms->dcs & 0xF0) == 0xE0) { // message waiting, UCS2
+		sms->coding = PDU_CODING_UCS2;
+	} else if ((sms->dcs & 0xE0) == 0xC0) { // message waiting, GSM7
+		sms->coding = PDU_CODING_GSM7;
+	} else {
+		return PDU_UNSUPPORTED_ERR;
+	}
+
+	decode_timestamp(pdu + indx, &sms->scts);
+	indx += 7;
+
+	/* UD, its length is in septets for GSM7 and in octets for others */
+	const uint8_t udl = pdu[indx++];
+	const uint8_t* ud = pdu + indx;
+	const uint8_t ud_octets = pdu_len - indx;
+	const uint8_t needed = sms->coding == PDU_CODING_GSM7 ? (udl * 7 + 7) / 8 : udl;
+	if (needed > ud_octets || needed > PDU_UD_MAX_LEN)
+		return PDU_MALFORMED_ERR;
+
+	uint8_t header_octets = 0;
+	if (has_udh && udl > 0) {
+		sms->udh_len = ud[0];
+		header_octets = sms->udh_len + 1;
+		if (header_octets > needed)
+			return PDU_MALFORMED_ERR;
+		decode_udh(ud + 1, sms->udh_len, &sms->concat);
+	}
+
+	if (sms->coding == PDU_CODING_GSM7) {
+		/* the header is padded to a septet boundary */
+		const uint8_t header_septets = (header_octets * 8 + 6) / 7;
+		const uint8_t fill_bits = header_septets * 7 - header_octets * 8;
+		if (udl < header_septets)
+			return PDU_MALFORMED_ERR;
+		sms->text_len = udl - header_septets;
+		if (pdu_unpack_septets(ud + header_octets, needed - header_octets, fill_bits, sms->text_len, sms->ud.text) < 0)
+			return PDU_MALFORMED_ERR;
+	} else if (sms->coding == PDU_CODING_8BIT) {
+		sms->text_len = udl - header_octets;
+		memcpy(sms->ud.data, ud + header_octets, sms->text_len);
+	} else {
+		sms->text_len = (udl - header_octets) / 2;
+		for (uint8_t i = 0; i < sms->text_len; i++)
+			sms->ud.wtext[i] = (ud[header_octets + i * 2] << 8) | ud[header_octets + i * 2 + 1];
+	}
+
+	return 0;
+}
+
+int pdu_decode_status_report(const uint8_t* pdu, uint8_t pdu_len, pdu_status_report_t* report) {
+	if (pdu == NULL || report == NULL || pdu_len < PDU_MIN_LEN)
+		return PDU_INVALID_ARG_ERR;
+
+	memset(report, 0, sizeof(pdu_status_report_t));
+	int n = decode_sca(pdu, pdu_len, report->sca);
+	if (n < 0 || n + 2 > pdu_len)
+		return PDU_MALFORMED_ERR;
+	uint8_t indx = n;
+
+	const uint8_t type = pdu[indx++];
+	if ((type & 0x03) != 0x02) // TP-MTI -> SMS-STATUS-REPORT
+		return PDU_UNSUPPORTED_ERR;
+	report->mr = pdu[indx++];
+
+	n = decode_address(pdu + indx, pdu_len - indx, &report->ra_type, report->ra);
+	if (n < 0)
+		return PDU_MALFORMED_ERR;
+	indx += n;
+
+	if (indx + 15 > pdu_len) // SCTS + DT + ST
+		return PDU_MALFORMED_ERR;
+	decode_timestamp(pdu + indx, &report->scts);
+	decode_timestamp(pdu + indx + 7, &report->dt);
+	report->st = pdu[indx + 14];
+
+	return 0;
+}
+
+/* append unicode char <c> to <out> in UTF-8 */
+static int put_utf8(uint32_t c, char* out, uint16_t* n, uint16_t out_size) {
+	const uint8_t len = c < 0x80 ? 1 : c < 0x800 ? 2 : c < 0x10000 ? 3 : 4;
+	if (*n + len + 1 > out_size)
+		return SMALL_INPUT_BUFF_ERR;
+
+	switch (len) {
+	case 1:
+		out[(*n)++] = c;
+		break;
+	case 2:
+		out[(*n)++] = 0xC0 | (c >> 6);
+		out[(*n)++] = 0x80 | (c & 0x3F);
+		break;
+	case 3:
+		out[(*n)++] = 0xE0 | (c >> 12);
+		out[(*n)++] = 0x80 | ((c >> 6) & 0x3F);
+		out[(*n)++] = 0x80 | (c & 0x3F);
+		break;
+	default:
+		out[(*n)++] = 0xF0 | (c >> 18);
+		out[(*n)++] = 0x80 | ((c >> 12) & 0x3F);
+		out[(*n)++] = 0x80 | ((c >> 6) & 0x3F);
+		out[(*n)++] = 0x80 | (c & 0x3F);
+		break;
+	}
+
+	return 0;
+}
+
+int pdu_ucs2_to_utf8(const uint16_t* text, uint8_t text_len, char* out, uint16_t out_size) {
+	if (text == NULL || out == NULL || out_size == 0)
+		return PDU_INVALID_ARG_ERR;
+
+	uint16_t n = 0;
+	for (uint8_t i = 0; i < text_len; i++) {
+		uint32_t cp = text[i];
+		/* combine surrogate pair, a lone surrogate becomes U+FFFD */
+		if (cp >= 0xD800 && cp <= 0xDBFF && i + 1 < text_len && text[i + 1] >= 0xDC00 && text[i + 1] <= 0xDFFF)
+			cp = 0x10000 + ((cp - 0xD800) << 10) + (text[++i] - 0xDC00);
+		else if (cp >= 0xD800 && cp <= 0xDFFF)
+			cp = 0xFFFD;
+
+		if (put_utf8(cp, out, &n, out_size) < 0)
+			return SMALL_INPUT_BUFF_ERR;
+	}
+	out[n] = 0;
+
+	return n;
+}
+
+int pdu_gsm7_to_utf8(const char* text, uint8_t text_len, char* out, uint16_t out_size) {
+	if (text == NULL || out == NULL || out_size == 0)
+		return PDU_INVALID_ARG_ERR;
+
+	uint16_t n = 0;
+	for (uint8_t pos = 0; pos < text_len;) {
+		if (put_utf8(gsm_decode_char(text, text_len, &pos), out, &n, out_size) < 0)
+			return SMALL_INPUT_BUFF_ERR;
+	}
+	out[n] = 0;
+
+	return n;
+}
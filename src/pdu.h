@@ -22,26 +22,138 @@
 ///@cond INTERNAL
 #define GSM_CODING_MAX_CHAR 160
 #define UCS2_CODING_MAX_CHAR 70
+/* chars per part of a concatenated SMS, with 8-bit reference UDH (one less with 16-bit reference) */
+#define GSM_CODING_PART_MAX_CHAR 153
+#define UCS2_CODING_PART_MAX_CHAR 67
+#define PDU_CONCAT_UDH_MAX_LEN 7
 #define PDU_MIN_LEN 9
+#define PDU_UD_MAX_LEN 140
+#define PDU_MAX_LEN (PDU_UD_MAX_LEN + 36)
+#define PDU_ADDR_MAX_LEN 20
 
 /* error codes */
 #define SMALL_INPUT_BUFF_ERR  -1
 #define PDU_INVALID_ARG_ERR   -2
+#define PDU_MALFORMED_ERR     -3
+#define PDU_UNSUPPORTED_ERR   -4
 #define PDU_UNEXPECTED_ERR    -128
+
+/* user data coding, derived from TP-DCS */
+#define PDU_CODING_GSM7 0
+#define PDU_CODING_8BIT 1
+#define PDU_CODING_UCS2 2
+
+/* text formats of pdu_text_t */
+#define PDU_TEXT_LATIN1 0 /* a char per byte, ASCII is a subset of it */
+#define PDU_TEXT_UCS2 1
+#define PDU_TEXT_UTF8 2 /* validated as it's read, chars outside BMP are sent as surrogate pairs */
+
+/* type of address */
+#define PDU_TOA_INTERNATIONAL 0x91
+#define PDU_TOA_ALPHANUMERIC 0xD0
 ///@endcond
 
 /*!
-* \brief Encode input SMS \a text (which is coded in ASCII) into a SMS-SUBMIT pdu.
+* \brief The service center time stamp of a SMS-DELIVER pdu.
+*/
+typedef struct {
+	uint8_t year; /* 0-99 */
+	uint8_t month;
+	uint8_t day;
+	uint8_t hour;
+	uint8_t minute;
+	uint8_t second;
+	int8_t tz; /* time zone in quarters of an hour */
+} pdu_timestamp_t;
+
+/*!
+* \brief The concatenated SMS information element of user data header.
+*/
+typedef struct {
+	uint16_t ref; /* reference number, the same for all parts */
+	uint8_t total; /* number of parts, 0 if the SMS is not a part of concatenated one */
+	uint8_t seq; /* sequence number of this part, starting from 1 */
+	uint8_t ref_bits; /* size of reference number, 8 or 16 */
+} pdu_concat_t;
+
+/*!
+* \brief A decoded SMS-DELIVER pdu.
+*/
+typedef struct {
+	char sca[PDU_ADDR_MAX_LEN + 1]; /* service center address, without international '+' */
+	char oa[PDU_ADDR_MAX_LEN + 1]; /* originator address, without international '+' */
+	uint8_t oa_type; /* type of originator address */
+	uint8_t pid;
+	uint8_t dcs;
+	uint8_t coding; /* one of PDU_CODING_XXX */
+	pdu_timestamp_t scts;
+	uint8_t udh_len; /* length of user data header, 0 if there is none */
+	pdu_concat_t concat;
+	uint8_t text_len; /* number of chars(GSM7), octets(8-bit) or UCS2 chars in ud */
+	union {
+		char text[GSM_CODING_MAX_CHAR + 1]; /* GSM7 codes (see pdu_gsm7_to_utf8()), NUL terminated but '@' is 0x00 too */
+		uint8_t data[PDU_UD_MAX_LEN]; /* 8-bit */
+		uint16_t wtext[UCS2_CODING_MAX_CHAR]; /* UCS2 */
+	} ud;
+} pdu_sms_t;
+
+/*!
+* \brief A text to be encoded by pdu_plan() and pdu_encode_text_part().
+*/
+typedef struct {
+	const void* data; /* chars in one of PDU_TEXT_XXX formats */
+	uint16_t len; /* number of bytes(LATIN1, UTF8) or UCS2 chars in data */
+	uint8_t format; /* PDU_TEXT_XXX */
+} pdu_text_t;
+
+/*!
+* \brief The coding and the number of parts of a text, picked by pdu_plan().
+*/
+typedef struct {
+	uint8_t coding; /* PDU_CODING_GSM7 or PDU_CODING_UCS2 */
+	uint8_t parts; /* number of SMS the text takes, 1 if it's not concatenated */
+	uint16_t units; /* septets(GSM7, an extension table char takes 2) or UCS2 chars of the whole text */
+} pdu_plan_t;
+
+/*!
+* \brief A decoded SMS-STATUS-REPORT pdu.
+*/
+typedef struct {
+	char sca[PDU_ADDR_MAX_LEN + 1]; /* service center address, without international '+' */
+	uint8_t mr; /* message reference of the reported SMS-SUBMIT */
+	char ra[PDU_ADDR_MAX_LEN + 1]; /* recipient address, without international '+' */
+	uint8_t ra_type; /* type of recipient address */
+	pdu_timestamp_t scts; /* when the SMS was received by service center */
+	pdu_timestamp_t dt; /* discharge time, when the status was reached */
+	uint8_t st; /* status, 0x00-0x1F delivered, 0x20-0x3F still trying, others failed */
+} pdu_status_report_t;
+
+/*!
+* \brief Encode input SMS \a text (which is coded in ASCII or Latin-1) into a SMS-SUBMIT pdu of GSM 7-bit alphabet.
+* Chars of GSM extension table (e.g '{', '~') take 2 septets and the ones which aren't in GSM alphabet are sent as '?'.
 * \param sca a null terminated string contain SMS service center address
 * \param phone a null terminated string contain destination phone number
-* \param text the SMS content in ASCII
-* \param text_len the number of chars in SMS content(could be up to 160 char long)
+* \param text the SMS content in ASCII or Latin-1
+* \param text_len the number of chars in SMS content(could be up to 160 septets long)
 * \param pdu the input buffer which is going to hold the final pdu
 * \param pdu_size the size of input pdu buffer
 * \return if success a positive value represent number of pdu octets written, if fail a negative value represent error code
 */
 int pdu_encode(const char* sca, const char* phone, const char* text, uint8_t text_len, uint8_t* pdu, uint8_t pdu_size);
 
+/*!
+* \brief Encode a part of concatenated SMS \a text (which is coded in ASCII or Latin-1) into a SMS-SUBMIT pdu, like pdu_encode().
+* \param sca a null terminated string contain SMS service center address
+* \param phone a null terminated string contain destination phone number
+* \param text the content of this part in ASCII or Latin-1
+* \param text_len the number of chars in \a text (up to GSM_CODING_PART_MAX_CHAR septets, one less with 16-bit reference)
+* \param concat the concatenation info of this part, if NULL it's the same as pdu_encode()
+* \param pdu the input buffer which is going to hold the final pdu
+* \param pdu_size the size of input pdu buffer
+* \return if success a positive value represent number of pdu octets written, if fail a negative value represent error code
+*/
+int pdu_encode_part(const char* sca, const char* phone, const char* text, uint8_t text_len, const pdu_concat_t* concat, uint8_t* pdu, uint8_t pdu_size);
+
 /*!
 * \brief Encode input SMS \a text (which is coded in UCS2) into a SMS-SUBMIT pdu.
 * \param sca a null terminated string contain SMS service center address
@@ -54,4 +166,108 @@ int pdu_encode(const char* sca, const char* phone, const char* text, uint8_t tex
 */
 int pdu_encodew(const char* sca, const char* phone, const uint16_t* text, uint8_t text_len, uint8_t* pdu, uint8_t pdu_size);
 
+/*!
+* \brief Encode a part of concatenated SMS \a text (which is coded in UCS2) into a SMS-SUBMIT pdu.
+* \param sca a null terminated string contain SMS service center address
+* \param phone a null terminated string contain destination phone number
+* \param text the content of this part coded in UCS2 coding scheme
+* \param text_len the number of UCS2 chars in \a text (up to UCS2_CODING_PART_MAX_CHAR, one less with 16-bit reference)
+* \param concat the concatenation info of this part, if NULL it's the same as pdu_encodew()
+* \param pdu the input buffer which is going to hold the final pdu
+* \param pdu_size the size of input pdu buffer
+* \return if success a positive value represent number of pdu octets written, if fail a negative value represent error code
+*/
+int pdu_encodew_part(const char* sca, const char* phone, const uint16_t* text, uint8_t text_len, const pdu_concat_t* concat, uint8_t* pdu, uint8_t pdu_size);
+
+/*!
+* \brief Pick the coding of \a text which takes the least SMS and count them.
+* It's GSM 7-bit alphabet if every char of \a text is in GSM default or extension table, otherwise UCS2.
+* \param text the SMS content
+* \param ref_bits the size of concatenation reference number, 8 or 16
+* \param plan the picked coding, the number of parts and the size of text in it
+* \return 0 on success, if fail(e.g the text needs more than 255 parts or it's not valid UTF-8) a negative value represent error code
+*/
+int pdu_plan(const pdu_text_t* text, uint8_t ref_bits, pdu_plan_t* plan);
+
+/*!
+* \brief Encode the chars of \a text from \a from which fit a SMS into a SMS-SUBMIT pdu.
+* An escaped GSM char or a surrogate pair is never split between two parts.
+* \param sca a null terminated string contain SMS service center address
+* \param phone a null terminated string contain destination phone number
+* \param text the SMS content
+* \param from where this part begins in \a text, it's moved to the beginning of next part
+* \param coding PDU_CODING_GSM7 or PDU_CODING_UCS2, usually picked by pdu_plan()
+* \param concat the concatenation info of this part, NULL if \a text is not concatenated
+* \param pdu the input buffer which is going to hold the final pdu
+* \param pdu_size the size of input pdu buffer
+* \return if success a positive value represent number of pdu octets written, if fail a negative value represent error code
+*/
+int pdu_encode_text_part(const char* sca, const char* phone, const pdu_text_t* text, uint16_t* from, uint8_t coding,
+	const pdu_concat_t* concat, uint8_t* pdu, uint8_t pdu_size);
+
+/*!
+* \brief Decode a SMS-DELIVER \a pdu (including SCA) into \a sms.
+* \param pdu the pdu octets
+* \param pdu_len the number of octets in \a pdu
+* \param sms the decoded SMS
+* \return if success 0, if fail a negative value represent error code
+*/
+int pdu_decode(const uint8_t* pdu, uint8_t pdu_len, pdu_sms_t* sms);
+
+/*!
+* \brief Decode a SMS-STATUS-REPORT \a pdu (including SCA) into \a report.
+* \param pdu the pdu octets
+* \param pdu_len the number of octets in \a pdu
+* \param report the decoded status report
+* \return if success 0, if fail a negative value represent error code
+*/
+int pdu_decode_status_report(const uint8_t* pdu, uint8_t pdu_len, pdu_status_report_t* report);
+
+/*!
+* \brief Translate ASCII(or Latin-1) \a in to 7-bit GSM alphabet and pack it, 8 septets take 7 octets.
+* Chars of extension table take 2 septets and the ones which aren't in GSM alphabet become '?'.
+* \param in the chars to pack
+* \param len the number of chars in \a in
+* \param out the output buffer, it should hold (septets * 7 + 7) / 8 octets (up to 140)
+* \return the number of octets written to \a out, or a negative value on invalid arguments or more than 160 septets
+*/
+int ascii_to_gsm(const char* in, uint8_t len, uint8_t* out);
+
+/*!
+* \brief Unpack 7-bit GSM alphabet septets into a NUL terminated Latin-1 string, the reverse of ascii_to_gsm().
+* Greek capitals and '€' aren't in Latin-1, they become '?'.
+* \param in the packed septets
+* \param in_len the number of octets in \a in
+* \param septets the number of septets to unpack
+* \param out the output buffer, it should hold \a septets + 1 chars
+* \return the number of chars written to \a out (without NUL), or a negative value represent error code
+*/
+int gsm_to_ascii(const uint8_t* in, uint8_t in_len, uint8_t septets, char* out);
+
+///@cond INTERNAL
+/* the 7-bit packing kernels of the functions above and of the pdu codecs, GSM codes are taken as they are */
+int pdu_pack_septets(const char* in, uint8_t len, uint8_t fill_bits, uint8_t* out);
+int pdu_unpack_septets(const uint8_t* in, uint8_t in_len, uint8_t fill_bits, uint8_t septets, char* out);
+///@endcond
+
+/*!
+* \brief Convert UCS2 \a text into a NUL terminated UTF-8 string. surrogate pairs are combined.
+* \param text the UCS2 chars
+* \param text_len the number of UCS2 chars in \a text
+* \param out the output buffer
+* \param out_size the size of output buffer
+* \return the number of bytes written to \a out (without NUL), or a negative value represent error code
+*/
+int pdu_ucs2_to_utf8(const uint16_t* text, uint8_t text_len, char* out, uint16_t out_size);
+
+/*!
+* \brief Convert GSM 7-bit alphabet \a text (e.g pdu_sms_t::ud::text) into a NUL terminated UTF-8 string.
+* \param text the GSM codes, an escape and the code after it are a single char
+* \param text_len the number of septets in \a text
+* \param out the output buffer, 2 bytes for each septet and one for NUL are always enough
+* \param out_size the size of output buffer
+* \return the number of bytes written to \a out (without NUL), or a negative value represent error code
+*/
+int pdu_gsm7_to_utf8(const char* text, uint8_t text_len, char* out, uint16_t out_size);
+
 #endif // PDU_H
@@ -0,0 +1,256 @@
+#ifndef REPLYPARSER_H
+#define REPLYPARSER_H
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "ringbuffer.h"
+
+///@cond INTERNAL
+/*
+	zero-copy parsing of modem replies: every piece is a Span into the reply itself,
+	nothing is copied until it's asked for (copyField()) and no read goes past the span.
+	e.g the status of AT+CREG? reply:
+
+		Span line, fields[2];
+		if (findLine(reply, "+CREG:", &line) && splitFields(line, fields, 2) == 2 && parseInt(fields[1], &status)) ...
+*/
+
+/* find str inside span, data doesn't need to be NUL terminated */
+inline int spanIndexOf(const Span& span, const char* str) {
+	const uint16_t len = strlen(str);
+	if (len == 0)
+		return -1;
+
+	for (uint16_t i = 0; i + len <= span.len; i++) {
+		if (memcmp(span.data + i, str, len) == 0)
+			return i;
+	}
+
+	return -1;
+}
+
+inline bool spanStartsWith(const Span& span, const char* str) {
+	const uint16_t len = strlen(str);
+	return len <= span.len && memcmp(span.data, str, len) == 0;
+}
+
+/* the span without the spaces and line ends around it */
+inline Span spanTrim(const Span& span) {
+	auto begin = span.data;
+	auto end = span.data + span.len;
+	while (begin < end && (*begin == ' ' || *begin == '\r' || *begin == '\n'))
+		begin++;
+	while (end > begin && (end[-1] == ' ' || end[-1] == '\r' || end[-1] == '\n'))
+		end--;
+
+	return Span{ begin, static_cast<uint16_t>(end - begin) };
+}
+
+/* take the next line off rest, without its line end. empty lines are taken too */
+inline bool takeLine(Span* rest, Span* line) {
+	if (!rest->len)
+		return false;
+
+	auto eol = static_cast<const char*>(memchr(rest->data, '\n', rest->len));
+	const uint16_t len = eol ? eol - rest->data : rest->len;
+	*line = Span{ rest->data, len };
+	if (line->len && line->data[line->len - 1] == '\r')
+		line->len--;
+	rest->data += eol ? len + 1 : len;
+	rest->len -= eol ? len + 1 : len;
+
+	return true;
+}
+
+/* the first line of reply which begins with prefix (e.g "+CSQ:"), lines are searched only from their beginning */
+inline bool findLine(const Span& reply, const char* prefix, Span* line) {
+	Span rest = reply;
+	while (takeLine(&rest, line)) {
+		if (spanStartsWith(*line, prefix))
+			return true;
+	}
+
+	return false;
+}
+
+/* the first line of reply which isn't empty */
+inline bool firstLine(const Span& reply, Span* line) {
+	Span rest = reply;
+	while (takeLine(&rest, line)) {
+		*line = spanTrim(*line);
+		if (line->len)
+			return true;
+	}
+
+	return false;
+}
+
+/* the comma separated fields of line, everything after ':' */
+inline Span lineFields(const Span& line) {
+	auto colon = static_cast<const char*>(memchr(line.data, ':', line.len));
+	if (!colon)
+		return Span{ nullptr, 0 };
+
+	return Span{ colon + 1, static_cast<uint16_t>(line.data + line.len - colon - 1) };
+}
+
+/*
+	take the next comma separated field off rest, quotes are stripped from a quoted field and
+	a comma inside the quotes doesn't end it. rest.data is nullptr once the last field is taken.
+*/
+inline bool nextField(Span* rest, Span* field) {
+	if (!rest->data)
+		return false;
+
+	auto p = rest->data;
+	const auto end = rest->data + rest->len;
+	while (p < end && *p == ' ')
+		p++;
+	if (p < end && *p == '"') {
+		const auto begin = ++p;
+		while (p < end && *p != '"')
+			p++;
+		*field = Span{ begin, static_cast<uint16_t>(p - begin) };
+		while (p < end && *p != ',')
+			p++;
+	} else {
+		const auto begin = p;
+		while (p < end && *p != ',')
+			p++;
+		auto last = p;
+		while (last > begin && last[-1] == ' ')
+			last--;
+		*field = Span{ begin, static_cast<uint16_t>(last - begin) };
+	}
+
+	if (p < end)
+		*rest = Span{ p + 1, static_cast<uint16_t>(end - p - 1) };
+	else
+		*rest = Span{ nullptr, 0 };
+
+	return true;
+}
+
+/* drop the next n fields off rest */
+inline bool skipFields(Span* rest, uint8_t n) {
+	Span field;
+	while (n--) {
+		if (!nextField(rest, &field))
+			return false;
+	}
+
+	return true;
+}
+
+/* split the comma separated fields of line after ':', quotes are stripped from the quoted ones */
+inline uint8_t splitFields(const Span& line, Span* fields, uint8_t max) {
+	auto rest = lineFields(line);
+	uint8_t n = 0;
+	while (n < max && nextField(&rest, &fields[n]))
+		n++;
+
+	return n;
+}
+
+/* the field was quoted, its quotes are stripped by nextField() */
+inline bool isQuoted(const Span& line, const Span& field) {
+	return field.data > line.data && field.data[-1] == '"';
+}
+
+/* a decimal integer with an optional sign, the whole field must be the number */
+inline bool parseInt(const Span& field, int32_t* value) {
+	uint16_t i = 0;
+	const bool negative = field.len && field.data[0] == '-';
+	if (field.len && (field.data[0] == '-' || field.data[0] == '+'))
+		i++;
+	if (i == field.len)
+		return false;
+
+	int32_t v = 0;
+	for (; i < field.len; i++) {
+		const char c = field.data[i];
+		if (c < '0' || c > '9' || v > (0x7FFFFFFFL - (c - '0')) / 10)
+			return false;
+		v = v * 10 + c - '0';
+	}
+	*value = negative ? -v : v;
+
+	return true;
+}
+
+template<class T> inline bool parseInt(const Span& field, T* value) {
+	int32_t v;
+	if (!parseInt(field, &v))
+		return false;
+
+	*value = static_cast<T>(v);
+	return true;
+}
+
+/* the field as a number, 0 if it isn't one */
+inline int32_t spanToInt(const Span& field) {
+	int32_t v = 0;
+	return parseInt(field, &v) ? v : 0;
+}
+
+/* copy field NUL terminated into out, nothing is copied if it doesn't fit */
+inline bool copyField(const Span& field, char* out, uint16_t size) {
+	if (field.len >= size)
+		return false;
+
+	memcpy(out, field.data, field.len);
+	out[field.len] = 0;
+	return true;
+}
+
+/* the field without a leading '+' of an international number */
+inline Span skipPlus(const Span& field) {
+	if (field.len && field.data[0] == '+')
+		return Span{ field.data + 1, static_cast<uint16_t>(field.len - 1) };
+
+	return field;
+}
+
+/*
+	a modem time stamp "yy/MM/dd,hh:mm:ss+zz" (A6 gives the year in 4 digits), tz is in quarters of an hour.
+	the time zone is optional, time is not normalized (see mktime())
+*/
+inline bool parseTime(const Span& field, struct tm* time, int* tz) {
+	int32_t parts[6];
+	static const char separators[] = "//,::";
+	const char* p = field.data;
+	const char* end = field.data + field.len;
+	for (uint8_t i = 0; i < 6; i++) {
+		const auto begin = p;
+		while (p < end && *p >= '0' && *p <= '9')
+			p++;
+		if (!parseInt(Span{ begin, static_cast<uint16_t>(p - begin) }, &parts[i]))
+			return false;
+		if (i < 5) {
+			if (p == end || *p != separators[i])
+				return false;
+			p++;
+		}
+	}
+
+	int32_t zone = 0;
+	if (p < end && !parseInt(Span{ p, static_cast<uint16_t>(end - p) }, &zone))
+		return false;
+
+	memset(time, 0, sizeof(*time));
+	time->tm_isdst = -1;
+	time->tm_year = parts[0] > 999 ? parts[0] - 1900 : parts[0] + 2000 - 1900;
+	time->tm_mon = parts[1] - 1;
+	time->tm_mday = parts[2];
+	time->tm_hour = parts[3];
+	time->tm_min = parts[4];
+	time->tm_sec = parts[5];
+	*tz = zone;
+
+	return true;
+}
+///@endcond
+
+#endif // !REPLYPARSER_H
@@ -0,0 +1,150 @@
+#ifndef RINGBUFFER_H
+#define RINGBUFFER_H
+
+#include <stdint.h>
+#include <string.h>
+
+///@cond INTERNAL
+/* a view into a buffer, it's valid until the buffer is modified */
+struct Span {
+	const char* data;
+	uint16_t len;
+};
+
+/*
+	fixed capacity byte ring buffer, the storage has one extra byte
+	so linearize() can always NUL terminate the content.
+*/
+template<uint16_t N>
+class RingBuffer {
+public:
+	uint16_t length() const {
+		return count;
+	}
+
+	uint16_t capacity() const {
+		return N;
+	}
+
+	bool isEmpty() const {
+		return count == 0;
+	}
+
+	bool isFull() const {
+		return count == N;
+	}
+
+	void clear() {
+		head = 0;
+		count = 0;
+	}
+
+	bool push(char c) {
+		if (isFull())
+			return false;
+
+		buff[(head + count) % N] = c;
+		count++;
+		return true;
+	}
+
+	/* i-th byte from the oldest one */
+	char at(uint16_t i) const {
+		return buff[(head + i) % N];
+	}
+
+	/* drop n oldest bytes */
+	void consume(uint16_t n) {
+		if (n >= count) {
+			clear();
+			return;
+		}
+
+		head = (head + n) % N;
+		count -= n;
+	}
+
+	int indexOf(const char* str, uint16_t from = 0) const {
+		const uint16_t len = strlen(str);
+		if (len == 0 || len > count)
+			return -1;
+
+		for (uint16_t i = from; i + len <= count; i++) {
+			uint16_t j = 0;
+			while (j < len && at(i + j) == str[j])
+				j++;
+			if (j == len)
+				return i;
+		}
+
+		return -1;
+	}
+
+	int indexOf(char c, uint16_t from = 0) const {
+		for (uint16_t i = from; i < count; i++) {
+			if (at(i) == c)
+				return i;
+		}
+
+		return -1;
+	}
+
+	int lastIndexOf(char c, uint16_t from) const {
+		if (from >= count)
+			return -1;
+
+		for (int i = from; i >= 0; i--) {
+			if (at(i) == c)
+				return i;
+		}
+
+		return -1;
+	}
+
+	bool endsWith(const char* str) const {
+		const uint16_t len = strlen(str);
+		if (len > count)
+			return false;
+
+		for (uint16_t i = 0; i < len; i++) {
+			if (at(count - len + i) != str[i])
+				return false;
+		}
+
+		return true;
+	}
+
+	/* rotate the content in place to the start of storage, so it could be viewed as a NUL terminated string */
+	Span linearize() {
+		if (head != 0) {
+			if (head + count <= N) {
+				memmove(buff, buff + head, count);
+			} else {
+				/* rotate the whole storage left by head */
+				reverse(0, head);
+				reverse(head, N);
+				reverse(0, N);
+			}
+			head = 0;
+		}
+		buff[count] = 0;
+
+		return Span{ buff, count };
+	}
+
+private:
+	void reverse(uint16_t from, uint16_t to) {
+		while (from + 1 < to) {
+			char tmp = buff[from];
+			buff[from++] = buff[--to];
+			buff[to] = tmp;
+		}
+	}
+
+	char buff[N + 1];
+	uint16_t head = 0;
+	uint16_t count = 0;
+};
+///@endcond
+
+#endif // !RINGBUFFER_H
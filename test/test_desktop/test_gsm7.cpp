@@ -0,0 +1,97 @@
+/*
+ * GSM 7-bit packing and unpacking (ascii_to_gsm()/gsm_to_ascii()) round-trips, around the 8 septets <-> 7 octets steps.
+*/
+
+#include <string.h>
+
+extern "C" {
+#include "pdu.h"
+}
+
+#include "tests.h"
+
+/* chars whose GSM code is a single septet */
+static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789 .,!?$_";
+
+static void fill(char* text, uint8_t len, uint8_t seed) {
+	for (uint8_t i = 0; i < len; i++)
+		text[i] = alphabet[(i * 7 + seed) % (sizeof(alphabet) - 1)];
+	text[len] = 0;
+}
+
+/* pack text, check it takes the octets its septets need and unpack it back */
+static void roundTrip(const char* text, uint8_t len, uint8_t septets) {
+	uint8_t packed[PDU_UD_MAX_LEN];
+	char unpacked[GSM_CODING_MAX_CHAR + 1];
+	const int n = ascii_to_gsm(text, len, packed);
+	TEST_ASSERT_EQUAL_INT((septets * 7 + 7) / 8, n);
+	TEST_ASSERT_EQUAL_INT(len, gsm_to_ascii(packed, n, septets, unpacked));
+	TEST_ASSERT_EQUAL_STRING(text, unpacked);
+}
+
+static void test_every_length() {
+	char text[GSM_CODING_MAX_CHAR + 1];
+	for (uint8_t len = 1; len <= GSM_CODING_MAX_CHAR; len++) {
+		fill(text, len, len);
+		roundTrip(text, len, len);
+	}
+}
+
+/* the high bit of the 8th septet of a word lands at the top of its 7th octet */
+static void test_word_boundaries() {
+	static const uint8_t lengths[] = { 7, 8, 9, 15, 16, 17, 55, 56, 57, 152, 153, 159, 160 };
+	char text[GSM_CODING_MAX_CHAR + 1];
+	for (auto len : lengths) {
+		memset(text, 0x7F & 'z', len); // 0x7A, all the septet bits but one set
+		text[len] = 0;
+		roundTrip(text, len, len);
+	}
+
+	/* 8 septets exactly fill 7 octets, a 9th takes an octet of its own */
+	uint8_t packed[PDU_UD_MAX_LEN];
+	TEST_ASSERT_EQUAL_INT(7, ascii_to_gsm("12345678", 8, packed));
+	TEST_ASSERT_EQUAL_INT(8, ascii_to_gsm("123456789", 9, packed));
+	TEST_ASSERT_EQUAL_UINT8('9' & 0x7F, packed[7]);
+}
+
+/* an extension table char takes 2 septets wherever it falls in a word */
+static void test_escape_at_every_position() {
+	char text[GSM_CODING_MAX_CHAR + 1];
+	for (uint8_t pos = 0; pos < 20; pos++) {
+		fill(text, 20, pos);
+		text[pos] = '{';
+		roundTrip(text, 20, 21);
+	}
+
+	/* the last char of the longest text */
+	fill(text, GSM_CODING_MAX_CHAR - 1, 3);
+	text[GSM_CODING_MAX_CHAR - 2] = '|';
+	roundTrip(text, GSM_CODING_MAX_CHAR - 1, GSM_CODING_MAX_CHAR);
+}
+
+static void test_too_long() {
+	char text[GSM_CODING_MAX_CHAR + 2];
+	uint8_t packed[PDU_UD_MAX_LEN + 1];
+	fill(text, GSM_CODING_MAX_CHAR + 1, 0);
+	TEST_ASSERT_TRUE(ascii_to_gsm(text, GSM_CODING_MAX_CHAR + 1, packed) < 0);
+
+	/* 160 chars, but the escape makes them 161 septets */
+	text[0] = '[';
+	TEST_ASSERT_TRUE(ascii_to_gsm(text, GSM_CODING_MAX_CHAR, packed) < 0);
+}
+
+/* the last septet spills into an octet which isn't there */
+static void test_unpack_truncated() {
+	uint8_t packed[PDU_UD_MAX_LEN];
+	char unpacked[GSM_CODING_MAX_CHAR + 1];
+	const int n = ascii_to_gsm("hello world", 11, packed);
+	TEST_ASSERT_TRUE(gsm_to_ascii(packed, n - 1, 11, unpacked) < 0);
+}
+
+void run_gsm7_tests() {
+	RUN_TEST(test_every_length);
+	RUN_TEST(test_word_boundaries);
+	RUN_TEST(test_escape_at_every_position);
+	RUN_TEST(test_too_long);
+	RUN_TEST(test_unpack_truncated);
+}
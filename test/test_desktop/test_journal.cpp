@@ -0,0 +1,133 @@
+/*
+ * SMSJournal replay after a crash tore the journal: the SMS before the first torn record are sent again,
+ * the torn one and everything after it are dropped.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <A6lib.h>
+
+#include "MockModem.h"
+#include "SMSJournal.h"
+
+#include "tests.h"
+
+static char dir[] = "/tmp/a6journalXXXXXX";
+static char path[sizeof(dir) + 16];
+
+static void script(MockModem* port) {
+	port->on("AT+CMGF", "\r\nOK\r\n", 1);
+	port->on("AT+CSCA?", "\r\n+CSCA: \"+989350001500\",145\r\n\r\nOK\r\n", 1);
+	port->on("AT+CMGS=", "\r\n> ", 1);
+	port->onSubmit("\r\n+CMGS: 1\r\n\r\nOK\r\n", 1);
+	port->begin(115200);
+}
+
+/* queue 3 SMS without sending them and close the journal, offsets get where each record begins */
+static void writeJournal(size_t* offsets) {
+	MockModem port;
+	script(&port);
+	A6lib modem(&port);
+	SMSJournal journal(&modem);
+	unlink(path);
+	TEST_ASSERT_EQUAL_INT(0, journal.open(path));
+	for (uint8_t i = 0; i < 3; i++) {
+		offsets[i] = journal.size();
+		TEST_ASSERT_TRUE(journal.queueSMS("989120000000", "hello") != 0);
+	}
+	offsets[3] = journal.size();
+	journal.close();
+}
+
+static void overwrite(size_t offset, const void* data, size_t len) {
+	FILE* f = fopen(path, "r+b");
+	TEST_ASSERT_TRUE(f != nullptr);
+	fseek(f, offset, SEEK_SET);
+	fwrite(data, 1, len, f);
+	fclose(f);
+}
+
+/* reopen the journal, it returns the number of SMS replayed */
+static int32_t replay() {
+	MockModem port;
+	script(&port);
+	A6lib modem(&port);
+	SMSJournal journal(&modem);
+	const auto replayed = journal.open(path);
+	TEST_ASSERT_EQUAL_UINT32(replayed, journal.pending());
+	journal.close();
+
+	return replayed;
+}
+
+static void test_replay_intact() {
+	size_t offsets[4];
+	writeJournal(offsets);
+	TEST_ASSERT_EQUAL_INT(3, replay());
+}
+
+/* a bit flipped in the last record */
+static void test_replay_torn_last() {
+	size_t offsets[4];
+	writeJournal(offsets);
+	const char flipped = 'H';
+	overwrite(offsets[3] - 4, &flipped, 1);
+	TEST_ASSERT_EQUAL_INT(2, replay());
+	/* and so it is on the next restart */
+	TEST_ASSERT_EQUAL_INT(2, replay());
+}
+
+/* only the head of the last record reached the disk */
+static void test_replay_cut_last() {
+	size_t offsets[4];
+	writeJournal(offsets);
+	char zeros[64] = {};
+	const size_t half = (offsets[3] - offsets[2]) / 2;
+	overwrite(offsets[2] + half, zeros, offsets[3] - offsets[2] - half);
+	TEST_ASSERT_EQUAL_INT(2, replay());
+}
+
+/* replay stops at the first torn record */
+static void test_replay_torn_middle() {
+	size_t offsets[4];
+	writeJournal(offsets);
+	const uint32_t crc = 0;
+	overwrite(offsets[1], &crc, sizeof(crc));
+	TEST_ASSERT_EQUAL_INT(1, replay());
+}
+
+/* the SMS which were sent aren't replayed */
+static void test_replay_sent() {
+	MockModem port;
+	script(&port);
+	A6lib modem(&port);
+	SMSJournal journal(&modem);
+	unlink(path);
+	TEST_ASSERT_EQUAL_INT(0, journal.open(path));
+	TEST_ASSERT_TRUE(journal.queueSMS("989120000000", "one") != 0);
+	TEST_ASSERT_TRUE(journal.queueSMS("989120000000", "two") != 0);
+	TEST_ASSERT_EQUAL_INT(2, journal.flush());
+	TEST_ASSERT_TRUE(journal.queueSMS("989120000000", "three") != 0);
+	journal.close();
+	TEST_ASSERT_EQUAL_INT(1, replay());
+}
+
+void run_journal_tests() {
+	if (!mkdtemp(dir)) {
+		perror(dir);
+		return;
+	}
+	snprintf(path, sizeof(path), "%s/outbox.journal", dir);
+
+	RUN_TEST(test_replay_intact);
+	RUN_TEST(test_replay_torn_last);
+	RUN_TEST(test_replay_cut_last);
+	RUN_TEST(test_replay_torn_middle);
+	RUN_TEST(test_replay_sent);
+
+	unlink(path);
+	rmdir(dir);
+}
@@ -0,0 +1,26 @@
+/*
+ * Runner of the host unit tests.
+ * e.g: pio test -e native
+*/
+
+#include "tests.h"
+
+void setUp() {
+
+}
+
+void tearDown() {
+
+}
+
+int main() {
+	UNITY_BEGIN();
+	run_tokenizer_tests();
+	run_pdu_tests();
+	run_gsm7_tests();
+	run_journal_tests();
+	run_payload_tests();
+	run_queue_tests();
+
+	return UNITY_END();
+}
@@ -0,0 +1,100 @@
+/*
+ * The SMS payload written on the prompt: as much as the port says it takes, a whole chunk on a port which
+ * doesn't report its room, and nothing while the tx buffer of a port which does report it is full.
+*/
+
+#include <ctype.h>
+
+#include <string>
+
+#include <A6lib.h>
+
+#include "MockModem.h"
+
+#include "tests.h"
+
+/* a port whose room can be taken away for a number of polls, it records the payload writes */
+class TxPort : public MockModem {
+public:
+	int availableForWrite() override {
+		polls++;
+		last_room = full_polls ? (full_polls--, 0) : MockModem::availableForWrite();
+		return last_room;
+	}
+	size_t write(const uint8_t* buffer, size_t size) override {
+		/* the chunks of a hex pdu and its Ctrl-Z, AT commands have other chars */
+		bool payload = size > 0;
+		for (size_t i = 0; i < size; i++)
+			payload = payload && (isxdigit(buffer[i]) || buffer[i] == 0x1A);
+		if (payload) {
+			max_chunk = max_chunk > size ? max_chunk : size;
+			if (last_room == 0 && MockModem::availableForWrite() > 0)
+				written_while_full++;
+		}
+		return MockModem::write(buffer, size);
+	}
+	using MockModem::write;
+
+	int full_polls = 0;
+	int last_room = 0;
+	unsigned polls = 0;
+	size_t max_chunk = 0;
+	unsigned written_while_full = 0;
+};
+
+static int submitted;
+
+static void script(MockModem* port) {
+	submitted = 0;
+	port->on("AT+CMGF", "\r\nOK\r\n", 1);
+	port->on("AT+CSCA?", "\r\n+CSCA: \"+989350001500\",145\r\n\r\nOK\r\n", 1);
+	port->on("AT+CMGS=", "\r\n> ", 1);
+	port->onSubmit([](const std::string&) {
+		submitted++;
+		return std::string("\r\n+CMGS: 7\r\n\r\nOK\r\n");
+	}, 1);
+	port->begin(115200);
+}
+
+/* a payload larger than the room goes in chunks no larger than it */
+static void test_limited_room() {
+	TxPort port;
+	script(&port);
+	port.setWriteRoom(10);
+	A6lib modem(&port);
+	TEST_ASSERT_TRUE(modem.sendPDU("989120000000", std::string(150, 'x').c_str()));
+	TEST_ASSERT_EQUAL_INT(1, submitted);
+	TEST_ASSERT_EQUAL_UINT(10, port.max_chunk);
+}
+
+/* a port which reported room once and then says 0 has a full tx buffer, the payload waits for room */
+static void test_full_tx_buffer() {
+	TxPort port;
+	script(&port);
+	A6lib modem(&port);
+	TEST_ASSERT_TRUE(modem.sendPDU("989120000000", "hello"));
+
+	port.full_polls = 20;
+	port.polls = 0;
+	TEST_ASSERT_TRUE(modem.sendPDU("989120000000", "hello again"));
+	TEST_ASSERT_EQUAL_INT(2, submitted);
+	TEST_ASSERT_TRUE(port.polls > 20);
+	TEST_ASSERT_EQUAL_UINT(0, port.written_while_full);
+}
+
+/* a port which never reports its room (Print's default) gets a whole chunk at a time */
+static void test_unknown_room() {
+	TxPort port;
+	script(&port);
+	port.setWriteRoom(0);
+	A6lib modem(&port);
+	TEST_ASSERT_TRUE(modem.sendPDU("989120000000", std::string(150, 'x').c_str()));
+	TEST_ASSERT_EQUAL_INT(1, submitted);
+	TEST_ASSERT_EQUAL_UINT(A6_TX_CHUNK, port.max_chunk);
+}
+
+void run_payload_tests() {
+	RUN_TEST(test_limited_room);
+	RUN_TEST(test_full_tx_buffer);
+	RUN_TEST(test_unknown_room);
+}
@@ -0,0 +1,290 @@
+/*
+ * SMS-DELIVER decoding (pdu_decode()), of well formed pdus and of the ones whose length fields don't add up,
+ * the parts of a concatenated SMS (pdu_encode_part()/pdu_encodew_part()) decoded back, and how a text is split into
+ * those parts (pdu_plan()/pdu_encode_text_part()).
+*/
+
+#include <string.h>
+
+extern "C" {
+#include "pdu.h"
+}
+
+#include "tests.h"
+
+static const uint8_t sca[] = { 0x07, 0x91, 0x89, 0x39, 0x05, 0x00, 0x51, 0x00 }; // +989350001500
+static const uint8_t oa[] = { 0x0C, 0x91, 0x89, 0x19, 0x02, 0x00, 0x00, 0x00 }; // +989120000000
+static const uint8_t scts[] = { 0x71, 0x01, 0x11, 0x61, 0x74, 0x54, 0x80 };
+
+/* pack 7-bit chars after fill_bits, 8 of them take 7 octets */
+static uint8_t pack(const char* text, uint8_t len, uint8_t* out, uint8_t fill_bits = 0) {
+	uint16_t bit = fill_bits;
+	memset(out, 0, (fill_bits + len * 7 + 7) / 8);
+	for (uint8_t i = 0; i < len; i++, bit += 7) {
+		const uint16_t v = (text[i] & 0x7F) << (bit & 7);
+		out[bit / 8] |= v & 0xFF;
+		if (v >> 8)
+			out[bit / 8 + 1] |= v >> 8;
+	}
+
+	return (bit + 7) / 8;
+}
+
+/* a SMS-DELIVER pdu of ud, whose length field says udl */
+static uint8_t deliver(uint8_t* pdu, uint8_t dcs, uint8_t udl, const uint8_t* ud, uint8_t ud_len, bool udh = false) {
+	uint8_t n = 0;
+	memcpy(pdu + n, sca, sizeof(sca));
+	n += sizeof(sca);
+	pdu[n++] = udh ? 0x44 : 0x04;
+	memcpy(pdu + n, oa, sizeof(oa));
+	n += sizeof(oa);
+	pdu[n++] = 0x00; // PID
+	pdu[n++] = dcs;
+	memcpy(pdu + n, scts, sizeof(scts));
+	n += sizeof(scts);
+	pdu[n++] = udl;
+	memcpy(pdu + n, ud, ud_len);
+
+	return n + ud_len;
+}
+
+/* the UD of a SMS-SUBMIT pdu and its length field */
+static const uint8_t* submitUD(const uint8_t* pdu, uint8_t* udl) {
+	uint8_t i = 1 + pdu[0];
+	const uint8_t type = pdu[i++];
+	i++; // MR
+	i += 2 + (pdu[i] + 1) / 2; // DA
+	i += 2; // PID, DCS
+	if ((type & 0x18) == 0x10) // relative VP
+		i++;
+	else if (type & 0x18)
+		i += 7;
+	*udl = pdu[i];
+
+	return pdu + i + 1;
+}
+
+static void test_decode() {
+	uint8_t ud[PDU_UD_MAX_LEN];
+	uint8_t pdu[PDU_MAX_LEN];
+	pdu_sms_t sms;
+	const uint8_t n = pack("hello", 5, ud);
+	TEST_ASSERT_EQUAL_INT(0, pdu_decode(pdu, deliver(pdu, 0x00, 5, ud, n), &sms));
+	TEST_ASSERT_EQUAL_STRING("989350001500", sms.sca);
+	TEST_ASSERT_EQUAL_STRING("989120000000", sms.oa);
+	TEST_ASSERT_EQUAL_UINT8(PDU_CODING_GSM7, sms.coding);
+	TEST_ASSERT_EQUAL_UINT8(5, sms.text_len);
+	TEST_ASSERT_EQUAL_STRING("hello", sms.ud.text);
+	TEST_ASSERT_EQUAL_UINT8(17, sms.scts.year);
+	TEST_ASSERT_EQUAL_UINT8(11, sms.scts.day);
+	TEST_ASSERT_EQUAL_INT(8, sms.scts.tz);
+	TEST_ASSERT_EQUAL_UINT8(0, sms.concat.total);
+}
+
+/* a part of a concatenated SMS, its text begins at the septet after the header */
+static void test_decode_concat() {
+	uint8_t ud[PDU_UD_MAX_LEN] = { 0x05, 0x00, 0x03, 0x07, 0x02, 0x01 };
+	uint8_t pdu[PDU_MAX_LEN];
+	pdu_sms_t sms;
+	const uint8_t n = pack("part", 4, ud + 6, 1);
+	TEST_ASSERT_EQUAL_INT(0, pdu_decode(pdu, deliver(pdu, 0x00, 7 + 4, ud, 6 + n, true), &sms));
+	TEST_ASSERT_EQUAL_UINT16(7, sms.concat.ref);
+	TEST_ASSERT_EQUAL_UINT8(2, sms.concat.total);
+	TEST_ASSERT_EQUAL_UINT8(1, sms.concat.seq);
+	TEST_ASSERT_EQUAL_STRING("part", sms.ud.text);
+}
+
+/* the longest UD of each coding still decodes */
+static void test_decode_full() {
+	uint8_t ud[PDU_UD_MAX_LEN];
+	uint8_t pdu[PDU_MAX_LEN];
+	pdu_sms_t sms;
+	memset(ud, 0x41, sizeof(ud));
+	TEST_ASSERT_EQUAL_INT(0, pdu_decode(pdu, deliver(pdu, 0x00, GSM_CODING_MAX_CHAR, ud, PDU_UD_MAX_LEN), &sms));
+	TEST_ASSERT_EQUAL_UINT8(GSM_CODING_MAX_CHAR, sms.text_len);
+	TEST_ASSERT_EQUAL_INT(0, pdu_decode(pdu, deliver(pdu, 0x04, PDU_UD_MAX_LEN, ud, PDU_UD_MAX_LEN), &sms));
+	TEST_ASSERT_EQUAL_UINT8(PDU_UD_MAX_LEN, sms.text_len);
+	TEST_ASSERT_EQUAL_INT(0, pdu_decode(pdu, deliver(pdu, 0x08, PDU_UD_MAX_LEN, ud, PDU_UD_MAX_LEN), &sms));
+	TEST_ASSERT_EQUAL_UINT8(UCS2_CODING_MAX_CHAR, sms.text_len);
+	TEST_ASSERT_EQUAL_UINT16(0x4141, sms.ud.wtext[UCS2_CODING_MAX_CHAR - 1]);
+}
+
+/* UDL says more than the pdu carries */
+static void test_decode_truncated() {
+	uint8_t ud[PDU_UD_MAX_LEN];
+	uint8_t pdu[PDU_MAX_LEN];
+	pdu_sms_t sms;
+	const uint8_t n = pack("hello world", 11, ud);
+	TEST_ASSERT_EQUAL_INT(PDU_MALFORMED_ERR, pdu_decode(pdu, deliver(pdu, 0x00, 11, ud, n - 1), &sms));
+	TEST_ASSERT_EQUAL_INT(PDU_MALFORMED_ERR, pdu_decode(pdu, deliver(pdu, 0x08, 10, ud, 9), &sms));
+	TEST_ASSERT_EQUAL_INT(PDU_MALFORMED_ERR, pdu_decode(pdu, deliver(pdu, 0x04, 10, ud, 9), &sms));
+
+	/* cut anywhere before the UD */
+	const uint8_t len = deliver(pdu, 0x00, 11, ud, n);
+	for (uint8_t cut = PDU_MIN_LEN; cut < len - n; cut++)
+		TEST_ASSERT_TRUE(pdu_decode(pdu, cut, &sms) < 0);
+}
+
+/* UDL beyond what a single SMS can hold, even when the pdu does carry that many octets */
+static void test_decode_oversized() {
+	uint8_t ud[PDU_UD_MAX_LEN + 2] = {};
+	uint8_t pdu[PDU_MAX_LEN + 2];
+	pdu_sms_t sms;
+	TEST_ASSERT_EQUAL_INT(PDU_MALFORMED_ERR, pdu_decode(pdu, deliver(pdu, 0x00, GSM_CODING_MAX_CHAR + 1, ud, PDU_UD_MAX_LEN + 1), &sms));
+	TEST_ASSERT_EQUAL_INT(PDU_MALFORMED_ERR, pdu_decode(pdu, deliver(pdu, 0x00, 0xFF, ud, PDU_UD_MAX_LEN + 1), &sms));
+	TEST_ASSERT_EQUAL_INT(PDU_MALFORMED_ERR, pdu_decode(pdu, deliver(pdu, 0x04, PDU_UD_MAX_LEN + 1, ud, PDU_UD_MAX_LEN + 1), &sms));
+	TEST_ASSERT_EQUAL_INT(PDU_MALFORMED_ERR, pdu_decode(pdu, deliver(pdu, 0x08, PDU_UD_MAX_LEN + 2, ud, PDU_UD_MAX_LEN + 2), &sms));
+
+	/* a header longer than the UD */
+	ud[0] = 10;
+	TEST_ASSERT_EQUAL_INT(PDU_MALFORMED_ERR, pdu_decode(pdu, deliver(pdu, 0x04, 6, ud, 6, true), &sms));
+}
+
+/* a SCA length whose digit count doesn't fit a uint8_t */
+static void test_decode_oversized_sca() {
+	uint8_t pdu[PDU_MAX_LEN] = {};
+	pdu_sms_t sms;
+	pdu_status_report_t report;
+	pdu[0] = 129;
+	pdu[1] = 0x91;
+	TEST_ASSERT_EQUAL_INT(PDU_MALFORMED_ERR, pdu_decode(pdu, sizeof(pdu), &sms));
+	TEST_ASSERT_EQUAL_INT(PDU_MALFORMED_ERR, pdu_decode_status_report(pdu, sizeof(pdu), &report));
+	pdu[0] = 1 + PDU_ADDR_MAX_LEN / 2 + 1;
+	TEST_ASSERT_EQUAL_INT(PDU_MALFORMED_ERR, pdu_decode(pdu, sizeof(pdu), &sms));
+}
+
+/* deliver the UD of a submitted part and decode it */
+static void decodeSubmitted(const uint8_t* submit, int n, uint8_t dcs, pdu_sms_t* sms) {
+	uint8_t pdu[PDU_MAX_LEN];
+	TEST_ASSERT_GREATER_THAN(0, n);
+	uint8_t udl;
+	const uint8_t* ud = submitUD(submit, &udl);
+	TEST_ASSERT_EQUAL_INT(0, pdu_decode(pdu, deliver(pdu, dcs, udl, ud, submit + n - ud, true), sms));
+}
+
+/* a full ASCII part, with 8-bit and 16-bit reference */
+static void test_encode_part() {
+	char content[GSM_CODING_PART_MAX_CHAR + 1];
+	for (uint8_t i = 0; i < GSM_CODING_PART_MAX_CHAR; i++)
+		content[i] = 'A' + i % 26;
+	content[GSM_CODING_PART_MAX_CHAR] = 0;
+	uint8_t submit[PDU_MAX_LEN];
+	pdu_sms_t sms;
+
+	pdu_concat_t concat = { 7, 3, 2, 8 };
+	decodeSubmitted(submit, pdu_encode_part("989350001500", "989120000000", content, GSM_CODING_PART_MAX_CHAR, &concat, submit, sizeof(submit)), 0x00, &sms);
+	TEST_ASSERT_EQUAL_UINT16(7, sms.concat.ref);
+	TEST_ASSERT_EQUAL_UINT8(3, sms.concat.total);
+	TEST_ASSERT_EQUAL_UINT8(2, sms.concat.seq);
+	TEST_ASSERT_EQUAL_UINT8(GSM_CODING_PART_MAX_CHAR, sms.text_len);
+	TEST_ASSERT_EQUAL_STRING(content, sms.ud.text);
+
+	concat = { 0x1234, 3, 3, 16 };
+	content[GSM_CODING_PART_MAX_CHAR - 1] = 0;
+	decodeSubmitted(submit, pdu_encode_part("989350001500", "989120000000", content, GSM_CODING_PART_MAX_CHAR - 1, &concat, submit, sizeof(submit)), 0x00, &sms);
+	TEST_ASSERT_EQUAL_UINT16(0x1234, sms.concat.ref);
+	TEST_ASSERT_EQUAL_UINT8(3, sms.concat.seq);
+	TEST_ASSERT_EQUAL_UINT8(GSM_CODING_PART_MAX_CHAR - 1, sms.text_len);
+	TEST_ASSERT_EQUAL_STRING(content, sms.ud.text);
+}
+
+/* a full UCS2 part */
+static void test_encodew_part() {
+	uint16_t content[UCS2_CODING_PART_MAX_CHAR];
+	for (uint8_t i = 0; i < UCS2_CODING_PART_MAX_CHAR; i++)
+		content[i] = 0x0627 + i;
+	uint8_t submit[PDU_MAX_LEN];
+	pdu_sms_t sms;
+
+	const pdu_concat_t concat = { 9, 2, 1, 8 };
+	decodeSubmitted(submit, pdu_encodew_part("989350001500", "989120000000", content, UCS2_CODING_PART_MAX_CHAR, &concat, submit, sizeof(submit)), 0x08, &sms);
+	TEST_ASSERT_EQUAL_UINT16(9, sms.concat.ref);
+	TEST_ASSERT_EQUAL_UINT8(2, sms.concat.total);
+	TEST_ASSERT_EQUAL_UINT8(1, sms.concat.seq);
+	TEST_ASSERT_EQUAL_UINT8(UCS2_CODING_PART_MAX_CHAR, sms.text_len);
+	TEST_ASSERT_EQUAL_UINT16_ARRAY(content, sms.ud.wtext, UCS2_CODING_PART_MAX_CHAR);
+}
+
+/* a part longer than a part can be is refused */
+static void test_encode_part_too_long() {
+	char content[GSM_CODING_PART_MAX_CHAR + 1];
+	memset(content, 'a', sizeof(content));
+	uint8_t submit[PDU_MAX_LEN];
+	const pdu_concat_t concat = { 7, 2, 1, 8 };
+	TEST_ASSERT_LESS_THAN(0, pdu_encode_part("989350001500", "989120000000", content, sizeof(content), &concat, submit, sizeof(submit)));
+}
+
+static void encodeAndDecode(const pdu_text_t& text, uint8_t coding, uint16_t* from, const pdu_concat_t& concat, pdu_sms_t* sms) {
+	uint8_t submit[PDU_MAX_LEN];
+	const int n = pdu_encode_text_part("989350001500", "989120000000", &text, from, coding, &concat, submit, sizeof(submit));
+	decodeSubmitted(submit, n, coding == PDU_CODING_GSM7 ? 0x00 : 0x08, sms);
+	TEST_ASSERT_EQUAL_UINT8(concat.total, sms->concat.total);
+	TEST_ASSERT_EQUAL_UINT8(concat.seq, sms->concat.seq);
+}
+
+/* an escaped GSM char which would straddle the parts goes to the next one */
+static void test_split_escape() {
+	char content[GSM_CODING_PART_MAX_CHAR + 10];
+	memset(content, 'a', GSM_CODING_PART_MAX_CHAR - 1);
+	content[GSM_CODING_PART_MAX_CHAR - 1] = '{';
+	memset(content + GSM_CODING_PART_MAX_CHAR, 'b', 10);
+	const pdu_text_t text = { content, sizeof(content), PDU_TEXT_LATIN1 };
+	pdu_plan_t plan;
+	TEST_ASSERT_EQUAL_INT(0, pdu_plan(&text, 8, &plan));
+	TEST_ASSERT_EQUAL_UINT8(PDU_CODING_GSM7, plan.coding);
+	TEST_ASSERT_EQUAL_UINT8(2, plan.parts);
+
+	pdu_sms_t sms;
+	char utf8[GSM_CODING_MAX_CHAR * 2 + 1];
+	uint16_t from = 0;
+	encodeAndDecode(text, plan.coding, &from, pdu_concat_t{ 7, 2, 1, 8 }, &sms);
+	TEST_ASSERT_EQUAL_UINT16(GSM_CODING_PART_MAX_CHAR - 1, from);
+	TEST_ASSERT_EQUAL_UINT8(GSM_CODING_PART_MAX_CHAR - 1, sms.text_len);
+	TEST_ASSERT_TRUE(sms.ud.text[sms.text_len - 1] != 0x1B);
+
+	encodeAndDecode(text, plan.coding, &from, pdu_concat_t{ 7, 2, 2, 8 }, &sms);
+	TEST_ASSERT_EQUAL_UINT16(sizeof(content), from);
+	TEST_ASSERT_EQUAL_UINT8(12, sms.text_len);
+	TEST_ASSERT_TRUE(pdu_gsm7_to_utf8(sms.ud.text, sms.text_len, utf8, sizeof(utf8)) > 0);
+	TEST_ASSERT_EQUAL_STRING("{bbbbbbbbbb", utf8);
+}
+
+/* a surrogate pair which would straddle the parts goes to the next one */
+static void test_split_surrogate() {
+	char content[UCS2_CODING_PART_MAX_CHAR - 1 + 4 + 5];
+	memset(content, 'a', UCS2_CODING_PART_MAX_CHAR - 1);
+	memcpy(content + UCS2_CODING_PART_MAX_CHAR - 1, "\xF0\x9F\x98\x80", 4); // U+1F600
+	memset(content + UCS2_CODING_PART_MAX_CHAR + 3, 'b', 5);
+	const pdu_text_t text = { content, sizeof(content), PDU_TEXT_UTF8 };
+	pdu_plan_t plan;
+	TEST_ASSERT_EQUAL_INT(0, pdu_plan(&text, 8, &plan));
+	TEST_ASSERT_EQUAL_UINT8(PDU_CODING_UCS2, plan.coding);
+	TEST_ASSERT_EQUAL_UINT8(2, plan.parts);
+
+	pdu_sms_t sms;
+	uint16_t from = 0;
+	encodeAndDecode(text, plan.coding, &from, pdu_concat_t{ 7, 2, 1, 8 }, &sms);
+	TEST_ASSERT_EQUAL_UINT16(UCS2_CODING_PART_MAX_CHAR - 1, from);
+	TEST_ASSERT_EQUAL_UINT8(UCS2_CODING_PART_MAX_CHAR - 1, sms.text_len);
+	TEST_ASSERT_EQUAL_UINT16('a', sms.ud.wtext[sms.text_len - 1]);
+
+	encodeAndDecode(text, plan.coding, &from, pdu_concat_t{ 7, 2, 2, 8 }, &sms);
+	TEST_ASSERT_EQUAL_UINT16(sizeof(content), from);
+	TEST_ASSERT_EQUAL_UINT8(7, sms.text_len);
+	TEST_ASSERT_EQUAL_UINT16(0xD83D, sms.ud.wtext[0]);
+	TEST_ASSERT_EQUAL_UINT16(0xDE00, sms.ud.wtext[1]);
+}
+
+void run_pdu_tests() {
+	RUN_TEST(test_decode);
+	RUN_TEST(test_decode_concat);
+	RUN_TEST(test_decode_full);
+	RUN_TEST(test_decode_truncated);
+	RUN_TEST(test_decode_oversized);
+	RUN_TEST(test_decode_oversized_sca);
+	RUN_TEST(test_encode_part);
+	RUN_TEST(test_encodew_part);
+	RUN_TEST(test_encode_part_too_long);
+	RUN_TEST(test_split_escape);
+	RUN_TEST(test_split_surrogate);
+}
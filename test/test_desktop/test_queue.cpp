@@ -0,0 +1,76 @@
+/*
+ * The asynchronous SMS queue: the SCA each job is submitted with follows the modem facts.
+*/
+
+#include <string>
+
+#include <A6lib.h>
+
+#include "MockModem.h"
+
+#include "tests.h"
+
+static std::string sca;
+static std::string last_pdu;
+static int sca_reads;
+
+static void script(MockModem* port) {
+	sca = "+989350001500";
+	last_pdu.clear();
+	sca_reads = 0;
+	port->on("AT+CMGF", "\r\nOK\r\n", 1);
+	port->on("AT+CSCA?", [](const std::string&) {
+		sca_reads++;
+		return "\r\n+CSCA: \"" + sca + "\",145\r\n\r\nOK\r\n";
+	}, 1);
+	port->on("AT+CMGS=", "\r\n> ", 1);
+	port->onSubmit([](const std::string& pdu) {
+		last_pdu = pdu;
+		return std::string("\r\n+CMGS: 7\r\n\r\nOK\r\n");
+	}, 1);
+	port->begin(115200);
+}
+
+/* queue a SMS and let handle() send it */
+static void send(A6lib* modem) {
+	TEST_ASSERT_TRUE(modem->queueSMS("989120000000", "hello") != 0);
+	const auto start = millis();
+	while (modem->queuedSMS() && millis() - start < 2000)
+		modem->handle();
+	TEST_ASSERT_EQUAL_UINT(0, modem->queuedSMS());
+}
+
+/* a SCA changed by the SIM is read again once the facts are invalidated */
+static void test_sca_after_invalidate() {
+	MockModem port;
+	script(&port);
+	A6lib modem(&port);
+	TEST_ASSERT_TRUE(modem.setSMSFormat(Format_PDU));
+	modem.setAsyncSMSQueue(true);
+
+	send(&modem);
+	TEST_ASSERT_EQUAL_STRING("0791893905005100", last_pdu.substr(0, 16).c_str());
+
+	sca = "+989350001600";
+	modem.invalidateFacts();
+	send(&modem);
+	TEST_ASSERT_EQUAL_STRING("0791893905006100", last_pdu.substr(0, 16).c_str());
+}
+
+/* while the fact is valid, a job doesn't ask modem again */
+static void test_sca_cached() {
+	MockModem port;
+	script(&port);
+	A6lib modem(&port);
+	TEST_ASSERT_TRUE(modem.setSMSFormat(Format_PDU));
+	modem.setAsyncSMSQueue(true);
+
+	send(&modem);
+	send(&modem);
+	TEST_ASSERT_EQUAL_INT(1, sca_reads);
+}
+
+void run_queue_tests() {
+	RUN_TEST(test_sca_after_invalidate);
+	RUN_TEST(test_sca_cached);
+}
@@ -0,0 +1,119 @@
+/*
+ * The line tokenizer of the command engine: a line still arriving stays out of replies and isn't lost
+ * when a command starts, a notification split across reads is dispatched once, and a line longer than
+ * rx isn't taken for a new line after its head is moved out.
+*/
+
+#include <string>
+
+#include <A6lib.h>
+
+#include "MockModem.h"
+
+#include "tests.h"
+
+static int hits[10];
+static int bad_hits;
+
+static void setUpModem(MockModem* port, A6lib* modem) {
+	for (auto& h : hits)
+		h = 0;
+	bad_hits = 0;
+	port->begin(115200);
+	/* "+QTST: <digit>" lines count in hits, anything else after the prefix is a bogus line */
+	modem->onURC("+QTST", [](void*, const Span& line, const Span&) {
+		const char last = line.data[line.len - 1];
+		if (line.len == 8 && last >= '0' && last <= '9')
+			hits[last - '0']++;
+		else
+			bad_hits++;
+	});
+}
+
+static void run(A6lib* modem, unsigned long ms) {
+	const auto start = millis();
+	while (millis() - start < ms)
+		modem->handle();
+}
+
+/* a reply followed by the head of a notification: the head isn't a part of the reply */
+static void test_partial_line_after_reply() {
+	MockModem port;
+	A6lib modem(&port);
+	setUpModem(&port, &modem);
+	port.on("AT+CSQ", "\r\n+CSQ: 20,0\r\n\r\nOK\r\n\r\n+QTST: 1", 5);
+	String reply;
+	const auto handle = modem.submitCommand("AT+CSQ", "+CSQ", "OK", 2000, 1, &reply);
+	TEST_ASSERT_TRUE(modem.waitForCommand(handle));
+	TEST_ASSERT_EQUAL_INT(-1, reply.indexOf("QTST"));
+	TEST_ASSERT_EQUAL_INT(0, hits[1]);
+
+	port.inject("\r\n", 2);
+	run(&modem, 20);
+	TEST_ASSERT_EQUAL_INT(1, hits[1]);
+	TEST_ASSERT_EQUAL_INT(0, bad_hits);
+}
+
+/* a notification half received when a command starts is kept */
+static void test_partial_line_before_command() {
+	MockModem port;
+	A6lib modem(&port);
+	setUpModem(&port, &modem);
+	port.on("AT+CSQ", "\r\n+CSQ: 20,0\r\n\r\nOK\r\n", 5);
+	port.inject("\r\n+QTST: ", 0);
+	port.inject("2\r\n", 2);
+	delay(1);
+	const auto handle = modem.submitCommand("AT+CSQ", "+CSQ", "OK", 2000, 1, nullptr);
+	TEST_ASSERT_TRUE(modem.waitForCommand(handle));
+	run(&modem, 20);
+	TEST_ASSERT_EQUAL_INT(1, hits[2]);
+	TEST_ASSERT_EQUAL_INT(0, bad_hits);
+}
+
+/* a notification split across reads while idle */
+static void test_split_notification() {
+	MockModem port;
+	A6lib modem(&port);
+	setUpModem(&port, &modem);
+	port.inject("\r\n+QT", 0);
+	port.inject("ST: 3\r", 3);
+	port.inject("\n\r\n+QTST: 4\r\n", 6);
+	run(&modem, 1);
+	TEST_ASSERT_EQUAL_INT(0, hits[3]);
+	run(&modem, 30);
+	TEST_ASSERT_EQUAL_INT(1, hits[3]);
+	TEST_ASSERT_EQUAL_INT(1, hits[4]);
+	TEST_ASSERT_EQUAL_INT(0, bad_hits);
+}
+
+/* a line longer than rx whose tail looks like a notification, then a real one */
+static void test_overlong_line() {
+	MockModem port;
+	A6lib modem(&port);
+	setUpModem(&port, &modem);
+	std::string big(A6_RX_BUFFER_SIZE + 100, 'x');
+	big.replace(A6_RX_BUFFER_SIZE - A6_CMD_MAX_LEN / 2, 8, "+QTST: 5");
+	big.replace(A6_RX_BUFFER_SIZE + 10, 8, "+QTST: 6");
+
+	/* while a command waits, the reply still gets the whole line */
+	port.on("AT+CSQ", "\r\n" + big + "\r\n+CSQ: 20,0\r\n\r\nOK\r\n\r\n+QTST: 1\r\n", 5);
+	String reply;
+	const auto handle = modem.submitCommand("AT+CSQ", "+CSQ", "OK", 2000, 1, &reply);
+	TEST_ASSERT_TRUE(modem.waitForCommand(handle));
+	TEST_ASSERT_TRUE(reply.indexOf(big.c_str()) != -1);
+	run(&modem, 20);
+	TEST_ASSERT_EQUAL_INT(1, hits[1]);
+
+	/* while idle */
+	port.inject("\r\n" + big + "\r\n+QTST: 2\r\n", 1);
+	run(&modem, 20);
+	TEST_ASSERT_EQUAL_INT(1, hits[2]);
+	TEST_ASSERT_EQUAL_INT(0, hits[5] + hits[6] + bad_hits);
+}
+
+void run_tokenizer_tests() {
+	RUN_TEST(test_partial_line_after_reply);
+	RUN_TEST(test_partial_line_before_command);
+	RUN_TEST(test_split_notification);
+	RUN_TEST(test_overlong_line);
+}
@@ -0,0 +1,18 @@
+/*
+ * Host unit tests, run by "pio test -e native" against the Arduino shim and MockModem in native/.
+*/
+
+#ifndef TESTS_H
+#define TESTS_H
+
+#include <unity.h>
+
+/* suites */
+void run_tokenizer_tests();
+void run_pdu_tests();
+void run_gsm7_tests();
+void run_journal_tests();
+void run_payload_tests();
+void run_queue_tests();
+
+#endif // !TESTS_H